@@ -0,0 +1,534 @@
+/**
+ * Compiler Benchmark
+ * - generate: writes a seeded random program that always compiles, sized by the number of functions,
+ *   the if / while nesting depth, the operands per expression, the locals per function and the
+ *   arrays per function; --size=MB keeps adding functions until the source is that big, from KBs
+ *   to hundreds of MBs
+ * - run: generates a fixed suite (same seed --> same sources on every machine), compiles each file
+ *   with --stats --no-parse-tree (plus --flags), keeps each phase's fastest of --repeat runs and
+ *   prints its throughput in source bytes, tokens and AST nodes per second
+ * - A stored baseline (--baseline=FILE) is compared phase by phase: any phase slower than
+ *   --threshold=PCT (that took at least 1 ms) makes run exit with 1; --save-baseline stores this
+ *   run instead
+ * - Build and run from the repo root (the "run benchmark" task does both):
+ *     g++ -std=c++17 -O2 -o compiler compiler.cpp && g++ -std=c++17 -O2 -o benchmark benchmark.cpp
+ *     ./benchmark generate --functions=2000 --depth=3 --expr=8 --vars=6 --arrays=2 --seed=7 big.cp
+ *     ./benchmark generate --size=200 huge.cp
+ *     ./benchmark run [--compiler=./compiler] [--flags="--stream"] [--size=MB] [--repeat=N] [--baseline=FILE] [--save-baseline]
+*/
+
+/* Imports */
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <map>
+#include <algorithm>
+#include <filesystem>
+#include <cstdint>
+#include <cstdlib>
+#include <sys/resource.h>
+using namespace std;
+
+// Shape of a generated program (set from generate's flags)
+struct GeneratorOptions {
+    long functions = 100; // --functions=N
+    int depth = 2; // --depth=N --> if / while nesting inside each function
+    int exprSize = 4; // --expr=N --> operands per expression
+    int vars = 4; // --vars=N --> int locals per function
+    int arrays = 1; // --arrays=N --> int arrays per function (0 --> no array code)
+    int statements = 3; // --statements=N --> statements per block
+    uint64_t seed = 1; // --seed=N
+    double sizeMb = 0; // --size=MB --> add functions until the source is this big (instead of --functions)
+};
+
+const char* const keywords[] = {"def", "int", "double", "if", "then", "fed", "fi", "else", "while", "print", "return", "or", "od", "and", "not", "do"};
+const int arraySize = 16;
+const int groupSize = 8; // function i calls i - 1 within its group, main calls each group's last --> every function is reachable, call chains stay short
+const int valueModulus = 10007; // every assignment is reduced by this, so no value can overflow
+
+// SplitMix64 --> the same sources from a seed with any standard library
+struct Random {
+    uint64_t state;
+
+    explicit Random(uint64_t seed) : state(seed) {}
+
+    uint64_t next() {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    // Uniform in [0, n)
+    int below(int n) {
+        return static_cast<int>(next() % static_cast<uint64_t>(n));
+    }
+};
+
+// prefix + index in letters (identifiers can't hold digits), skipping keywords
+string identifier(char prefix, long index) {
+    string name;
+    for (long i = index + 1; i > 0; i = (i - 1) / 26) name = static_cast<char>('a' + (i - 1) % 26) + name;
+    name = prefix + name;
+    for (const char* keyword : keywords) {
+        if (name == keyword) return name + "z";
+    }
+    return name;
+}
+
+// Writes one function or main at a time
+struct ProgramGenerator {
+    const GeneratorOptions& options;
+    Random random;
+    int loops = 0; // enclosing while loops --> their counters are safe array indexes
+
+    ProgramGenerator(const GeneratorOptions& options) : options(options), random(options.seed) {}
+
+    string literal() {
+        return to_string(1 + random.below(9));
+    }
+
+    // Array index that is always in range
+    string index() {
+        if (loops > 0) return identifier('k', random.below(loops)) + " % " + to_string(arraySize);
+        return to_string(random.below(arraySize));
+    }
+
+    // Variable, literal or array element; a comparison operand can't start with "(" (that reads as a nested bexpr)
+    string operand(bool comparison) {
+        int kind = random.below(options.arrays > 0 ? 4 : 3);
+        if (kind == 0) return literal();
+        if (kind == 3) return identifier('w', random.below(options.arrays)) + "[" + index() + "]";
+        if (kind == 2 && loops > 0) return identifier('k', random.below(loops));
+        if (!comparison && random.below(8) == 0) return "(" + identifier('v', random.below(options.vars)) + " + " + literal() + ")";
+        return identifier('v', random.below(options.vars));
+    }
+
+    // size operands joined by + - * and literal / or %
+    string expression(int size, bool comparison = false) {
+        string text = operand(comparison);
+        for (int i = 1; i < size; i++) {
+            int op = random.below(8);
+            if (op < 3) text += " + " + operand(comparison);
+            else if (op < 5) text += " - " + operand(comparison);
+            else if (op < 6) text += " * " + literal();
+            else if (op < 7) text += " / " + literal();
+            else text += " % " + literal();
+        }
+        return text;
+    }
+
+    string comparison() {
+        static const char* const ops[] = {"<", ">", "==", "<=", ">=", "<>"};
+        int size = max(1, options.exprSize / 2);
+        return expression(size, true) + " " + ops[random.below(6)] + " " + expression(size, true);
+    }
+
+    string condition() {
+        int kind = random.below(6);
+        if (kind == 0) return "(" + comparison() + ") and (" + comparison() + ")";
+        if (kind == 1) return "(" + comparison() + ") or (" + comparison() + ")";
+        if (kind == 2) return "not (" + comparison() + ")";
+        return comparison();
+    }
+
+    void assignment(string& out, const string& indent) {
+        string target = options.arrays > 0 && random.below(3) == 0
+            ? identifier('w', random.below(options.arrays)) + "[" + index() + "]"
+            : identifier('v', random.below(options.vars));
+        out += indent + target + " = (" + expression(options.exprSize) + ") % " + to_string(valueModulus);
+    }
+
+    // options.statements statements at nesting level (deeper levels only get assignments)
+    void block(string& out, int level, const string& indent) {
+        for (int s = 0; s < options.statements; s++) {
+            if (s > 0) out += ";\n";
+            int kind = level < options.depth ? random.below(4) : 0;
+            if (kind <= 1) assignment(out, indent);
+            else if (kind == 2) {
+                out += indent + "if " + condition() + " then\n";
+                block(out, level + 1, indent + "    ");
+                if (random.below(2) == 0) {
+                    out += "\n" + indent + "else\n";
+                    block(out, level + 1, indent + "    ");
+                }
+                out += "\n" + indent + "fi";
+            }
+            else {
+                string counter = identifier('k', loops);
+                out += indent + counter + " = 0;\n";
+                out += indent + "while " + counter + " < " + to_string(2 + random.below(8)) + " do\n";
+                loops++;
+                block(out, level + 1, indent + "    ");
+                loops--;
+                out += ";\n" + indent + "    " + counter + " = " + counter + " + 1\n" + indent + "od";
+            }
+        }
+    }
+
+    // def int qX(int n) ... fed;
+    string function(long number) {
+        string out = "def int " + identifier('q', number) + "(int n)\n    int ";
+        for (int v = 0; v < options.vars; v++) out += identifier('v', v) + ", ";
+        for (int k = 0; k < options.depth; k++) out += identifier('k', k) + ", ";
+        for (int a = 0; a < options.arrays; a++) out += identifier('w', a) + "[" + to_string(arraySize) + "], ";
+        out.resize(out.size() - 2);
+        out += ";\n";
+        for (int v = 0; v < options.vars; v++) out += "    " + identifier('v', v) + " = n + " + to_string(v) + ";\n";
+        for (int a = 0; a < options.arrays; a++) {
+            for (int i = 0; i < arraySize; i++) out += "    " + identifier('w', a) + "[" + to_string(i) + "] = " + literal() + ";\n";
+        }
+        block(out, 0, "    ");
+        string result = expression(options.exprSize);
+        if (number % groupSize != 0) result += " + " + identifier('q', number - 1) + "(n + " + literal() + ")"; // the semantic check rejects locals as arguments
+        else result += " + r"; // reads a global --> no group is pure, so partial evaluation can't fold main into a constant
+        out += ";\n    return (" + result + ") % " + to_string(valueModulus) + "\nfed;\n";
+        return out;
+    }
+
+    // Calls the last function of each group, then prints the sum
+    string main(long functions) {
+        string out = "int r;\nr = 0;\n";
+        for (long f = 0; f < functions; f++) {
+            if (f % groupSize == groupSize - 1 || f == functions - 1) {
+                out += "r = (r + " + identifier('q', f) + "(" + literal() + ")) % " + to_string(valueModulus) + ";\n";
+            }
+        }
+        return out + "print(r).\n";
+    }
+};
+
+// Writes the program for options to path --> its size in bytes (0 if path can't be written)
+uintmax_t generateProgram(const GeneratorOptions& options, const string& path) {
+    ofstream out(path, ios::binary);
+    if (!out) return 0;
+    ProgramGenerator generator(options);
+    uintmax_t bytes = 0;
+    uintmax_t target = static_cast<uintmax_t>(options.sizeMb * 1024 * 1024);
+    long functions = 0;
+    while (target > 0 ? bytes < target : functions < options.functions) {
+        string text = generator.function(functions++);
+        out << text;
+        bytes += text.size();
+    }
+    string text = generator.main(functions);
+    out << text;
+    return out ? bytes + text.size() : 0;
+}
+
+// flag --> value after "--name=" (false if flag isn't --name=...)
+bool flagValue(const string& flag, const string& name, string& value) {
+    string prefix = "--" + name + "=";
+    if (flag.rfind(prefix, 0) != 0) return false;
+    value = flag.substr(prefix.size());
+    return true;
+}
+
+// Sets the generator option for one flag --> false if flag isn't one (or its value isn't a number)
+bool applyGeneratorFlag(const string& flag, GeneratorOptions& options) {
+    string value;
+    try {
+        if (flagValue(flag, "functions", value)) options.functions = stol(value);
+        else if (flagValue(flag, "depth", value)) options.depth = stoi(value);
+        else if (flagValue(flag, "expr", value)) options.exprSize = max(1, stoi(value));
+        else if (flagValue(flag, "vars", value)) options.vars = max(1, stoi(value));
+        else if (flagValue(flag, "arrays", value)) options.arrays = stoi(value);
+        else if (flagValue(flag, "statements", value)) options.statements = max(1, stoi(value));
+        else if (flagValue(flag, "seed", value)) options.seed = stoull(value);
+        else if (flagValue(flag, "size", value)) options.sizeMb = stod(value);
+        else return false;
+    }
+    catch (const logic_error&) {
+        return false; // stoi / stol / stoull / stod
+    }
+    return true;
+}
+
+/**
+ * Stats (the compiler's stats.json)
+ * - Only the fields run uses are read: each phase's wall and CPU ms and the counts
+ * - A baseline file is {"NAME": STATS, ...} with one compiler stats.json per suite program
+*/
+struct Phase {
+    string name;
+    double wallMs = 0;
+    double cpuMs = 0;
+};
+
+struct Stats {
+    vector<Phase> phases;
+    double tokens = 0;
+    double astNodes = 0;
+    double bytes = 0; // source size (written by run, not the compiler)
+};
+
+// Number after "key": at or after from in json (0 if there is none)
+double jsonNumber(const string& json, const string& key, size_t from = 0) {
+    size_t at = json.find("\"" + key + "\":", from);
+    return at == string::npos ? 0 : strtod(json.c_str() + at + key.size() + 3, nullptr);
+}
+
+Stats parseStats(const string& json) {
+    Stats stats;
+    const string marker = "\"name\": \"";
+    for (size_t at = json.find(marker); at != string::npos; at = json.find(marker, at + 1)) {
+        Phase phase;
+        size_t start = at + marker.size();
+        phase.name = json.substr(start, json.find('"', start) - start);
+        phase.wallMs = jsonNumber(json, "wall_ms", at);
+        phase.cpuMs = jsonNumber(json, "cpu_ms", at);
+        stats.phases.push_back(phase);
+    }
+    stats.tokens = jsonNumber(json, "tokens");
+    stats.astNodes = jsonNumber(json, "ast_nodes");
+    stats.bytes = jsonNumber(json, "source_bytes");
+    return stats;
+}
+
+// The {...} that follows "name": in json (empty if there is none)
+string jsonObject(const string& json, const string& name) {
+    size_t at = json.find("\"" + name + "\":");
+    if (at == string::npos || (at = json.find('{', at)) == string::npos) return "";
+    int depth = 0;
+    for (size_t i = at; i < json.size(); i++) {
+        if (json[i] == '{') depth++;
+        else if (json[i] == '}' && --depth == 0) return json.substr(at, i - at + 1);
+    }
+    return "";
+}
+
+bool readFile(const string& path, string& text) {
+    ifstream in(path, ios::binary);
+    if (!in) return false;
+    ostringstream contents;
+    contents << in.rdbuf();
+    text = contents.str();
+    return true;
+}
+
+/**
+ * Suite (run)
+ * - Scales the function count from KBs to a few MBs, then stresses nesting, expression size and
+ *   locals separately; --size=MB adds a program of that size
+*/
+struct SuiteProgram {
+    string name;
+    GeneratorOptions options;
+};
+
+vector<SuiteProgram> benchmarkSuite(double sizeMb) {
+    vector<SuiteProgram> suite(7);
+    suite[0].name = "tiny";
+    suite[0].options.functions = 8;
+    suite[1].name = "small";
+    suite[1].options.functions = 100;
+    suite[2].name = "medium";
+    suite[2].options.functions = 1000;
+    suite[3].name = "large";
+    suite[3].options.sizeMb = 4;
+    suite[4].name = "nested";
+    suite[4].options.functions = 200;
+    suite[4].options.depth = 6;
+    suite[4].options.statements = 2;
+    suite[5].name = "expressions";
+    suite[5].options.functions = 200;
+    suite[5].options.exprSize = 40;
+    suite[6].name = "locals";
+    suite[6].options.functions = 200;
+    suite[6].options.vars = 64;
+    suite[6].options.arrays = 8;
+    for (auto& program : suite) program.options.seed = 471;
+    if (sizeMb > 0) {
+        SuiteProgram sized;
+        sized.name = "size" + to_string(static_cast<long>(sizeMb)) + "mb";
+        sized.options.sizeMb = sizeMb;
+        sized.options.seed = 471;
+        suite.push_back(sized);
+    }
+    return suite;
+}
+
+// "'text'" for the shell
+string shellQuote(const string& text) {
+    string quoted = "'";
+    for (char ch : text) {
+        if (ch == '\'') quoted += "'\\''";
+        else quoted += ch;
+    }
+    return quoted + "'";
+}
+
+// Compiles source repeat times with --stats --> each phase's fastest run (false if a compile failed)
+bool measure(const string& compiler, const string& flags, const string& source, const string& outputDir, int repeat, Stats& best, string& json) {
+    for (int r = 0; r < repeat; r++) {
+        string command = shellQuote(compiler) + " " + flags + " --no-parse-tree --stats -o " + shellQuote(outputDir) + " " + shellQuote(source)
+            + " > " + shellQuote(outputDir + "/log.txt") + " 2>&1";
+        string errors, text;
+        if (system(command.c_str()) != 0 || !readFile(outputDir + "/stats.json", text) || !readFile(outputDir + "/errors.txt", errors) || !errors.empty()) {
+            return false;
+        }
+        Stats stats = parseStats(text);
+        if (r == 0) {
+            best = stats;
+            json = text;
+            continue;
+        }
+        for (size_t p = 0; p < best.phases.size() && p < stats.phases.size(); p++) {
+            best.phases[p].wallMs = min(best.phases[p].wallMs, stats.phases[p].wallMs);
+            best.phases[p].cpuMs = min(best.phases[p].cpuMs, stats.phases[p].cpuMs);
+        }
+    }
+    return true;
+}
+
+// Per second for count things done in ms
+double rate(double count, double ms) {
+    return ms > 0 ? count * 1000.0 / ms : 0;
+}
+
+// Throughput table for stats, with the change against baseline (empty phases --> none stored)
+int printStats(const string& name, const Stats& stats, const Stats& baseline, double threshold) {
+    int regressions = 0;
+    cout << name << ": " << fixed << setprecision(1) << stats.bytes / 1024 << " KB, " << setprecision(0) << stats.tokens << " tokens, "
+         << stats.astNodes << " AST nodes" << endl;
+    cout << left << setw(10) << "Phase" << right << setw(12) << "Wall ms" << setw(10) << "MB/s" << setw(14) << "Ktokens/s" << setw(14)
+         << "Knodes/s" << setw(14) << "Baseline ms" << setw(10) << "Change" << endl;
+    Phase total;
+    total.name = "total";
+    Phase baselineTotal;
+    vector<Phase> rows = stats.phases;
+    for (const auto& phase : stats.phases) total.wallMs += phase.wallMs;
+    for (const auto& phase : baseline.phases) baselineTotal.wallMs += phase.wallMs;
+    rows.push_back(total);
+    for (const auto& phase : rows) {
+        cout << left << setw(10) << phase.name << right << setprecision(3) << setw(12) << phase.wallMs << setprecision(1)
+             << setw(10) << rate(stats.bytes / (1024 * 1024), phase.wallMs) << setw(14) << rate(stats.tokens / 1000, phase.wallMs)
+             << setw(14) << rate(stats.astNodes / 1000, phase.wallMs);
+        const Phase* before = phase.name == "total" && !baseline.phases.empty() ? &baselineTotal : nullptr;
+        for (const auto& old : baseline.phases) {
+            if (old.name == phase.name) before = &old;
+        }
+        if (before && before->wallMs > 0) {
+            double change = 100.0 * (phase.wallMs - before->wallMs) / before->wallMs;
+            cout << setprecision(3) << setw(14) << before->wallMs << setprecision(1) << setw(9) << showpos << change << noshowpos << "%";
+            if (change > threshold && phase.name != "total" && before->wallMs >= 1) { // sub-ms phases are mostly noise
+                cout << "  slower";
+                regressions++;
+            }
+        }
+        cout << endl;
+    }
+    cout << endl;
+    return regressions;
+}
+
+int runSuite(const vector<string>& flags) {
+    string compiler = "./compiler", baselinePath = "benchmark_baseline.json", outputDir = "benchmark_output", compilerFlags;
+    double sizeMb = 0, threshold = 10;
+    int repeat = 3;
+    bool save = false;
+    for (const auto& flag : flags) {
+        string value;
+        try {
+            if (flagValue(flag, "compiler", value)) compiler = value;
+            else if (flagValue(flag, "baseline", value)) baselinePath = value;
+            else if (flagValue(flag, "out", value)) outputDir = value;
+            else if (flagValue(flag, "flags", value)) compilerFlags = value;
+            else if (flagValue(flag, "size", value)) sizeMb = stod(value);
+            else if (flagValue(flag, "threshold", value)) threshold = stod(value);
+            else if (flagValue(flag, "repeat", value)) repeat = max(1, stoi(value));
+            else if (flag == "--save-baseline") save = true;
+            else {
+                cerr << "Unknown option " << flag << endl;
+                return 1;
+            }
+        }
+        catch (const logic_error&) {
+            cerr << "Bad value for " << flag << endl;
+            return 1;
+        }
+    }
+    compiler = filesystem::absolute(compiler).string();
+
+    // Deep fdecls / statement_seq chains recurse once per function and statement --> give the compiler all the stack it may have
+    rlimit stack;
+    if (getrlimit(RLIMIT_STACK, &stack) == 0) {
+        stack.rlim_cur = stack.rlim_max;
+        setrlimit(RLIMIT_STACK, &stack);
+    }
+
+    string baselineJson;
+    bool haveBaseline = !save && readFile(baselinePath, baselineJson);
+    ostringstream saved;
+    saved << "{";
+    int regressions = 0;
+    for (const auto& program : benchmarkSuite(sizeMb)) {
+        string dir = (filesystem::path(outputDir) / program.name).string();
+        string source = dir + ".cp";
+        error_code ignored;
+        filesystem::create_directories(dir, ignored);
+        uintmax_t bytes = generateProgram(program.options, source);
+        Stats stats;
+        string json;
+        if (bytes == 0 || !measure(compiler, compilerFlags, source, dir, repeat, stats, json)) {
+            cerr << program.name << ": compiling " << source << " failed (see " << dir << "/log.txt)" << endl;
+            return 1;
+        }
+        stats.bytes = static_cast<double>(bytes);
+        Stats baseline;
+        if (haveBaseline) baseline = parseStats(jsonObject(baselineJson, program.name));
+        regressions += printStats(program.name, stats, baseline, threshold);
+
+        // Stored with this run's fastest phases and the source size
+        ostringstream phases;
+        phases << fixed << setprecision(6) << "{\n  \"source_bytes\": " << bytes << ",\n  \"phases\": [";
+        for (size_t p = 0; p < stats.phases.size(); p++) {
+            phases << (p ? "," : "") << "\n    {\"name\": \"" << stats.phases[p].name << "\", \"wall_ms\": " << stats.phases[p].wallMs
+                   << ", \"cpu_ms\": " << stats.phases[p].cpuMs << "}";
+        }
+        size_t counts = json.find("\"counts\":");
+        phases << "\n  ],\n  " << (counts != string::npos ? json.substr(counts, json.find('}', counts) - counts + 1) : "\"counts\": {}") << "\n}";
+        saved << (saved.tellp() > 1 ? "," : "") << "\n\"" << program.name << "\": " << phases.str();
+    }
+    saved << "\n}\n";
+
+    if (save) {
+        ofstream(baselinePath) << saved.str();
+        cout << "Saved baseline to " << baselinePath << endl;
+        return 0;
+    }
+    if (!haveBaseline) cout << "No baseline in " << baselinePath << " (--save-baseline stores one)" << endl;
+    else if (regressions > 0) {
+        cout << regressions << " phases slower than the baseline by more than " << threshold << "%" << endl;
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    string command = argc > 1 ? argv[1] : "";
+    vector<string> flags(argv + min(argc, 2), argv + argc);
+    if (command == "run") return runSuite(flags);
+    if (command != "generate" || flags.empty()) {
+        cerr << "Usage: benchmark generate [--functions=N] [--depth=N] [--expr=N] [--vars=N] [--arrays=N] [--statements=N] [--seed=N] [--size=MB] FILE" << endl;
+        cerr << "       benchmark run [--compiler=PATH] [--flags=FLAGS] [--size=MB] [--repeat=N] [--threshold=PCT] [--baseline=FILE] [--save-baseline] [--out=DIR]" << endl;
+        return 1;
+    }
+    GeneratorOptions options;
+    for (size_t i = 0; i + 1 < flags.size(); i++) {
+        if (!applyGeneratorFlag(flags[i], options)) {
+            cerr << "Unknown option " << flags[i] << endl;
+            return 1;
+        }
+    }
+    uintmax_t bytes = generateProgram(options, flags.back());
+    if (bytes == 0) {
+        cerr << "Error writing " << flags.back() << endl;
+        return 1;
+    }
+    cout << "Wrote " << bytes << " bytes to " << flags.back() << endl;
+    return 0;
+}
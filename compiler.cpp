@@ -3,53 +3,182 @@
 #include <fstream>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <cctype> 
 #include <queue>
 #include <array>
 #include <map>
+#include <unordered_map>
+#include <deque>
+#include <set>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cstddef>
 #include <algorithm>
 #include <utility>
+#include <tuple>
 #include <memory>
 #include <optional>
+#include <cmath>
+#include <charconv>
+#include <filesystem>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <iomanip>
+#if defined(__x86_64__) && defined(__unix__)
+#include <sys/mman.h>
+#endif
+#if defined(__unix__)
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <cerrno>
+#include <sys/resource.h>
+#endif
 #include <sstream>
 #include <stdexcept>
+#include "language_tables.h" // table.txt and keywords.txt (generated by generate_tables.cpp)
 using namespace std;
 
 /* Constants and Global Declarations: */ 
 #define MAX_KEYWORDS 100
 #define BUFFER_SIZE 2048
 
-// Lexical Analysis:
-ifstream inputFile;
-ofstream tokenFile;
-ofstream errorFile;
-
-vector<string> keywords(34); // eg. for, do, while, etc...
-array<array<int, 127>, 30> table{}; // transition table for automaton machine (30 states, 127 inputs)
-vector<char> buffer1(BUFFER_SIZE); // Dual buffers for reading 
-vector<char> buffer2(BUFFER_SIZE); 
-vector<char>* currentBuffer = &buffer1;
-
-int character = 0; 
-int line = 0; // track line while parsing
-
 // Syntax Analysis
-ifstream lexemmeFile;
-string tokenVal; // for parsing soruce file
-string tokenType;
 using ProductionRule = vector<string>; // grammer production rule
 using LL1Key = pair<string, string>; // pair of current non terminal and lookahead terminal
 using LL1table = map<LL1Key, ProductionRule>; // sparse ll1 table
-LL1table ll1table;
 
-// Semantic Analysis
-string scope = "global";
+// Language tables (loaded once by languageTables(), then only read so every compilation shares them)
+struct LanguageTables {
+    array<array<int, 127>, 30> table{}; // transition table for automaton machine (30 states, 127 inputs)
+    vector<string> keywords; // eg. for, do, while, etc...
+    LL1table ll1table;
+
+    // Production for <nonTerminal, lookahead> (empty if there is none)
+    const ProductionRule& productions(const string& nonTerminal, const string& lookahead) const {
+        static const ProductionRule none;
+        auto it = ll1table.find({nonTerminal, lookahead});
+        return it == ll1table.end() ? none : it->second;
+    }
+};
+
+// Optimization options (set from command line flags in main)
+struct CompileOptions {
+    bool optimize = true; // -O0 --> skip scalar optimizations and inlining
+    bool inlineFunctions = true; // --no-inline
+    int inlineBudget = 8; // --inline-budget=N --> max quads a callee may add at a call site
+    int inlineCallerLimit = 400; // stop inlining into a caller once it grows past this many quads
+    bool inlineReport = false; // --inline-report --> print every inlining decision
+    bool partialEval = true; // --no-partial-eval
+    bool boundsCheckElimination = true; // --no-bce --> check every array index
+    long evalStepLimit = 100000; // --eval-steps=N --> quads run per compile-time call before giving up
+    int evalDepthLimit = 64; // --eval-depth=N --> nested compile-time calls before giving up
+    bool registerAllocation = true; // -O0 --> every var lives in a stack slot
+    bool allocationReport = false; // --ra-report --> print registers and stack slots per function
+    bool emitTAC = false; // --emit-tac --> write 3TAC to compile.txt instead of ARM
+    bool peephole = true; // -O0 or --no-peephole --> keep the ARM exactly as lowered
+    bool peepholeReport = false; // --peephole-report --> print rewrites per rule
+    bool emitBytecode = false; // --emit-bytecode --> write the VM bytecode to compile.txt instead of ARM
+    bool run = false; // --run --> execute the program on the bytecode VM after compiling
+    bool jit = false; // --jit --> compile hot functions and loops to machine code while running
+    uint32_t jitThreshold = 1000; // --jit-threshold=N --> calls or loop iterations before a function is jitted
+    int maxCallDepth = 1000000; // --max-call-depth=N --> nested VM calls before "call depth exceeded"
+    string target = "arm"; // --target=x86-64 --> write GNU x86-64 assembly to compile.s instead of ARM
+    bool link = false; // --link --> assemble and link compile.s with the runtime into ./compile
+    bool vectorize = true; // -O0 or --no-vectorize --> keep x86-64 loops scalar
+    bool avx2 = false; // --avx2 --> vectorize with 256-bit AVX2 instead of SSE2 (./compile then needs an AVX2 CPU)
+    bool vectorizeReport = false; // --vectorize-report --> print every vectorized loop
+    bool unroll = true; // --no-unroll
+    int unrollFactor = 4; // --unroll-factor=N --> body copies per iteration of a partially unrolled loop
+    int unrollBudget = 128; // --unroll-budget=N --> max quads a fully unrolled loop or a partially unrolled body may take
+    bool unrollReport = false; // --unroll-report --> print every unrolled loop
+    string profileGenerate; // --profile-generate=FILE --> run on the VM and write block, branch and call counts to FILE
+    string profileUse; // --profile-use=FILE --> lay out blocks, inline and allocate registers from FILE's counts
+    string outputDir = "."; // -o DIR --> where tokens.txt, errors.txt, compile.txt, compile.s and compile go
+    int jobs = 0; // -j N or -jN --> files compiled at once in batch mode (0 = hardware threads)
+    string cacheDir; // --cache=DIR --> reuse the outputs of earlier compiles of the same source and options
+    uintmax_t cacheSize = 256u << 20; // --cache-size=MB --> evict least recently used entries past this
+    bool cacheStats = false; // --cache-stats --> print cache hits, misses and evictions
+    bool timeReport = false; // --time-report --> print time, allocations and peak RSS per phase and the token, node, symbol, quad and diagnostic counts
+    bool stats = false; // --stats --> write the same report as JSON to stats.json
+    bool streamFrontEnd = false; // --stream --> lex, parse and build function symbol tables on three threads at once
+    bool parseTree = true; // --no-parse-tree --> don't print the AST (its indentation grows with every function, so large sources spend most of parsing on it)
+};
+
+// File name in options.outputDir
+string outputPath(const CompileOptions& options, const string& name) {
+    return (filesystem::path(options.outputDir) / name).string();
+}
+
+// All of text as a number in [low, high] --> throws invalid_argument otherwise (like stoll on junk)
+long long flagNumber(const string& text, long long low, long long high) {
+    size_t used = 0;
+    long long value = (text.empty() || isspace(static_cast<unsigned char>(text[0]))) ? 0 : stoll(text, &used);
+    if (used == 0 || used != text.size() || value < low || value > high) throw invalid_argument(text);
+    return value;
+}
 
-// Intermediate Code Gen
-ofstream ICGFile; // output file for intermediate code
-// int tempNum = 1; // t1, t2, t3, etc...
-// int labelNum = 1; // lab1, lab2, etc...
-// int loopNum = 1; // loop1, loop2, etc..
+// Sets the option for one optimization / output flag --> false if flag isn't one (or its value isn't a number in range)
+bool applyFlag(const string& flag, CompileOptions& options) {
+    const long long intMax = INT32_MAX;
+    try {
+        if (flag == "-O0") options.optimize = options.registerAllocation = options.peephole = options.vectorize = false;
+        else if (flag == "--no-inline") options.inlineFunctions = false;
+        else if (flag == "--inline-report") options.inlineReport = true;
+        else if (flag.rfind("--inline-budget=", 0) == 0) options.inlineBudget = static_cast<int>(flagNumber(flag.substr(16), 0, intMax));
+        else if (flag == "--no-partial-eval") options.partialEval = false;
+        else if (flag == "--no-bce") options.boundsCheckElimination = false;
+        else if (flag == "--ra-report") options.allocationReport = true;
+        else if (flag == "--emit-tac") options.emitTAC = true;
+        else if (flag == "--no-peephole") options.peephole = false;
+        else if (flag == "--peephole-report") options.peepholeReport = true;
+        else if (flag == "--emit-bytecode") options.emitBytecode = true;
+        else if (flag == "--run") options.run = true;
+        else if (flag == "--jit") options.jit = options.run = true;
+        else if (flag.rfind("--jit-threshold=", 0) == 0) options.jitThreshold = static_cast<uint32_t>(flagNumber(flag.substr(16), 0, UINT32_MAX));
+        else if (flag.rfind("--max-call-depth=", 0) == 0) options.maxCallDepth = static_cast<int>(flagNumber(flag.substr(17), 1, intMax));
+        else if (flag == "--target=arm" || flag == "--target=x86-64") options.target = flag.substr(9);
+        else if (flag == "--link") options.link = true;
+        else if (flag == "--no-vectorize") options.vectorize = false;
+        else if (flag == "--avx2") options.avx2 = true;
+        else if (flag == "--vectorize-report") options.vectorizeReport = true;
+        else if (flag == "--no-unroll") options.unroll = false;
+        else if (flag.rfind("--unroll-factor=", 0) == 0) options.unrollFactor = static_cast<int>(flagNumber(flag.substr(16), 1, intMax));
+        else if (flag.rfind("--unroll-budget=", 0) == 0) options.unrollBudget = static_cast<int>(flagNumber(flag.substr(16), 0, intMax));
+        else if (flag == "--unroll-report") options.unrollReport = true;
+        else if (flag.rfind("--profile-generate=", 0) == 0) {
+            options.profileGenerate = flag.substr(19);
+            options.run = true;
+            options.inlineFunctions = false; // every K_DEF keeps its calls so their counts are exact
+            options.unroll = false; // and every loop its exit test
+        }
+        else if (flag.rfind("--profile-use=", 0) == 0) options.profileUse = flag.substr(14);
+        else if (flag.rfind("--eval-steps=", 0) == 0) options.evalStepLimit = static_cast<long>(flagNumber(flag.substr(13), 0, intMax));
+        else if (flag.rfind("--eval-depth=", 0) == 0) options.evalDepthLimit = static_cast<int>(flagNumber(flag.substr(13), 0, intMax));
+        else if (flag.rfind("--cache=", 0) == 0) options.cacheDir = flag.substr(8);
+        else if (flag.rfind("--cache-size=", 0) == 0) options.cacheSize = static_cast<uintmax_t>(flagNumber(flag.substr(13), 0, INT64_MAX >> 20)) << 20;
+        else if (flag == "--cache-stats") options.cacheStats = true;
+        else if (flag == "--time-report") options.timeReport = true;
+        else if (flag == "--stats") options.stats = true;
+        else if (flag == "--no-parse-tree") options.parseTree = false;
+        else if (flag == "--stream") options.streamFrontEnd = true;
+        else if (flag.rfind("-j", 0) == 0 && flag.size() > 2) options.jobs = static_cast<int>(flagNumber(flag.substr(2), 0, intMax));
+        else return false;
+    }
+    catch (const logic_error&) {
+        return false; // flagNumber
+    }
+    return true;
+}
 
 /* Structs and Enums*/
 enum TokenType {
@@ -156,15 +285,65 @@ struct SymbolEntry {
     string type; // K_DEF, K_IF, K_WHILE, K_INT, K_DOUBLE
     shared_ptr<class SymbolTable> childTable; // child table for new scope (functions, if or while)
     string varName; // symbol name for K_DEF, or K_INT/K_DOUBLE
+    bool isArray = false; // K_INT/K_DOUBLE declared with a [size]
 
-    // Specific to K_IF:
-    union {int intVal; double doubleVal;}; // for int or double var declarations (eg. int x = 4;)
-    
     // Specific to K_DEF
     string returnType; // K_INT or K_DOUBLE
     vector<pair<string, string>> params; // function params (type, var)
 };
 
+/**
+ * Three address code (3TAC) instruction --> dest = arg1 op arg2
+ * - "=": dest = arg1
+ * - "+", "-", "*", "/", "%": dest = arg1 op arg2
+ * - "<", ">", "==", "<=", ">=", "<>", "and", "or": dest = 1 if true else 0
+ * - "not": dest = not arg1
+ * - "=[]": dest = arg1[arg2], "[]=": dest[arg1] = arg2
+ * - "param": push {arg1}, "call": dest = BL arg1 (arg2 = num of args)
+ * - "print": print(arg1), "return": fp - 4 = arg1 then branch to exit
+ * - "label": dest:, "b": b dest
+ * - "beq", "bne", "blt", "bgt", "ble", "bge": cmp arg1, arg2 then branch to dest
+*/
+struct Quad {
+    string op;
+    string dest;
+    string arg1;
+    string arg2;
+    int site = 0; // profile site of labels and conditional branches (negative once the branch is inverted)
+    bool inBounds = false; // "=[]" / "[]=" index proven in range (no bounds check)
+};
+
+struct ICGFunction {
+    string name; // function name (main for global statements)
+    string returnType; // K_INT or K_DOUBLE (empty for main)
+    vector<pair<string, string>> params; // function params (type, var)
+    map<string, string> varTypes; // params, locals and temps --> K_INT or K_DOUBLE
+    map<string, int> arraySizes; // declared array lengths (eg. int a[10])
+    vector<Quad> code;
+
+    // Incrementation Vals
+    int bytesRequired = 0; // total bytes required by function
+    int tempNum = 1; // t1, t2, t3, etc...
+    int labelNum = 1; // lab1, lab2, etc...
+    int loopNum = 1; // loop1, loop2, etc...
+};
+
+struct ICGProgram {
+    map<string, string> globals; // global vars --> K_INT or K_DOUBLE
+    map<string, int> globalArrays; // declared global array lengths
+    map<string, string> returnTypes; // function name --> K_INT or K_DOUBLE
+    vector<ICGFunction> functions; // main is always last
+    int siteNum = 0; // profile sites numbered so far
+};
+
+// Counts read back from a --profile-generate run (--profile-use)
+struct Profile {
+    bool loaded = false;
+    map<string, uint64_t> calls; // function --> times entered
+    map<int, uint64_t> labels; // label site --> times reached
+    map<int, pair<uint64_t, uint64_t>> branches; // branch site --> (executed, taken)
+};
+
 /* Classes */
 class SymbolTable {
 public:
@@ -218,6 +397,7 @@ public:
     vector<char> buffer;
     int line; // line and char where token starts
     int character;
+    int constant = -1; // constant pool entry of a T_INT / T_DOUBLE
 
     // Constructor to initialize the Token
     Token() : line(0), character(0) {
@@ -269,15 +449,540 @@ public:
     }
 };
 
+// "00" to "99" so ints are formatted two digits at a time
+const char digitPairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+// Writes value's digits so they end just before end --> where they start (needs 11 chars)
+char* formatIntBackward(int32_t value, char* end) {
+    uint32_t magnitude = (value < 0) ? 0u - static_cast<uint32_t>(value) : static_cast<uint32_t>(value);
+    char* p = end;
+    while (magnitude >= 100) {
+        const char* pair = digitPairs + (magnitude % 100) * 2;
+        magnitude /= 100;
+        *--p = pair[1];
+        *--p = pair[0];
+    }
+    if (magnitude >= 10) {
+        *--p = digitPairs[magnitude * 2 + 1];
+        *--p = digitPairs[magnitude * 2];
+    }
+    else *--p = static_cast<char>('0' + magnitude);
+    if (value < 0) *--p = '-';
+    return p;
+}
+
+/**
+ * Shortest text that reads back as value --> end of the text (needs 32 chars)
+ * - The digits come from to_chars (Ryu in libstdc++) and are laid out like %g at that many
+ *   digits, so 1.5e+07 and 0.30000000000000004, plus ".0" if there's no point or exponent
+ * - Same layout as cp471_print_double in the x86-64 runtime
+*/
+char* formatDoubleTo(double value, char* out) {
+    if (!isfinite(value)) {
+        const char* text = isnan(value) ? (signbit(value) ? "-nan.0" : "nan.0") : (value < 0 ? "-inf.0" : "inf.0");
+        return copy(text, text + strlen(text), out);
+    }
+    char scientific[32];
+    char* end = to_chars(scientific, scientific + sizeof(scientific), value, chars_format::scientific).ptr;
+
+    // "-d.ddde+XX" --> sign, significant digits and decimal exponent
+    const char* p = scientific;
+    if (*p == '-') *out++ = *p++;
+    char digits[20];
+    int count = 0;
+    for (; *p != 'e'; p++) {
+        if (*p != '.') digits[count++] = *p;
+    }
+    int exponent = 0;
+    from_chars(p + 1 + (p[1] == '+'), end, exponent);
+
+    if (exponent < -4 || exponent >= count) {
+        *out++ = digits[0];
+        if (count > 1) {
+            *out++ = '.';
+            out = copy(digits + 1, digits + count, out);
+        }
+        *out++ = 'e';
+        *out++ = (exponent < 0) ? '-' : '+';
+        int magnitude = abs(exponent);
+        if (magnitude >= 100) *out++ = static_cast<char>('0' + magnitude / 100);
+        *out++ = digitPairs[magnitude % 100 * 2];
+        *out++ = digitPairs[magnitude % 100 * 2 + 1];
+        return out;
+    }
+    if (exponent < 0) {
+        *out++ = '0';
+        *out++ = '.';
+        out = fill_n(out, -exponent - 1, '0');
+        return copy(digits, digits + count, out);
+    }
+    out = copy(digits, digits + exponent + 1, out);
+    *out++ = '.';
+    if (count > exponent + 1) return copy(digits + exponent + 1, digits + count, out);
+    *out++ = '0';
+    return out;
+}
+
+// Shortest literal that reads back as the same double (always keeps a decimal point)
+string formatDouble(double value) {
+    char buffer[32];
+    return string(buffer, formatDoubleTo(value, buffer));
+}
+
+/**
+ * Constant pool
+ * - T_INT / T_DOUBLE lexemes are converted once with from_chars when they are lexed and interned
+ *   here, one entry per distinct type and value (ints wrap to 32 bits like the target machine)
+ * - Literal operands in the AST and 3TAC are an entry's canonical text, so later phases get values
+ *   with literalConstant (a lookup, not a conversion) and folded results are interned as well
+ * - The VM and x86-64 backends keep their constant registers / .rodata doubles per entry index
+*/
+struct Constant {
+    bool isDouble = false;
+    int32_t intValue = 0; // doubles truncated (like D2I) when in range
+    double doubleValue = 0; // ints too (int literals in double expressions)
+    string text; // canonical literal: formatInt / formatDouble of the value
+};
+
+struct ConstantPool {
+    deque<Constant> entries; // references stay valid as the pool grows
+    map<pair<bool, uint64_t>, int> byValue; // (is double, value bits) --> entry
+    unordered_map<string, int> byText; // canonical text and the lexemes seen --> entry
+
+    int intern(int32_t value) {
+        return add(false, static_cast<uint32_t>(value), [&](Constant& constant) {
+            constant.intValue = value;
+            constant.doubleValue = value;
+            constant.text = to_string(value);
+        });
+    }
+
+    int intern(double value) {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        return add(true, bits, [&](Constant& constant) {
+            constant.isDouble = true;
+            constant.doubleValue = value;
+            if (value > INT32_MIN - 1.0 && value < INT32_MAX + 1.0) constant.intValue = static_cast<int32_t>(value);
+            constant.text = formatDouble(value);
+        });
+    }
+
+    // Converts literal text [first, last) --> entry (-1 if it isn't a number or out of range)
+    int parse(const char* first, const char* last, bool isDouble) {
+        if (isDouble) {
+            double value = 0;
+            auto result = from_chars(first, last, value);
+            if (result.ec != errc() || result.ptr != last) return -1;
+            return intern(value);
+        }
+        long long value = 0;
+        auto result = from_chars(first, last, value);
+        if (result.ec != errc() || result.ptr != last || value < INT32_MIN || value > INT32_MAX) return -1;
+        return intern(static_cast<int32_t>(value));
+    }
+
+    // Entry for literal text, converted only the first time the text is seen
+    int lookup(const string& text) {
+        auto it = byText.find(text);
+        if (it != byText.end()) return it->second;
+        int index = parse(text.data(), text.data() + text.size(), text.find_first_of(".eE") != string::npos);
+        if (index >= 0) byText[text] = index;
+        return index;
+    }
+
+private:
+    template <typename Fill>
+    int add(bool isDouble, uint64_t bits, Fill fill) {
+        auto it = byValue.find({isDouble, bits});
+        if (it != byValue.end()) return it->second;
+        int index = static_cast<int>(entries.size());
+        entries.emplace_back();
+        fill(entries.back());
+        byValue[{isDouble, bits}] = index;
+        byText[entries.back().text] = index;
+        return index;
+    }
+};
+
+/**
+ * Phase Instrumentation (--time-report, --stats)
+ * - Each phase (lex, parse, symtab, semantic, icg, optimize, backend, run) records its wall time, the
+ *   CPU time and allocations of the compiling thread plus any worker it ran (the VM thread, --stream's
+ *   lexer and symbol threads), and the peak RSS after it
+ * - Allocations are counted by the replaced global operator new, per thread so batch jobs and server
+ *   connections count their own; a program embedding the library (CP471_LIBRARY) keeps its own
+ *   operator new, so its reports show 0 allocations
+ * - Peak RSS is the process's (getrusage), so in a batch it covers every job that ran before
+*/
+thread_local uint64_t allocationCount = 0;
+thread_local uint64_t allocatedBytes = 0;
+
+#ifndef CP471_LIBRARY
+void* operator new(size_t size) {
+    allocationCount++;
+    allocatedBytes += size;
+    if (void* memory = malloc(size ? size : 1)) return memory;
+    throw bad_alloc();
+}
+
+// noinline --> GCC would otherwise see free() on a pointer from operator new and warn
+__attribute__((noinline)) void operator delete(void* memory) noexcept {
+    free(memory);
+}
+
+__attribute__((noinline)) void operator delete(void* memory, size_t) noexcept {
+    free(memory);
+}
+#endif
+
+// CPU time of this thread in ms
+double threadCpuMs() {
+#if defined(__unix__)
+    timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1e6;
+#else
+    return 1000.0 * clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+// Peak resident set size of the process in KB (0 if unknown)
+long peakRssKb() {
+#if defined(__unix__)
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+#else
+    return 0;
+#endif
+}
+
+// This thread's CPU time and allocations so far (a worker takes one when it starts and one when it's done)
+struct ThreadUsage {
+    double cpuMs = threadCpuMs();
+    uint64_t allocations = allocationCount;
+    uint64_t bytes = allocatedBytes;
+};
+
+struct PhaseStats {
+    string name;
+    double wallMs = 0;
+    double cpuMs = 0; // compiling thread and its workers
+    uint64_t allocations = 0;
+    uint64_t allocatedBytes = 0;
+    long peakRssKb = 0; // process, after the phase
+};
+
+struct CompileStats {
+    vector<PhaseStats> phases;
+    size_t tokens = 0;
+    size_t astNodes = 0;
+    size_t symbols = 0; // entries in every scope
+    size_t quads = 0; // 3TAC after ICG
+    size_t optimizedQuads = 0; // 3TAC after the optimizer
+    size_t diagnostics = 0; // lines in errors.txt
+
+    // Ends the running phase (if any) and starts timing name
+    void start(const string& name) {
+        stop();
+        running = true;
+        phases.push_back(PhaseStats());
+        phases.back().name = name;
+        wallStart = chrono::steady_clock::now();
+        cpuStart = threadCpuMs();
+        allocationsStart = allocationCount;
+        bytesStart = allocatedBytes;
+    }
+
+    void stop() {
+        if (!running) return;
+        running = false;
+        PhaseStats& phase = phases.back();
+        phase.wallMs = chrono::duration<double, milli>(chrono::steady_clock::now() - wallStart).count();
+        phase.cpuMs = threadCpuMs() - cpuStart + workerCpuMs;
+        phase.allocations = allocationCount - allocationsStart + workerAllocations;
+        phase.allocatedBytes = allocatedBytes - bytesStart + workerBytes;
+        phase.peakRssKb = peakRssKb();
+        workerCpuMs = 0;
+        workerAllocations = workerBytes = 0;
+    }
+
+    // Adds what another thread did between start and end for the running phase (call once it's joined)
+    void addWorker(const ThreadUsage& start, const ThreadUsage& end) {
+        workerCpuMs += end.cpuMs - start.cpuMs;
+        workerAllocations += end.allocations - start.allocations;
+        workerBytes += end.bytes - start.bytes;
+    }
+
+private:
+    bool running = false;
+    chrono::steady_clock::time_point wallStart;
+    double cpuStart = 0, workerCpuMs = 0;
+    uint64_t allocationsStart = 0, bytesStart = 0, workerAllocations = 0, workerBytes = 0;
+};
+
+// Passes everything on to target and counts the lines (the diagnostics written to errors.txt)
+struct LineCounter : streambuf {
+    streambuf* target;
+    size_t lines = 0;
+
+    explicit LineCounter(streambuf* buffer) : target(buffer) {}
+
+protected:
+    int overflow(int ch) override {
+        if (ch == traits_type::eof()) return 0;
+        if (ch == '\n') lines++;
+        return target->sputc(static_cast<char>(ch));
+    }
+
+    streamsize xsputn(const char* text, streamsize size) override {
+        lines += count(text, text + size, '\n');
+        return target->sputn(text, size);
+    }
+
+    int sync() override { return target->pubsync(); }
+
+    pos_type seekoff(off_type offset, ios_base::seekdir dir, ios_base::openmode which) override {
+        return target->pubseekoff(offset, dir, which); // tellp() on errorFile
+    }
+};
+
+// Nodes in the tree under node
+size_t countNodes(const shared_ptr<ASTNode>& node) {
+    if (!node) return 0;
+    size_t count = 1;
+    for (const auto& child : node->children) count += countNodes(child);
+    return count;
+}
+
+// Entries in table and the function scopes under it
+size_t countSymbols(const SymbolTable& table) {
+    size_t count = table.table.size();
+    for (const auto& entry : table.table) {
+        if (entry.second.childTable) count += countSymbols(*entry.second.childTable);
+    }
+    return count;
+}
+
+size_t countQuads(const vector<ICGFunction>& functions) {
+    size_t count = 0;
+    for (const auto& fn : functions) count += fn.code.size();
+    return count;
+}
+
+// Table of phases then the counts (--time-report)
+void printTimeReport(const CompileStats& stats, ostream& out) {
+    PhaseStats total;
+    total.name = "total";
+    ios_base::fmtflags flags = out.flags();
+    out << fixed << setprecision(3);
+    out << left << setw(10) << "Phase" << right << setw(12) << "Wall ms" << setw(12) << "CPU ms" << setw(12) << "Allocs"
+        << setw(14) << "Alloc KB" << setw(14) << "Peak RSS KB" << endl;
+    auto row = [&](const PhaseStats& phase) {
+        out << left << setw(10) << phase.name << right << setw(12) << phase.wallMs << setw(12) << phase.cpuMs << setw(12)
+            << phase.allocations << setw(14) << phase.allocatedBytes / 1024.0 << setw(14) << phase.peakRssKb << endl;
+    };
+    for (const auto& phase : stats.phases) {
+        row(phase);
+        total.wallMs += phase.wallMs;
+        total.cpuMs += phase.cpuMs;
+        total.allocations += phase.allocations;
+        total.allocatedBytes += phase.allocatedBytes;
+        total.peakRssKb = max(total.peakRssKb, phase.peakRssKb);
+    }
+    row(total);
+    out.flags(flags);
+    out << "Counts: " << stats.tokens << " tokens, " << stats.astNodes << " AST nodes, " << stats.symbols << " symbols, "
+        << stats.quads << " IR quads (" << stats.optimizedQuads << " optimized), " << stats.diagnostics << " diagnostics" << endl;
+}
+
+// The same report as JSON (--stats)
+string statsJson(const CompileStats& stats) {
+    ostringstream json;
+    json << setprecision(6) << fixed;
+    json << "{\n  \"phases\": [";
+    for (size_t i = 0; i < stats.phases.size(); i++) {
+        const PhaseStats& phase = stats.phases[i];
+        json << (i ? "," : "") << "\n    {\"name\": \"" << phase.name << "\", \"wall_ms\": " << phase.wallMs << ", \"cpu_ms\": " << phase.cpuMs
+             << ", \"allocations\": " << phase.allocations << ", \"allocated_bytes\": " << phase.allocatedBytes
+             << ", \"peak_rss_kb\": " << phase.peakRssKb << "}";
+    }
+    json << "\n  ],\n  \"counts\": {\"tokens\": " << stats.tokens << ", \"ast_nodes\": " << stats.astNodes << ", \"symbols\": " << stats.symbols
+         << ", \"ir_quads\": " << stats.quads << ", \"optimized_quads\": " << stats.optimizedQuads << ", \"diagnostics\": " << stats.diagnostics << "}\n}\n";
+    return json.str();
+}
+
+/**
+ * Streaming Front End (--stream)
+ * - The lexer runs on its own thread and pushes compact tokens (type and text) into a lock-free
+ *   single producer / single consumer ring; the parser pops them as they come instead of waiting
+ *   for the whole token list
+ * - Each fdec is handed to a symbol worker through a second ring as soon as it's parsed, and the
+ *   worker builds its symbol table while the parser goes on with the next one
+ * - Type checking needs every signature and the globals (declared after the last fdec), so
+ *   semantic analysis still runs once the parse is done
+ * - The parser's errors are held back and written after the lexer's, like a sequential compile
+ *   (which lexes everything first), so errors.txt and every output are the same as without --stream
+*/
+template <typename T>
+struct SpscRing {
+    explicit SpscRing(size_t capacity) : slots(capacity), mask(capacity - 1) {} // capacity is a power of 2
+
+    // Producer thread only --> false if the ring is full
+    bool tryPush(T& value) {
+        size_t tail = this->tail.load(memory_order_relaxed);
+        if (tail - headSeen == slots.size()) {
+            headSeen = head.load(memory_order_acquire);
+            if (tail - headSeen == slots.size()) return false;
+        }
+        slots[tail & mask] = move(value);
+        this->tail.store(tail + 1, memory_order_release);
+        return true;
+    }
+
+    // Consumer thread only --> false if the ring is empty
+    bool tryPop(T& value) {
+        size_t head = this->head.load(memory_order_relaxed);
+        if (head == tailSeen) {
+            tailSeen = tail.load(memory_order_acquire);
+            if (head == tailSeen) return false;
+        }
+        value = move(slots[head & mask]);
+        this->head.store(head + 1, memory_order_release);
+        return true;
+    }
+
+    // Waits while full / empty (yielding, so one core still runs the other side)
+    void push(T value) {
+        while (!tryPush(value)) this_thread::yield();
+    }
+
+    T pop() {
+        T value;
+        while (!tryPop(value)) this_thread::yield();
+        return value;
+    }
+
+private:
+    vector<T> slots;
+    size_t mask;
+    alignas(64) atomic<size_t> head{0}; // next slot the consumer reads
+    size_t tailSeen = 0; // consumer's last read of tail
+    alignas(64) atomic<size_t> tail{0}; // next slot the producer writes
+    size_t headSeen = 0; // producer's last read of head
+};
+
+// Token as it crosses the ring (T_EOF --> the lexer is done)
+struct CompactToken {
+    TokenType type = T_EOF;
+    uint32_t length = 0;
+    const char* text = nullptr; // in the lexer's TextArena (literals: their canonical text)
+};
+
+// Lexeme text in blocks that never move, so the parser reads it while the lexer appends
+struct TextArena {
+    vector<unique_ptr<char[]>> blocks; // lexer thread only
+    char* next = nullptr;
+    size_t left = 0;
+
+    const char* add(const char* text, size_t length) {
+        if (length > left) {
+            left = max<size_t>(length, 1 << 16);
+            blocks.emplace_back(new char[left]);
+            next = blocks.back().get();
+        }
+        char* start = next;
+        memcpy(start, text, length);
+        next += length;
+        left -= length;
+        return start;
+    }
+};
+
+// Parser's side of the token ring
+struct TokenStream {
+    SpscRing<CompactToken> ring{1 << 12};
+    CompactToken current; // token parseTokens returned last (T_EOF once the lexer is done)
+    bool started = false;
+    size_t tokens = 0; // popped so far
+};
+
+/**
+ * Compiler Context
+ * - Everything one compilation reads and writes: its options, the lexer and parser position, the
+ *   current scope, the output streams, the profile and the constant pool
+ * - Every phase takes the context as a parameter (the backends' generators keep a reference, the VM
+ *   just its options), so nothing else is global and mutable and N threads can compile N sources at once
+*/
+struct CompilerContext {
+    CompileOptions options;
+    const LanguageTables& tables;
+
+    // Lexical Analysis
+    istream& inputFile;
+    ostream* tokenFile = nullptr; // tokens.txt (nullptr --> not written)
+    LineCounter errorLines; // counts what goes to errorFile
+    ostream errorFile; // errors.txt
+    int line = 0; // track line while parsing
+    vector<Token> tokenList;
+
+    // Syntax Analysis
+    size_t nextToken = 0; // tokenList index parseTokens reads next
+    size_t tokenEnd = SIZE_MAX; // parseTokens reads "$" from here on (parsing one function of an incremental compile)
+    TokenStream* tokenStream = nullptr; // --stream: parseTokens pops the lexer thread's ring instead of reading tokenList
+    function<void(const shared_ptr<ASTNode>&)> functionParsed; // --stream: gets each fdec as soon as it's parsed
+    string tokenVal; // for parsing soruce file
+    string tokenType;
+    bool sourceEnded = false; // "$" came while a symbol was still pending (reported once)
+
+    // Semantic Analysis
+    string scope = "global";
+
+    // Optimization
+    Profile profile; // --profile-use counts
+    ConstantPool constantPool;
+
+    // Console output (cout and cerr, or a batch job's stdout.txt)
+    ostream& out;
+    ostream& err;
+
+    // --time-report / --stats
+    CompileStats stats;
+
+    CompilerContext(const CompileOptions& options, const LanguageTables& tables, istream& inputFile, ostream& errors, ostream& out, ostream& err)
+        : options(options), tables(tables), inputFile(inputFile), errorLines(errors.rdbuf()), errorFile(&errorLines), out(out), err(err) {}
+};
+
+// Pool entry of a literal operand
+const Constant& literalConstant(CompilerContext& ctx, const string& literal) {
+    int index = ctx.constantPool.lookup(literal);
+    if (index < 0) throw invalid_argument("not a literal: " + literal);
+    return ctx.constantPool.entries[index];
+}
+
+// Canonical text of an int (wrapped to 32 bits like the target machine) or double value, interned
+// so reading it back is a lookup
+string intLiteralText(CompilerContext& ctx, long long value) {
+    return ctx.constantPool.entries[ctx.constantPool.intern(static_cast<int32_t>(static_cast<uint32_t>(value)))].text;
+}
+
+string doubleLiteralText(CompilerContext& ctx, double value) {
+    return ctx.constantPool.entries[ctx.constantPool.intern(value)].text;
+}
+
 /* Functions */
 // Parse source code for chars and return tokens
-Token getNextToken() {
+Token getNextToken(CompilerContext& ctx) {
     Token token; // Token now uses its default constructor for initialization
     int currentState = 0;
     char currentChar;
     int character = 0; // track token positions
 
-    while (inputFile.get(currentChar)) { 
+    while (ctx.inputFile.get(currentChar)) { 
         int ascii = static_cast<int>(currentChar); // Use static_cast for conversions in C++
         // cout << "Token: " << currentChar << " --> ascii: " << ascii << ", currentState = " << currentState << endl;
         /* Return current token given following cases
@@ -287,7 +992,7 @@ Token getNextToken() {
          */
         if ((currentState == 1 || currentState == 5 || currentState == 6) && (ascii < 60 || ascii > 62)) {
             // cout << "Return " << currentChar << " w/ ascii = " << ascii << " back to the file stream" << endl;
-            inputFile.unget();
+            ctx.inputFile.unget();
 
             // Determining Token Type:
             if (currentState == 1) token.type = TokenType::K_LS_THEN;
@@ -295,26 +1000,32 @@ Token getNextToken() {
             else if (currentState == 6) token.type = TokenType::K_GT_THEN;
 
             token.character = character;
-            token.line = line;
+            token.line = ctx.line;
             return token;
         }
 
-        else if ((currentState == 13 || currentState == 15 || currentState == 18) && (ascii <  48 || ascii > 57) && (ascii != 46) && (ascii != 69)&& (ascii != 101)) {
+        else if ((currentState == 13 || currentState == 15 || currentState == 18) && (ascii <  48 || ascii > 57) && (ascii != 46 || currentState != 13) && (ascii != 69)&& (ascii != 101)) { // "." only continues an int
             // cout << "Return " << currentChar << " w/ ascii = " << ascii << " back to the file stream" << endl;
-            inputFile.unget();
+            ctx.inputFile.unget();
             if (currentState == 13) token.type = TokenType::T_INT;
             else if (currentState == 15 || currentState == 18) token.type = TokenType::T_DOUBLE;
+
+            // Converted once here, the lexeme then reads back as its constant pool entry
+            token.constant = ctx.constantPool.parse(token.buffer.data(), token.buffer.data() + token.buffer.size(), token.type == TokenType::T_DOUBLE);
+            string lexeme(token.buffer.begin(), token.buffer.end());
+            if (token.constant >= 0) ctx.constantPool.byText[lexeme] = token.constant;
+            else ctx.errorFile << "Lexical Error: literal " << lexeme << " out of range on line " << ctx.line + 1 << endl;
             token.character = character;
-            token.line = line;
+            token.line = ctx.line;
             return token;
         }
 
         else if ((currentState == 10) && (ascii < 97 || ascii > 122)) {
             // cout << "Return " << currentChar << " w/ ascii = " << ascii << " back to the file stream" << endl;
-            inputFile.unget(); // Put character back into stream
-            token.determineType(keywords);      
+            ctx.inputFile.unget(); // Put character back into stream
+            token.determineType(ctx.tables.keywords);      
             token.character = character;   
-            token.line = line;   
+            token.line = ctx.line;   
             return token;
         }
 
@@ -322,33 +1033,33 @@ Token getNextToken() {
         // If a-z --> set state = 10
         // If e and currentState = 15 --> set state = 16
         else if (ascii >= 97 && ascii <= 122) {
-            if (currentState == 15 && ascii == 101) currentState = table[currentState][101];
-            else currentState = table[currentState][97];
+            if (currentState == 15 && ascii == 101) currentState = ctx.tables.table[currentState][101];
+            else currentState = ctx.tables.table[currentState][97];
             // cout << "Token: " << currentChar << " w/ ascii: " << ascii << " is a-z --> currentState = " << currentState << endl;
         }
         
         // If ws or \n --> set state 100, 
         else if (ascii == 32 || ascii == 10) {
-            if (ascii == 10) line += 1; // increment line count
-            currentState = table[currentState][ascii];
+            if (ascii == 10) ctx.line += 1; // increment line count
+            currentState = ctx.tables.table[currentState][ascii];
             // cout << "Token: " << currentChar << " w/ ascii: " << ascii << " is ws --> currentState = " << currentState << endl;
         }
 
         // Double Logic:
         else if (ascii >= 48 && ascii <= 57) {
-            currentState = table[currentState][48];
+            currentState = ctx.tables.table[currentState][48];
             // cout << "Token: " << currentChar << " w/ ascii: " << ascii << " is 0-9 --> currentState = " << currentState << endl;
         }
 
         // If E --> follow transition table with low e (accepted with double)
         else if (ascii == 69) {
-            currentState = table[currentState][101];
+            currentState = ctx.tables.table[currentState][101];
             // cout << "Token: " << currentChar << " w/ ascii: " << ascii << " is E --> currentState = " << currentState << endl;
         }
 
         // If +, -, .  --> follow transition table (accepted with double)
         else if (ascii == 43 || ascii == 45 || ascii == 46) {
-            currentState = table[currentState][ascii];
+            currentState = ctx.tables.table[currentState][ascii];
             if (currentState == 0) {
                 token.buffer.push_back(currentChar);
                 
@@ -357,20 +1068,20 @@ Token getNextToken() {
                 else if (ascii == 45) token.type = TokenType::K_MINUS;
                 else if (ascii == 46) token.type = TokenType::K_DOT;
                 token.character = character;
-                token.line = line;
+                token.line = ctx.line;
                 return token;
             }
             // cout << "Token: " << currentChar << " w/ ascii: " << ascii << " is +-. --> currentState = " << currentState << endl;
         }
 
         else if (ascii >= 60 && ascii <= 62) {
-            currentState = table[currentState][ascii];
+            currentState = ctx.tables.table[currentState][ascii];
             // cout << "Token: " << currentChar << " w/ ascii: " << ascii << " is <,>,= --> currentState = " << currentState << endl;
         }
             
         // other special
         else {
-            currentState = table[currentState][50];
+            currentState = ctx.tables.table[currentState][50];
             // cout << "Token: " << currentChar << " w/ ascii: " << ascii << " is other --> currentState = " << currentState << endl;
         }        
 
@@ -402,7 +1113,7 @@ Token getNextToken() {
             else if (ascii == 47) token.type = TokenType::K_DIVIDE;
 
             token.character = character;
-            token.line = line;
+            token.line = ctx.line;
             return token;
         }
 
@@ -417,7 +1128,7 @@ Token getNextToken() {
             else if (currentState == 9) token.type = TokenType::K_EQL_TO;
 
             token.character = character;
-            token.line = line;
+            token.line = ctx.line;
             return token;
         }
 
@@ -429,15 +1140,15 @@ Token getNextToken() {
             else if (currentState == 8) token.type = TokenType::K_LS_THEN;
 
             token.character = character;
-            token.line = line;
+            token.line = ctx.line;
             return token;
         }
 
         // Accept Identifer if at 100
         else if (currentState == 100) {
-            token.determineType(keywords);     
+            token.determineType(ctx.tables.keywords);     
             token.character = character;   
-            token.line = line;
+            token.line = ctx.line;
             return token;
         }
 
@@ -447,57 +1158,80 @@ Token getNextToken() {
     return token;
 }
 
-// Read each token from tokens.txt and update references. Once empty return $ token
-void parseTokens() {
-    string line;
-    if (getline(lexemmeFile, line)) {
-        istringstream iss(line.substr(1, line.size() - 2)); // Remove < and >
-        string val, type;
-        getline(iss, val, ',');
-        getline(iss, type);
-        type.erase(0, 1); // Remove leading space
-        
-        tokenVal = val;
-        tokenType = type;
+// Read the next token from the lexer's token list and update references. Once empty return $ token
+// (after the closing K_DOT, or wherever the source was cut off)
+void parseTokens(CompilerContext& ctx) {
+    if (ctx.tokenStream) {
+        // Streamed --> pop until the lexer's T_EOF, then $ from then on
+        TokenStream& stream = *ctx.tokenStream;
+        if (!stream.started || stream.current.type != T_EOF) {
+            stream.current = stream.ring.pop();
+            stream.started = true;
+        }
+        if (stream.current.type != T_EOF) {
+            ctx.tokenVal.assign(stream.current.text, stream.current.length);
+            ctx.tokenType = tokenTypeToString(stream.current.type);
+            stream.tokens++;
+            return;
+        }
+        ctx.tokenVal = "";
+        ctx.tokenType = "$";
+        return;
+    }
+    if (ctx.nextToken < ctx.tokenList.size() && ctx.nextToken < ctx.tokenEnd) {
+        const Token& token = ctx.tokenList[ctx.nextToken++];
+
+        // Literals carry their constant pool entry's canonical text (no conversion, the lexer interned the lexeme)
+        if (token.constant >= 0) ctx.tokenVal = ctx.constantPool.entries[token.constant].text;
+        else ctx.tokenVal.assign(token.buffer.begin(), token.buffer.end());
+        ctx.tokenType = tokenTypeToString(token.type);
     }
     else {
-        tokenVal = "";
-        tokenType = "$"; // end of source file
+        ctx.tokenVal = "";
+        ctx.tokenType = "$"; // end of source file
     }
 }
 
 // Debugging
-void printAST(const shared_ptr<ASTNode>& node, int level = 0) {
+void printAST(const shared_ptr<ASTNode>& node, ostream& out, int level = 0) {
     if (!node) return; // Guard against null pointers
 
     // Print the current node with indentation based on its level in the tree
-    cout << string(level * 2, ' ') << node->typeName(); // Indent based on level
+    out << string(level * 2, ' ') << node->typeName(); // Indent based on level
     if (!node->value.empty()) {
-        cout << " (Value: " << node->value << ")";
+        out << " (Value: " << node->value << ")";
     } 
-    cout << endl;
+    out << endl;
 
     // Recursively print each child
     for (const auto& child : node->children) {
-        printAST(child, level + 1); // Increase level for child nodes
+        printAST(child, out, level + 1); // Increase level for child nodes
     }
 }
 
 // Recursively decend and match tokens:
-void recursiveDecent(const string& currProd, shared_ptr<ASTNode> currentNode, shared_ptr<ASTNode> debugRoot) {
-    if (tokenType == "$") return; // stop Decent if source file empty
-    else if (tokenType == " K_COMMA") {
-        tokenType = "K_COMMA";
-        tokenVal = ",";
+void recursiveDecent(CompilerContext& ctx, const string& currProd, shared_ptr<ASTNode> currentNode, shared_ptr<ASTNode> debugRoot) {
+    // Source ended with currProd still pending --> log once, then unwind
+    // (currProd would have ended at a K_DOT --> only the closing "." is missing, else a statement was cut off)
+    if (ctx.tokenType == "$" && ctx.tables.productions(currProd, "$").empty()) {
+        if (ctx.sourceEnded) return;
+        if (currProd == "K_DOT" || !ctx.tables.productions(currProd, "K_DOT").empty()) ctx.errorFile << "Syntax Error: Missing . at the end of the program" << endl;
+        else ctx.errorFile << "Syntax Error: Source ended before " << currProd << " was complete" << endl;
+        ctx.sourceEnded = true;
+        return;
+    }
+    else if (ctx.tokenType == " K_COMMA") {
+        ctx.tokenType = "K_COMMA";
+        ctx.tokenVal = ",";
     }
 
-    auto productions = ll1table[{currProd, tokenType}]; // Get production vector from <nonTerminal, tokenType> pair
+    auto productions = ctx.tables.productions(currProd, ctx.tokenType); // Get production vector from <nonTerminal, tokenType> pair
     if (productions.empty()) {
-        // printAST(debugRoot);
-        errorFile << "Syntax Error: No production for " << currProd << " and " << tokenType << endl; // If blank production --> log error
-        currentNode->value = "Syntax Error for --> " + tokenVal + " ";
-        parseTokens();
-        recursiveDecent(currProd, currentNode, debugRoot);
+        // printAST(debugRoot, ctx.out);
+        ctx.errorFile << "Syntax Error: No production for " << currProd << " and " << ctx.tokenType << endl; // If blank production --> log error
+        currentNode->value = "Syntax Error for --> " + ctx.tokenVal + " ";
+        parseTokens(ctx);
+        recursiveDecent(ctx, currProd, currentNode, debugRoot);
     }
 
     /**
@@ -515,46 +1249,30 @@ void recursiveDecent(const string& currProd, shared_ptr<ASTNode> currentNode, sh
         // Cases
         if (p == "ε") 
             return;
-        else if (p == tokenType) {
-            childProd->value = tokenVal;
-            parseTokens(); // "Consume" current token by updating address to tokenVal, tokenType to next token
+        else if (p == ctx.tokenType) {
+            childProd->value = ctx.tokenVal;
+            parseTokens(ctx); // "Consume" current token by updating address to tokenVal, tokenType to next token
             continue;
         }
-        else recursiveDecent(p, childProd, debugRoot);
+        else recursiveDecent(ctx, p, childProd, debugRoot);
     }
+    if (currProd == "fdec" && ctx.functionParsed && !productions.empty()) ctx.functionParsed(currentNode);
 }
 
 // Generates Transition Table
-void generateTable() {
-    ifstream file("table.txt");
-    if (!file) {
-        cerr << "Error opening file" << endl;
-        return; 
-    }
-
-    int state, input, next_state;
-    char comma; 
-    while (file >> state >> comma >> input >> comma >> next_state) {
-        table[state][input] = next_state; 
+void generateTable(LanguageTables& tables) {
+    for (const auto& transition : transitionList) {
+        tables.table[transition[0]][transition[1]] = transition[2]; 
     }
 }
 
 // Generates Reserved/Keyword Array
-void loadKeywords() {
-    ifstream file("keywords.txt");
-    if (!file) {
-        cerr << "Error opening file" << endl;
-        return;
-    }
-
-    string keyword;
-    while (getline(file, keyword)) {
-        keywords.push_back(keyword);
-    }
+void loadKeywords(LanguageTables& tables) {
+    tables.keywords.assign(begin(keywordList), end(keywordList));
 }
 
 // Loads Ll1 table with ll1 grammer
-void loadLL1() {
+void loadLL1(LL1table& ll1table) {
 
     // S' --> Start
     ll1table[{"S'", "K_SEMI_COL"}] = {"program", "$"};
@@ -641,6 +1359,7 @@ void loadLL1() {
     ll1table[{"statement_seq", "T_IDENTIFIER"}] = {"statement", "statement_seqp"};
     ll1table[{"statement_seq", "K_FED"}] = {"ε"}; // grammer modification
     ll1table[{"statement_seq", "K_OD"}] = {"ε"}; // modifications
+    ll1table[{"statement_seq", "K_DOT"}] = {"ε"}; // grammer modification
 
     // Statement Sequence Prime:
     ll1table[{"statement_seqp", "K_SEMI_COL"}] = {"K_SEMI_COL", "statement_seq"};
@@ -648,7 +1367,7 @@ void loadLL1() {
     ll1table[{"statement_seqp", "K_OD"}] = {"ε"}; // grammer modification
     ll1table[{"statement_seqp", "K_FI"}] = {"ε"}; // grammer modification
     ll1table[{"statement_seqp", "K_ELSE"}] = {"ε"}; // grammer modification
-    ll1table[{"statement_seqp", "K_MULTIPY"}] = {"K_MULTIPY", "factor", "termp"};
+    ll1table[{"statement_seqp", "K_DOT"}] = {"ε"}; // grammer modification
 
     // Statement:
     ll1table[{"statement", "K_IF"}] = {"K_IF", "bexpr", "K_THEN", "statement_seq", "statementp"};
@@ -666,10 +1385,8 @@ void loadLL1() {
     ll1table[{"expr", "K_LPAREN"}] = {"term", "exprp"};
     ll1table[{"expr", "T_IDENTIFIER"}] = {"term", "exprp"};
 
-    ll1table[{"expr", "K_FED"}] = {"ε"}; // grammer modification
-    ll1table[{"expr", "K_OD"}] = {"ε"}; // grammer modification
-    ll1table[{"expr", "T_INT"}] = {"T_INT"}; // grammer modification
-    ll1table[{"expr", "T_DOUBLE"}] = {"T_DOUBLE"}; // grammer modification
+    ll1table[{"expr", "T_INT"}] = {"term", "exprp"}; // grammer modification (literals lead through factor)
+    ll1table[{"expr", "T_DOUBLE"}] = {"term", "exprp"}; // grammer modification
 
     // Expression Prime:
     ll1table[{"exprp", "K_SEMI_COL"}] = {"ε"};
@@ -693,14 +1410,14 @@ void loadLL1() {
     ll1table[{"exprp", "K_OD"}] = {"ε"}; // grammer modification
     ll1table[{"exprp", "K_FI"}] = {"ε"}; // grammer modification
     ll1table[{"exprp", "K_ELSE"}] = {"ε"}; // grammer modification
+    ll1table[{"exprp", "K_DOT"}] = {"ε"}; // grammer modification
 
 
     // Term:
     ll1table[{"term", "K_LPAREN"}] = {"factor", "termp"};
     ll1table[{"term", "T_IDENTIFIER"}] = {"factor", "termp"};
-    ll1table[{"term", "K_FED"}] = {"ε"}; // grammer modification
-    ll1table[{"term", "T_INT"}] = {"T_INT"}; // grammer modification
-    ll1table[{"term", "T_DOUBLE"}] = {"T_DOUBLE"}; // grammer modification
+    ll1table[{"term", "T_INT"}] = {"factor", "termp"}; // grammer modification
+    ll1table[{"term", "T_DOUBLE"}] = {"factor", "termp"}; // grammer modification
 
     // Term Prime:
     ll1table[{"termp", "K_SEMI_COL"}] = {"ε"};
@@ -725,19 +1442,21 @@ void loadLL1() {
     ll1table[{"termp", "K_FED"}] = {"ε"}; // grammer modification
     ll1table[{"termp", "K_FI"}] = {"ε"}; // grammer modification
     ll1table[{"termp", "K_ELSE"}] = {"ε"}; // grammer modification
+    ll1table[{"termp", "K_OD"}] = {"ε"}; // grammer modification
+    ll1table[{"termp", "K_DOT"}] = {"ε"}; // grammer modification
 
 
     // Factor:
     ll1table[{"factor", "K_LPAREN"}] = {"K_LPAREN", "expr", "K_RPAREN"};
     // ll1table[{"factor", "T_IDENTIFIER"}] = {"id", "K_LPAREN", "exprseq", "K_RPAREN"}; 
     ll1table[{"factor", "T_IDENTIFIER"}] = {"id", "factorp"};
-    ll1table[{"factor", "K_FED"}] = {"ε"}; // grammer modification
     ll1table[{"factor", "T_INT"}] = {"T_INT"}; // grammer modification
     ll1table[{"factor", "T_DOUBLE"}] = {"T_DOUBLE"}; // grammer modification
 
 
     // Factor Prime:
     ll1table[{"factorp", "K_LPAREN"}] = {"K_LPAREN", "exprseq", "K_RPAREN"};
+    ll1table[{"factorp", "K_LBRACKET"}] = {"K_LBRACKET", "expr", "K_RBRACKET"};
     ll1table[{"factorp", "K_RPAREN"}] = {"ε"};
     ll1table[{"factorp", "K_COMMA"}] = {"ε"};
     ll1table[{"factorp", "K_THEN"}] = {"ε"};
@@ -761,6 +1480,8 @@ void loadLL1() {
     ll1table[{"factorp", "K_FED"}] = {"ε"}; // grammer modification
     ll1table[{"factorp", "K_ELSE"}] = {"ε"}; // grammer modification
     ll1table[{"factorp", "K_FI"}] = {"ε"}; // grammer modification
+    ll1table[{"factorp", "K_OD"}] = {"ε"}; // grammer modification
+    ll1table[{"factorp", "K_DOT"}] = {"ε"}; // grammer modification
 
 
     // Expression Sequence:
@@ -768,8 +1489,8 @@ void loadLL1() {
     ll1table[{"exprseq", "K_RPAREN"}] = {"ε"};
     ll1table[{"exprseq", "T_IDENTIFIER"}] = {"expr", "exprseqp"};
     // Mising from grammer --> needed modification
-    ll1table[{"exprseq", "T_DOUBLE"}] = {"T_DOUBLE", "exprseqp"}; 
-    ll1table[{"exprseq", "T_INT"}] = {"T_INT", "exprseqp"}; 
+    ll1table[{"exprseq", "T_DOUBLE"}] = {"expr", "exprseqp"}; 
+    ll1table[{"exprseq", "T_INT"}] = {"expr", "exprseqp"}; 
 
     // Expression Sequence Prime:
     ll1table[{"exprseqp", "K_RPAREN"}] = {"ε"};
@@ -779,7 +1500,8 @@ void loadLL1() {
     ll1table[{"bexpr", "K_LPAREN"}] = {"bterm", "bexprp"};
     ll1table[{"bexpr", "K_NOT"}] = {"bterm", "bexprp"};
     ll1table[{"bexpr", "T_IDENTIFIER"}] = {"bterm", "bexprp"};
-    ll1table[{"bexpr", "T_INT"}] = {"T_INT", "comp", "expr"}; // grammer modification
+    ll1table[{"bexpr", "T_INT"}] = {"bterm", "bexprp"}; // grammer modification
+    ll1table[{"bexpr", "T_DOUBLE"}] = {"bterm", "bexprp"}; // grammer modification
 
 
     // Boolean Expression Prime:
@@ -792,6 +1514,8 @@ void loadLL1() {
     ll1table[{"bterm", "K_LPAREN"}] = {"bfactor", "btermp"};
     ll1table[{"bterm", "K_NOT"}] = {"bfactor", "btermp"};
     ll1table[{"bterm", "T_IDENTIFIER"}] = {"bfactor", "btermp"};
+    ll1table[{"bterm", "T_INT"}] = {"bfactor", "btermp"}; // grammer modification
+    ll1table[{"bterm", "T_DOUBLE"}] = {"bfactor", "btermp"}; // grammer modification
 
     // Boolean Term Prime:
     ll1table[{"btermp", "K_RPAREN"}] = {"ε"};
@@ -805,6 +1529,8 @@ void loadLL1() {
     // ll1table[{"bfactor", "K_LPAREN"}] = {"expr", "comp", "expr"};
     ll1table[{"bfactor", "K_NOT"}] = {"K_NOT", "bfactor"};
     ll1table[{"bfactor", "T_IDENTIFIER"}] = {"expr", "comp", "expr"};
+    ll1table[{"bfactor", "T_INT"}] = {"expr", "comp", "expr"}; // grammer modification
+    ll1table[{"bfactor", "T_DOUBLE"}] = {"expr", "comp", "expr"}; // grammer modification
 
     // Comparison:
     ll1table[{"comp", "K_LS_THEN"}] = {"K_LS_THEN"};
@@ -828,6 +1554,18 @@ void loadLL1() {
     ll1table[{"id", "T_IDENTIFIER"}] = {"T_IDENTIFIER"};
 }
 
+// Transition table, keywords and LL1 table, loaded on first use (thread safe) and shared by every compilation
+const LanguageTables& languageTables() {
+    static const LanguageTables tables = []() {
+        LanguageTables loaded;
+        generateTable(loaded);
+        loadKeywords(loaded);
+        loadLL1(loaded.ll1table);
+        return loaded;
+    }();
+    return tables;
+}
+
 /**
  * AST Parsing Functions (DFS)
  * - Building Symbol Table
@@ -868,9 +1606,11 @@ void extractVars(const shared_ptr<ASTNode>& varlistNode, const shared_ptr<Symbol
     if (!varlistNode) return;
 
     string varName;
+    bool isArray = false;
     for (const auto& child : varlistNode->children) {
         if (child->nodeType == "var") {
             varName = child->children.front()->children.front()->value;
+            isArray = child->children.size() > 1 && !child->children[1]->children.empty() && child->children[1]->children.front()->nodeType == "K_LBRACKET"; // var --> id varp
         } else if (child->nodeType == "varlistp" && child->children.front()->nodeType != "ε") {
             extractVars(child->children[1], table, type);
         }
@@ -881,17 +1621,31 @@ void extractVars(const shared_ptr<ASTNode>& varlistNode, const shared_ptr<Symbol
         SymbolEntry entry;
         entry.type = type;
         entry.varName = varName;
+        entry.isArray = isArray;
         table->addEntry(varName, entry);
     }
 }
 
 // Performing Semantic Analysis
+// Returns first literal under node (array sizes in declarations)
+string findLiteral(const shared_ptr<ASTNode>& node) {
+    if (node->nodeType == "T_INT") return node->value;
+    for (const auto& child : node->children) {
+        string literal = findLiteral(child);
+        if (!literal.empty()) return literal;
+    }
+    return "";
+}
+
 void extractExpr(const shared_ptr<ASTNode>& exprNode, vector<shared_ptr<ASTNode>>& varList) {
     if (!exprNode) return;
 
     // Add vars to list:
     if (exprNode->nodeType == "T_IDENTIFIER" || exprNode->nodeType == "T_DOUBLE" || exprNode->nodeType == "T_INT") varList.push_back(exprNode);
 
+    // Array index (factorp --> K_LBRACKET expr K_RBRACKET) is an int whatever the element type
+    if (exprNode->nodeType == "factorp" && !exprNode->children.empty() && exprNode->children.front()->nodeType == "K_LBRACKET") return;
+
     // Recurse
     for (const auto& child : exprNode->children) extractExpr(child, varList);
 }
@@ -978,62 +1732,128 @@ void populateSymbolTable(shared_ptr<ASTNode> &node, shared_ptr<SymbolTable>& tab
 }
 
 /* Phases */
-void lexicalAnalysis(vector<Token>& tokenList) {
+// Runs the lexer over ctx.inputFile, writing tokens.txt and passing each token on to emit
+void lexTokens(CompilerContext& ctx, const function<void(const Token&)>& emit) {
 	// Initialize: temp token for storing, line and character for tracking position
     Token token;
     bool isFirstToken = true; 
 
     while (true) {
-        token = getNextToken(); 
+        token = getNextToken(ctx); 
         if (token.type == TokenType::T_EOF) {
             break;
         }
         if (!token.isBlank()) {
-            tokenList.push_back(token); // add token to list
+            emit(token);
+            if (!ctx.tokenFile) continue;
 			// Convert token.buffer (vector<char>) to string for printing
             string tokenContent(token.buffer.begin(), token.buffer.end());
             string tokenTypeStr = tokenTypeToString(token.type);
 
             if (!isFirstToken) {
-                tokenFile << endl; 
+                *ctx.tokenFile << '\n'; 
             }
-            tokenFile << "<" << tokenContent << ", " << tokenTypeStr << ">";
+            *ctx.tokenFile << "<" << tokenContent << ", " << tokenTypeStr << ">";
             isFirstToken = false; 
         }
     }
 }
 
+void lexicalAnalysis(CompilerContext& ctx) {
+    lexTokens(ctx, [&](const Token& token) { ctx.tokenList.push_back(token); }); // add token to list
+}
+
+// Lexer thread of --stream: pushes each token into ring (text copied to arena), then a T_EOF token --> tokens pushed
+size_t streamTokens(CompilerContext& ctx, SpscRing<CompactToken>& ring, TextArena& arena) {
+    size_t tokens = 0;
+    lexTokens(ctx, [&](const Token& token) {
+        tokens++;
+        CompactToken compact;
+        compact.type = token.type;
+        if (token.constant >= 0) { // canonical text (the pool is the lexer's, the parser can't read it while it grows)
+            const string& text = ctx.constantPool.entries[token.constant].text;
+            compact.length = text.size();
+            compact.text = arena.add(text.data(), text.size());
+        }
+        else {
+            compact.length = token.buffer.size();
+            compact.text = arena.add(token.buffer.data(), token.buffer.size());
+        }
+        ring.push(compact);
+    });
+    ring.push(CompactToken());
+    return tokens;
+}
+
 // Parses Token File and returns abstract syntax tree
-shared_ptr<ASTNode> syntaxAnalysis() {
+shared_ptr<ASTNode> syntaxAnalysis(CompilerContext& ctx) {
     auto root = make_shared<ASTNode>("S'"); // Start of tree
     // Start syntax analysis if parsing if first production is correct:
-    parseTokens();
-    if (ll1table[{"S'", tokenType}].empty()) errorFile << "Syntax Error: No matching production found" << endl;
-    else recursiveDecent("S'", root, root); 
+    parseTokens(ctx);
+    if (ctx.tables.productions("S'", ctx.tokenType).empty()) ctx.errorFile << "Syntax Error: No matching production found" << endl;
+    else recursiveDecent(ctx, "S'", root, root); 
 
-    printAST(root);
-    cout << "Parsing Done" << endl;
+    if (ctx.options.parseTree) printAST(root, ctx.out);
+    ctx.out << "Parsing Done" << endl;
     return root;
 }
 
 // Builds symbol table from AST
-shared_ptr<SymbolTable> generateSymbolTable(shared_ptr<ASTNode> root) {
+shared_ptr<SymbolTable> generateSymbolTable(CompilerContext& ctx, shared_ptr<ASTNode> root) {
     auto rootSymbolTable = make_shared<SymbolTable>("global");
     populateSymbolTable(root, rootSymbolTable);
 
-    cout << "Done Building symbol Table" << endl;
+    ctx.out << "Done Building symbol Table" << endl;
     return rootSymbolTable;
 }
 
 // Perform semantic checking
-void semanticAnalysis(shared_ptr<ASTNode> node, shared_ptr<SymbolTable> table) {
+void semanticAnalysis(CompilerContext& ctx, shared_ptr<ASTNode> node, shared_ptr<SymbolTable> table) {
     if (!node) return;
 
     // Update Scope for tracking
     if (node->nodeType == "fdec") 
-        scope = node->children[2]->children.front()->children.front()->value;
-    else if (node->nodeType == "K_FED") 
-        scope = "global";
+        ctx.scope = node->children[2]->children.front()->children.front()->value;
+    else if (node->nodeType == "K_FED")
+        ctx.scope = "global";
+
+    // Array declarations need an int literal size > 0 (decl --> type varlist, var --> id varp)
+    if (node->nodeType == "decl" && node->children.size() == 2) {
+        auto varlist = node->children[1];
+        while (varlist && varlist->children.size() == 2) {
+            auto var = varlist->children[0];
+            if (var->children.size() > 1 && !var->children[1]->children.empty() && var->children[1]->children.front()->nodeType == "K_LBRACKET") {
+                string length = findLiteral(var->children[1]);
+                int index = length.empty() ? -1 : ctx.constantPool.lookup(length);
+                if (index >= 0 ? ctx.constantPool.entries[index].intValue <= 0 : length.empty()) { // bad literals are lexical errors already
+                    ctx.errorFile << "Declaration Error: array " << var->children.front()->children.front()->value << " needs a size > 0 in " << ctx.scope << endl;
+                }
+            }
+            auto varlistp = varlist->children[1];
+            varlist = (varlistp->children.size() == 2) ? varlistp->children[1] : nullptr;
+        }
+    }
+
+    // Names in statements (var --> id varp, factor --> id factorp): only arrays take an index and arrays always need one
+    auto parent = node->parent.lock();
+    bool isUse = (node->nodeType == "var" && parent && parent->nodeType == "statement") || node->nodeType == "factor";
+    if (isUse && !node->children.empty() && node->children.front()->nodeType == "id" && !node->children.front()->children.empty()) {
+        string name = node->children.front()->children.front()->value;
+        string suffix = (node->children.size() > 1 && !node->children[1]->children.empty()) ? node->children[1]->children.front()->nodeType : "ε";
+
+        // Function params are scalars, then the function's locals and the globals (undeclared names and calls are checked below)
+        bool isParam = false;
+        optional<SymbolEntry> entry;
+        auto functionEntry = (ctx.scope != "global") ? table->findEntry(ctx.scope) : nullopt;
+        if (functionEntry) {
+            for (const auto& p : functionEntry->params) isParam = isParam || p.second == name;
+            if (!isParam) entry = functionEntry->childTable->findEntry(name);
+        }
+        else entry = table->findEntry(name);
+        bool isVar = isParam || (entry && (entry->type == "K_INT" || entry->type == "K_DOUBLE"));
+        if (isVar && suffix == "K_LBRACKET" && (isParam || !entry->isArray)) ctx.errorFile << "Type Error: " << name << " is not an array in " << ctx.scope << endl;
+        else if (isVar && suffix != "K_LBRACKET" && !isParam && entry->isArray) ctx.errorFile << "Type Error: array " << name << " needs an index in " << ctx.scope << endl;
+    }
 
     /** 
      * Statement containing boolean expression
@@ -1045,8 +1865,8 @@ void semanticAnalysis(shared_ptr<ASTNode> node, shared_ptr<SymbolTable> table) {
         vector<shared_ptr<ASTNode>> bexprList;
 
         // If Scope is function --> get symbol entry and function table
-        if (scope != "global") {
-            auto functionEntry = table->findEntry(scope);
+        if (ctx.scope != "global") {
+            auto functionEntry = table->findEntry(ctx.scope);
             auto functionTable = functionEntry->childTable;
             string comp;
 
@@ -1056,7 +1876,7 @@ void semanticAnalysis(shared_ptr<ASTNode> node, shared_ptr<SymbolTable> table) {
             for (const auto& var : bexprList) {
                 if (functionTable->findEntry(var->value)) {
                     auto varEntry = functionTable->findEntry(var->value);
-                    if (varEntry->type != "K_INT") errorFile << "Type Error at " << var->value << " in " << scope << endl;
+                    if (varEntry->type != "K_INT") ctx.errorFile << "Type Error at " << var->value << " in " << ctx.scope << endl;
                 }
                 else if (var->nodeType == "T_INT") continue;
                 else {
@@ -1064,11 +1884,11 @@ void semanticAnalysis(shared_ptr<ASTNode> node, shared_ptr<SymbolTable> table) {
                     for (const auto& p : functionEntry->params) {
                         if (p.second == var->value) {
                             found = true; 
-                            if (p.first != "K_INT") errorFile << "Type Error at " << var->value << " in " << scope << endl;
+                            if (p.first != "K_INT") ctx.errorFile << "Type Error at " << var->value << " in " << ctx.scope << endl;
                             break;
                         }
                     }
-                    if (!found) errorFile << "Declaration Error at " << var->value << " in " << scope << endl;
+                    if (!found) ctx.errorFile << "Declaration Error at " << var->value << " in " << ctx.scope << endl;
                 }
             }
         }
@@ -1082,10 +1902,10 @@ void semanticAnalysis(shared_ptr<ASTNode> node, shared_ptr<SymbolTable> table) {
             for (const auto& var : bexprList) {
                 if (table->findEntry(var->value)) {
                     auto varEntry = table->findEntry(var->value);
-                    if (varEntry->type != "K_INT") errorFile << "Type Error at " << var->value << " in " << scope << endl;
+                    if (varEntry->type != "K_INT") ctx.errorFile << "Type Error at " << var->value << " in " << ctx.scope << endl;
                 }
                 else if (var->nodeType == "T_INT") continue;
-                else errorFile << "Declaration Error at " << var->value << " in " << scope << endl;
+                else ctx.errorFile << "Declaration Error at " << var->value << " in " << ctx.scope << endl;
             }
         }
     }
@@ -1102,8 +1922,8 @@ void semanticAnalysis(shared_ptr<ASTNode> node, shared_ptr<SymbolTable> table) {
         string stmtType; // stores type of first var in expression 
     
         // Perform semantic check on function and global scope expressions 
-        if (scope != "global") {
-            auto functionEntry = table->findEntry(scope);
+        if (ctx.scope != "global") {
+            auto functionEntry = table->findEntry(ctx.scope);
             auto functionTable = functionEntry->childTable;
 
             // Check for first var in function scope or function params --> else declaration error
@@ -1121,7 +1941,7 @@ void semanticAnalysis(shared_ptr<ASTNode> node, shared_ptr<SymbolTable> table) {
                         break;
                     }
                 }
-                if (!found) errorFile << "Declaration Error at " << varList.front()->value << " in " << scope << endl;
+                if (!found) ctx.errorFile << "Declaration Error at " << varList.front()->value << " in " << ctx.scope << endl;
             }
         
             // Extract expression vars and perform semantic checks (scope then type)
@@ -1133,7 +1953,7 @@ void semanticAnalysis(shared_ptr<ASTNode> node, shared_ptr<SymbolTable> table) {
                     
                     // If expression var is a function declaration --> extract args and perform sematic check
                     if (varEntry->type == "K_DEF") {
-                        if (varEntry->returnType != stmtType) errorFile << "Type Error: Function " << var->value << " does not return " << stmtType << " in " << scope << endl;
+                        if (varEntry->returnType != stmtType) ctx.errorFile << "Type Error: Function " << var->value << " does not return " << stmtType << " in " << ctx.scope << endl;
                         vector<vector<shared_ptr<ASTNode>>> argList; // entire function argument
                         vector<shared_ptr<ASTNode>> arg; // indivdual args
                         auto argNode = var->parent.lock()->parent.lock()->children[1]->children[1];
@@ -1144,7 +1964,7 @@ void semanticAnalysis(shared_ptr<ASTNode> node, shared_ptr<SymbolTable> table) {
                          * - Check for num of params
                          * - compare the return type of each param and argNode in argList
                         */
-                        if (varEntry->params.size() != argList.size()) errorFile << "Error: Mismatch in function call params " << varEntry->varName << " in " << scope << endl;
+                        if (varEntry->params.size() != argList.size()) ctx.errorFile << "Error: Mismatch in function call params " << varEntry->varName << " in " << ctx.scope << endl;
                         else {
                             for (size_t i = 0; i < varEntry->params.size(); i++) {
                                 const auto& pType = varEntry->params[i].first; // current function param
@@ -1159,32 +1979,32 @@ void semanticAnalysis(shared_ptr<ASTNode> node, shared_ptr<SymbolTable> table) {
                                     if (a->nodeType == "T_IDENTIFIER") {
                                         if (functionTable->findEntry(a->value)) {
                                             auto argEntry = functionTable->findEntry(a->value);
-                                            if (argEntry->type != pType) errorFile << "Error: Type Mismatch in Function Call at " << a->value << " in " << scope << endl;
+                                            if (argEntry->type != pType) ctx.errorFile << "Error: Type Mismatch in Function Call at " << a->value << " in " << ctx.scope << endl;
                                         }
                                         else {
                                             bool found = false;
                                             for (const auto& p : functionEntry->params) {
                                                 if (p.second == a->value) {found = true; break;}
                                             }
-                                            if (!found) errorFile << "Declaration Error at " << a->value << " in function call in " << scope << endl;
+                                            if (!found) ctx.errorFile << "Declaration Error at " << a->value << " in function call in " << ctx.scope << endl;
                                         }
                                     }
                                     else if (a->nodeType == "T_INT" || a->nodeType == "T_DOUBLE") {
                                         if (a->nodeType == "T_INT" && pType == "K_INT") continue;
                                         else if (a->nodeType == "T_DOUBLE" && pType == "K_DOUBLE") continue;
-                                        else errorFile << "Type Error at " << a->value << " in function call in " << scope << endl;
+                                        else ctx.errorFile << "Type Error at " << a->value << " in function call in " << ctx.scope << endl;
                                     }
                                 }
                             }
                         }
                         break;
                     }
-                    else if (varEntry->type != stmtType) errorFile << "Type Error at " << var->value << " in " << scope << endl;
+                    else if (varEntry->type != stmtType) ctx.errorFile << "Type Error at " << var->value << " in " << ctx.scope << endl;
                 } 
                 else if (var->nodeType == "T_INT" || var->nodeType == "T_DOUBLE") {
                     if (var->nodeType == "T_INT" && stmtType == "K_INT") continue;
                     else if (var->nodeType == "T_DOUBLE" && stmtType == "K_DOUBLE") continue;
-                    else errorFile << "Type Error at " << var->value << " in " << scope << endl;
+                    else ctx.errorFile << "Type Error at " << var->value << " in " << ctx.scope << endl;
                 }
                 // Check for var in function params
                 else {
@@ -1192,11 +2012,11 @@ void semanticAnalysis(shared_ptr<ASTNode> node, shared_ptr<SymbolTable> table) {
                     for (const auto& p : functionEntry->params) {
                         if (p.second == var->value) {
                             found = true; 
-                            if (p.first != stmtType) errorFile << "Type Error at " << var->value << " in " << scope << endl;
+                            if (p.first != stmtType) ctx.errorFile << "Type Error at " << var->value << " in " << ctx.scope << endl;
                             break;
                         }
                     }
-                    if (!found) errorFile << "Declaration Error at " << var->value << " in " << scope << endl;
+                    if (!found) ctx.errorFile << "Declaration Error at " << var->value << " in " << ctx.scope << endl;
                 }
             }
         }
@@ -1206,7 +2026,7 @@ void semanticAnalysis(shared_ptr<ASTNode> node, shared_ptr<SymbolTable> table) {
             if (table->findEntry(varList.front()->value)) {
                 auto varEntry = table->findEntry(varList.front()->value);
                 stmtType = varEntry->type;
-            } else errorFile << "Declaration Error at " << varList.front()->value << " in " << scope << endl;
+            } else ctx.errorFile << "Declaration Error at " << varList.front()->value << " in " << ctx.scope << endl;
 
             // Extract expression vars and perform semantic checks (scope then type)
             extractExpr(node->children[2], varList);
@@ -1215,7 +2035,7 @@ void semanticAnalysis(shared_ptr<ASTNode> node, shared_ptr<SymbolTable> table) {
                     auto varEntry = table->findEntry(var->value);
                     // If expression var is a function declaration --> extract args and perform sematic check
                     if (varEntry->type == "K_DEF") {
-                        if (varEntry->returnType != stmtType) errorFile << "Type Error: Function " << var->value << " does not return " << stmtType << " in " << scope << endl;
+                        if (varEntry->returnType != stmtType) ctx.errorFile << "Type Error: Function " << var->value << " does not return " << stmtType << " in " << ctx.scope << endl;
                         vector<vector<shared_ptr<ASTNode>>> argList; // entire function argument
                         vector<shared_ptr<ASTNode>> arg; // indivdual args
                         auto argNode = var->parent.lock()->parent.lock()->children[1]->children[1];
@@ -1226,7 +2046,7 @@ void semanticAnalysis(shared_ptr<ASTNode> node, shared_ptr<SymbolTable> table) {
                          * - Check for num of params
                          * - compare the return type of each param and argNode in argList
                         */
-                        if (varEntry->params.size() != argList.size()) errorFile << "Error: Mismatch in function call params " << varEntry->varName << " in " << scope << endl;
+                        if (varEntry->params.size() != argList.size()) ctx.errorFile << "Error: Mismatch in function call params " << varEntry->varName << " in " << ctx.scope << endl;
                         else {
                             for (size_t i = 0; i < varEntry->params.size(); i++) {
                                 const auto& pType = varEntry->params[i].first; // current function param
@@ -1241,38 +2061,38 @@ void semanticAnalysis(shared_ptr<ASTNode> node, shared_ptr<SymbolTable> table) {
                                     if (a->nodeType == "T_IDENTIFIER") {
                                         if (table->findEntry(a->value)) {
                                             auto argEntry = table->findEntry(a->value);
-                                            if (argEntry->type != pType) errorFile << "Error: Type Mismatch in Function Call at " << a->value << " in " << scope << endl;
+                                            if (argEntry->type != pType) ctx.errorFile << "Error: Type Mismatch in Function Call at " << a->value << " in " << ctx.scope << endl;
                                         }
-                                        else errorFile << "Declaration Error at " << a->value << " in function call in " << scope << endl;
+                                        else ctx.errorFile << "Declaration Error at " << a->value << " in function call in " << ctx.scope << endl;
                                         
                                     }
                                     else if (a->nodeType == "T_INT" || a->nodeType == "T_DOUBLE") {
                                         if (a->nodeType == "T_INT" && pType == "K_INT") continue;
                                         else if (a->nodeType == "T_DOUBLE" && pType == "K_DOUBLE") continue;
-                                        else errorFile << "Type Error at " << a->value << " in function call in " << scope << endl;
+                                        else ctx.errorFile << "Type Error at " << a->value << " in function call in " << ctx.scope << endl;
                                     }
                                 }
                             }
                         }
                         break;
                     }
-                    else if (varEntry->type != stmtType) errorFile << "Type Error at " << var->value << " in " << scope << endl; 
+                    else if (varEntry->type != stmtType) ctx.errorFile << "Type Error at " << var->value << " in " << ctx.scope << endl; 
                     
                     
                 } 
                 else if (var->nodeType == "T_INT" || var->nodeType == "T_DOUBLE") {
                     if (var->nodeType == "T_INT" && stmtType == "K_INT") continue;
                     else if (var->nodeType == "T_DOUBLE" && stmtType == "K_DOUBLE") continue;
-                    else errorFile << "Type Error at " << var->value << " in " << scope << endl;
+                    else ctx.errorFile << "Type Error at " << var->value << " in " << ctx.scope << endl;
                 }
-                else errorFile << "Declaration Error at " << var->value << " in " << scope << endl;
+                else ctx.errorFile << "Declaration Error at " << var->value << " in " << ctx.scope << endl;
             }
         }
     }
 
-    else if (node->nodeType == "statement" && node->children.front()->nodeType == "K_RETURN" && scope != "global") {
+    else if (node->nodeType == "statement" && node->children.front()->nodeType == "K_RETURN" && ctx.scope != "global") {
         vector<shared_ptr<ASTNode>> varList;
-        auto functionEntry = table->findEntry(scope);
+        auto functionEntry = table->findEntry(ctx.scope);
         auto functionTable = functionEntry->childTable;
         string stmtType = functionEntry->returnType;
         // Extract Expression vars and perform semantic checks
@@ -1284,7 +2104,7 @@ void semanticAnalysis(shared_ptr<ASTNode> node, shared_ptr<SymbolTable> table) {
                 
                 // If expression var is a function declaration --> extract args and perform sematic check
                 if (varEntry->type == "K_DEF") {
-                    if (varEntry->returnType != stmtType) errorFile << "Type Error: Function " << var->value << " does not return " << stmtType << " in " << scope << endl;
+                    if (varEntry->returnType != stmtType) ctx.errorFile << "Type Error: Function " << var->value << " does not return " << stmtType << " in " << ctx.scope << endl;
                     vector<vector<shared_ptr<ASTNode>>> argList; // entire function argument
                     vector<shared_ptr<ASTNode>> arg; // indivdual args
                     auto argNode = var->parent.lock()->parent.lock()->children[1]->children[1];
@@ -1295,7 +2115,7 @@ void semanticAnalysis(shared_ptr<ASTNode> node, shared_ptr<SymbolTable> table) {
                      * - Check for num of params
                      * - compare the return type of each param and argNode in argList
                     */
-                    if (varEntry->params.size() != argList.size()) errorFile << "Error: Mismatch in function call params " << varEntry->varName << " in " << scope << endl;
+                    if (varEntry->params.size() != argList.size()) ctx.errorFile << "Error: Mismatch in function call params " << varEntry->varName << " in " << ctx.scope << endl;
                     else {
                         for (size_t i = 0; i < varEntry->params.size(); i++) {
                             const auto& pType = varEntry->params[i].first; // current function param
@@ -1310,32 +2130,32 @@ void semanticAnalysis(shared_ptr<ASTNode> node, shared_ptr<SymbolTable> table) {
                                 if (a->nodeType == "T_IDENTIFIER") {
                                     if (functionTable->findEntry(a->value)) {
                                         auto argEntry = functionTable->findEntry(a->value);
-                                        if (argEntry->returnType != pType) errorFile << "Error: Type Mismatch in Function Call at " << a->value << " in " << scope << endl;
+                                        if (argEntry->returnType != pType) ctx.errorFile << "Error: Type Mismatch in Function Call at " << a->value << " in " << ctx.scope << endl;
                                     }
                                     else {
                                         bool found = false;
                                         for (const auto& p : functionEntry->params) {
                                             if (p.second == a->value) {found = true; break;}
                                         }
-                                        if (!found) errorFile << "Declaration Error at " << a->value << " in function call in " << scope << endl;
+                                        if (!found) ctx.errorFile << "Declaration Error at " << a->value << " in function call in " << ctx.scope << endl;
                                     }
                                 }
                                 else if (a->nodeType == "T_INT" || a->nodeType == "T_DOUBLE") {
                                     if (a->nodeType == "T_INT" && pType == "K_INT") continue;
                                     else if (a->nodeType == "T_DOUBLE" && pType == "K_DOUBLE") continue;
-                                    else errorFile << "Type Error at " << a->value << " in function call in " << scope << endl;
+                                    else ctx.errorFile << "Type Error at " << a->value << " in function call in " << ctx.scope << endl;
                                 }
                             }
                         }
                     }
                     break;
                 }
-                else if (varEntry->type != stmtType) errorFile << "Type Error at " << var->value << " in " << scope << endl;
+                else if (varEntry->type != stmtType) ctx.errorFile << "Type Error at " << var->value << " in " << ctx.scope << endl;
             } 
             else if (var->nodeType == "T_INT" || var->nodeType == "T_DOUBLE") {
                 if (var->nodeType == "T_INT" && stmtType == "K_INT") continue;
                 else if (var->nodeType == "T_DOUBLE" && stmtType == "K_DOUBLE") continue;
-                else errorFile << "Type Error at " << var->value << " in " << scope << endl;
+                else ctx.errorFile << "Type Error at " << var->value << " in " << ctx.scope << endl;
             }
             // Check for var in function params
             else {
@@ -1343,173 +2163,5993 @@ void semanticAnalysis(shared_ptr<ASTNode> node, shared_ptr<SymbolTable> table) {
                 for (const auto& p : functionEntry->params) {
                     if (p.second == var->value) {
                         found = true; 
-                        if (p.first != stmtType) errorFile << "Type Error at " << var->value << " in " << scope << endl;
+                        if (p.first != stmtType) ctx.errorFile << "Type Error at " << var->value << " in " << ctx.scope << endl;
                         break;
                     }
                 }
-                if (!found) errorFile << "Declaration Error at " << var->value << " in " << scope << endl;
+                if (!found) ctx.errorFile << "Declaration Error at " << var->value << " in " << ctx.scope << endl;
             }
         }
     }
 
     // Process all nodes
     for (auto& child: node->children) {
-        semanticAnalysis(child, table);
+        semanticAnalysis(ctx, child, table);
     }
 }
 
-// Functions for Recursively returning 3TAC information:
-void ICG_K_IF(shared_ptr<ASTNode> node, shared_ptr<SymbolTable> table, vector<string>& header3TAC, vector<string> body3TAC, int& labNum) {
-    if (!node) return;
+/**
+ * Intermediate Code Generation (3TAC)
+ * - Each fdec and the global statement_seq (main) are lowered into a list of quads
+ * - Expressions are evaluated left to right into temps (t1, t2, etc...)
+ * - Boolean expressions in if/while lower straight to compare and branch quads
+*/
+// Returns true if operand is a numeric literal (eg. 21, 1.0E-10, -4)
+bool isLiteral(const string& operand) {
+    if (operand.empty()) return false;
+    size_t i = (operand[0] == '-') ? 1 : 0;
+    return i < operand.size() && isdigit(static_cast<unsigned char>(operand[i]));
+}
 
-    // Append header and body of each K_IF to recursed 3TACS
-    if (node->nodeType == "statement" && node->children.front()->nodeType == "K_IF") {
-        string comp;
-        vector<shared_ptr<ASTNode>> bexprList; 
-        extractBexpr(node->children[1], bexprList, comp);
+// Literal type --> doubles have a decimal point or exponent
+string literalType(const string& literal) {
+    return (literal.find_first_of(".eE") != string::npos) ? "K_DOUBLE" : "K_INT";
+}
+
+// Type of operand in function: literal, param/local/temp or global var
+string operandType(const ICGFunction& fn, const ICGProgram& program, const string& operand) {
+    if (isLiteral(operand)) return literalType(operand);
+    auto it = fn.varTypes.find(operand);
+    if (it != fn.varTypes.end()) return it->second;
+    auto global = program.globals.find(operand);
+    if (global != program.globals.end()) return global->second;
+    return "K_INT";
+}
 
-        // Get Branch Equality
-        string branchEquality;
-        if (comp == "K_LS_EQL") branchEquality = "BLE";
-        else if (comp == "K_NOT_EQL") branchEquality = "BNE";
-        else if (comp == "K_LS_THEN") branchEquality = "BLE";
-        else if (comp == "K_EQL_TO") branchEquality = "BEQ";
-        else if (comp == "K_GR_EQL") branchEquality = "BGE";
-        else if (comp == "K_GT_THEN") branchEquality = "BGT";
+int typeSize(const string& type) {
+    return (type == "K_DOUBLE") ? 8 : 4;
+}
 
-        // Append to Header:
-        string icg = branchEquality + " lab" + to_string(labNum);
-        header3TAC.push_back(icg);
-        labNum += 1;
+bool isArithOp(const string& op) {
+    return op == "+" || op == "-" || op == "*" || op == "/" || op == "%";
+}
 
-        // Build Label Body:
-        // If Body
-        if (node->children[3]->children.front()->nodeType == "statement") {
-            if (node->children[3]->children.front()->children.front()->nodeType == "K_RETURN") {
+bool isRelOp(const string& op) {
+    return op == "<" || op == ">" || op == "==" || op == "<=" || op == ">=" || op == "<>";
+}
 
-            }
-        }
-        // Else Body
-        if (node->children[4]->children.front()->nodeType == "K_ELSE") {
+bool isBinaryOp(const string& op) {
+    return isArithOp(op) || isRelOp(op) || op == "and" || op == "or";
+}
 
-        }
-        // ICG_LAB(node->children[3], ) IF
-        // ICG_LAB(node->children[4]) ELSE
-    }
+bool isBranchOp(const string& op) {
+    return op == "beq" || op == "bne" || op == "blt" || op == "bgt" || op == "ble" || op == "bge";
+}
 
-    // Recurse:
-    for (auto& child: node->children) {
-        ICG_K_IF(child, table, header3TAC, body3TAC, labNum);
-    }
+// Ops without side effects that only write dest
+bool isPureOp(const string& op) {
+    return op == "=" || op == "not" || op == "=[]" || isBinaryOp(op);
 }
 
-// Generate intermediate code for compiling
-void createICG(shared_ptr<ASTNode> node, shared_ptr<SymbolTable> table) {
+void emit(ICGFunction& fn, const string& op, const string& dest, const string& arg1 = "", const string& arg2 = "") {
+    fn.code.push_back({op, dest, arg1, arg2});
+}
 
-    if (!node) return;
+string newTemp(ICGFunction& fn, const string& type) {
+    string temp = "t" + to_string(fn.tempNum++);
+    fn.varTypes[temp] = type;
+    return temp;
+}
 
-    // Generate Function ICG(s) if they exist
-    if (node->nodeType == "fdec") {
+string newLabel(ICGFunction& fn, const string& prefix = "lab") {
+    if (prefix == "loop") return "loop" + to_string(fn.loopNum++);
+    return "lab" + to_string(fn.labelNum++);
+}
 
-        // Get Function Information
-        // node->children[2]->children.front()->children.front()->value
-        auto functionEntry = table->findEntry(node->children[2]->children.front()->children.front()->value);
-        auto functionTable = functionEntry->childTable;
+// Finds first child of node with nodeType
+shared_ptr<ASTNode> findChild(const shared_ptr<ASTNode>& node, const string& nodeType) {
+    for (const auto& child : node->children) {
+        if (child->nodeType == nodeType) return child;
+    }
+    return nullptr;
+}
 
-        // Incrementation Vals
-        int bytesRequired = 0; // total bytes required by function
-        int labelNum = 1; // lab1, lab2, etc...
-        int loopNum = 1; // loop1, loop2, etcc...
+// Records declared vars (and array lengths) of a declarations node
+void ICG_DECLS(CompilerContext& ctx, const shared_ptr<ASTNode>& node, map<string, string>& types, map<string, int>& arraySizes) {
+    if (!node) return;
 
-        // Printing Declarations
-        vector<string> printFuncDecls; // gcd: 24 Begin, push lr and push fp, exitgcd
-        vector<string> printFuncParams; // b = fp + 8, a = fp + 12
-        vector<string> funcHeader3TAC; // header for 3TAC --> BEQ lab1, BLT loop1
-        vector<string> funcBodyTAC; // body of 3TAC command --> lab and loops
-        
-        // Get function params:
-        int fpCounter = 8;
-        for (const auto& p : functionEntry->params) {
-            string param;
-            string tempCounter = to_string(fpCounter);
-            
-            // param = p.second + " = fp + " + tempCounter + "\n";
-            printFuncParams.push_back(param);
+    // decl --> type varlist, var --> id varp
+    if (node->nodeType == "decl" && node->children.size() == 2) {
+        string type = node->children[0]->children.front()->nodeType;
+        auto varlist = node->children[1];
+        while (varlist && varlist->children.size() == 2) {
+            auto var = varlist->children[0];
+            string name = var->children.front()->children.front()->value;
+            types[name] = type;
+            if (var->children.size() > 1 && var->children[1]->children.front()->nodeType == "K_LBRACKET") {
+                string length = findLiteral(var->children[1]);
+                arraySizes[name] = length.empty() ? 1 : literalConstant(ctx, length).intValue;
+            }
+            auto varlistp = varlist->children[1];
+            varlist = (varlistp->children.size() == 2) ? varlistp->children[1] : nullptr;
         }
+        return;
+    }
 
-        // Handle 3TAC --> K_IF:
-        vector<string> K_IF_Header3TAC;
-        vector<string> K_IF_Body3TAC;
-
-        ICG_K_IF(node, table, K_IF_Header3TAC, K_IF_Body3TAC, labelNum);
+    // Nested function declarations are lowered on their own
+    if (node->nodeType == "fdec") return;
+    for (const auto& child : node->children) ICG_DECLS(ctx, child, types, arraySizes);
+}
 
-        // Handle 3TAC --> K_WHILE:
-        // vector<string> K_WHILE_Header3TAC;
-        // vector<string> K_WHILE_Body3TAC;
+string ICG_EXPR(const shared_ptr<ASTNode>& node, ICGFunction& fn, const ICGProgram& program);
 
-        // ICG_K_WHILE(node, table, K_IF_Header3TAC, K_IF_Body3TAC, labelNum);
+// Evaluates each argument of exprseq
+void ICG_ARGS(shared_ptr<ASTNode> exprseq, ICGFunction& fn, const ICGProgram& program, vector<string>& args) {
+    // exprseq --> expr exprseqp, exprseqp --> K_COMMA exprseq
+    while (exprseq && exprseq->children.size() == 2) {
+        args.push_back(ICG_EXPR(exprseq->children[0], fn, program));
+        auto exprseqp = exprseq->children[1];
+        exprseq = (exprseqp->children.size() == 2) ? exprseqp->children[1] : nullptr;
+    }
+}
 
-        // Append to function header and body
-        funcHeader3TAC.insert(funcHeader3TAC.end(), K_IF_Header3TAC.begin(), K_IF_Header3TAC.end());
-        funcBodyTAC.insert(funcBodyTAC.end(), K_IF_Body3TAC.begin(), K_IF_Body3TAC.end());
+// factor --> K_LPAREN expr K_RPAREN | id factorp | T_INT | T_DOUBLE
+string ICG_FACTOR(const shared_ptr<ASTNode>& node, ICGFunction& fn, const ICGProgram& program) {
+    const auto& first = node->children.front();
+    if (first->nodeType == "T_INT" || first->nodeType == "T_DOUBLE") return first->value;
+    if (first->nodeType == "K_LPAREN") return ICG_EXPR(node->children[1], fn, program);
+
+    string name = first->children.front()->value; // id --> T_IDENTIFIER
+    auto factorp = (node->children.size() > 1) ? node->children[1] : nullptr;
+    if (!factorp || factorp->children.empty() || factorp->children.front()->nodeType == "ε") return name;
+
+    // Function call --> push args then branch and link
+    if (factorp->children.front()->nodeType == "K_LPAREN") {
+        vector<string> args;
+        ICG_ARGS(factorp->children[1], fn, program, args);
+        for (const auto& arg : args) emit(fn, "param", "", arg);
+
+        auto returnType = program.returnTypes.find(name);
+        string temp = newTemp(fn, (returnType != program.returnTypes.end()) ? returnType->second : "K_INT");
+        emit(fn, "call", temp, name, to_string(args.size()));
+        return temp;
+    }
 
+    // Array element --> id [ expr ]
+    string index = ICG_EXPR(factorp->children[1], fn, program);
+    string temp = newTemp(fn, operandType(fn, program, name));
+    emit(fn, "=[]", temp, name, index);
+    return temp;
+}
 
+/**
+ * expr --> term exprp, term --> factor termp
+ * - both primes are (op, operand, prime) chains so evaluate them left associative
+*/
+string ICG_EXPR(const shared_ptr<ASTNode>& node, ICGFunction& fn, const ICGProgram& program) {
+    if (!node || node->children.empty()) return node ? node->value : "";
+    if (node->nodeType == "factor") return ICG_FACTOR(node, fn, program);
+
+    const auto& first = node->children.front();
+    if (first->nodeType == "ε") return "";
+    if (first->nodeType == "T_INT" || first->nodeType == "T_DOUBLE") return first->value;
+
+    string left = ICG_EXPR(first, fn, program);
+    auto prime = (node->children.size() > 1) ? node->children[1] : nullptr;
+    while (prime && prime->children.size() >= 2) {
+        string op = prime->children[0]->value;
+        string right = ICG_EXPR(prime->children[1], fn, program);
+        string type = (operandType(fn, program, left) == "K_DOUBLE" || operandType(fn, program, right) == "K_DOUBLE") ? "K_DOUBLE" : "K_INT";
+        string temp = newTemp(fn, type);
+        emit(fn, op, temp, left, right);
+
+        left = temp;
+        prime = (prime->children.size() > 2) ? prime->children[2] : nullptr;
     }
+    return left;
+}
 
-    // // Process all nodes:
-    for (auto& child: node->children) {
-        createICG(child, table);
+// Branch taken when comparison holds and the branch for its inverse
+const map<string, pair<string, string>> branchOps = {
+    {"<", {"blt", "bge"}}, {">", {"bgt", "ble"}}, {"==", {"beq", "bne"}},
+    {"<=", {"ble", "bgt"}}, {">=", {"bge", "blt"}}, {"<>", {"bne", "beq"}}};
+
+string invertBranch(const string& op) {
+    for (const auto& entry : branchOps) {
+        if (entry.second.first == op) return entry.second.second;
     }
+    return op;
 }
 
-int main() {
-
-    // Open Files
-    string inputFilePath;
-    cout << "Enter Path of file to compile: ";
-    cin >> inputFilePath;
+/**
+ * Boolean expressions --> short circuit jumps (no 0/1 temps)
+ * - bexpr --> bterm bexprp (K_OR chain), bterm --> bfactor btermp (K_AND chain)
+ * - bfactor --> K_LPAREN bexpr K_RPAREN | K_NOT bfactor | expr comp expr
+ * - fallTrue: code right after the condition is the true target, so comparisons branch to
+ *   falseLabel on the inverted test. Otherwise they branch to trueLabel and fall into false
+ * - not swaps the targets instead of computing anything
+*/
+void ICG_COND(const shared_ptr<ASTNode>& node, const string& trueLabel, const string& falseLabel, bool fallTrue, ICGFunction& fn, const ICGProgram& program) {
+    if (!node || node->children.empty()) return;
+
+    // Comparison: expr comp expr
+    if (node->children.size() == 3 && node->children[1]->nodeType == "comp") {
+        string left = ICG_EXPR(node->children[0], fn, program);
+        string right = ICG_EXPR(node->children[2], fn, program);
+        const auto& ops = branchOps.at(node->children[1]->children.front()->value);
+        if (fallTrue) emit(fn, ops.second, falseLabel, left, right);
+        else emit(fn, ops.first, trueLabel, left, right);
+        return;
+    }
 
-    inputFilePath = "test cases/" + inputFilePath + ".cp";
+    const auto& first = node->children.front();
+    if (first->nodeType == "K_LPAREN") return ICG_COND(node->children[1], trueLabel, falseLabel, fallTrue, fn, program);
+    if (first->nodeType == "K_NOT") return ICG_COND(node->children[1], falseLabel, trueLabel, !fallTrue, fn, program);
 
-    inputFile.open(inputFilePath);
-    tokenFile.open("tokens.txt");
-    errorFile.open("errors.txt");
+    // Chain of operands joined by or (bexpr) or and (bterm)
+    vector<shared_ptr<ASTNode>> operands(1, first);
+    auto prime = (node->children.size() > 1) ? node->children[1] : nullptr;
+    while (prime && prime->children.size() >= 2) {
+        operands.push_back(prime->children[1]);
+        prime = (prime->children.size() > 2) ? prime->children[2] : nullptr;
+    }
+    bool isOr = node->nodeType == "bexpr";
+
+    for (size_t i = 0; i + 1 < operands.size(); i++) {
+        // or --> true exits early, and --> false exits early
+        string next = newLabel(fn);
+        if (isOr) ICG_COND(operands[i], trueLabel, next, false, fn, program);
+        else ICG_COND(operands[i], next, falseLabel, true, fn, program);
+        emit(fn, "label", next);
+    }
+    ICG_COND(operands.back(), trueLabel, falseLabel, fallTrue, fn, program);
+}
 
-    if (!inputFile.is_open() || !tokenFile.is_open() || !errorFile.is_open()) {
-        cerr << "Error opening files" << endl;
-        return 1; // Return a non-zero value to indicate error
+void ICG_STATEMENTS(shared_ptr<ASTNode> node, ICGFunction& fn, const ICGProgram& program);
+
+// statement --> K_IF bexpr K_THEN statement_seq statementp
+void ICG_K_IF(const shared_ptr<ASTNode>& node, ICGFunction& fn, const ICGProgram& program) {
+    string thenLabel = newLabel(fn);
+    string elseLabel = newLabel(fn);
+    ICG_COND(node->children[1], thenLabel, elseLabel, true, fn, program);
+    emit(fn, "label", thenLabel);
+    ICG_STATEMENTS(node->children[3], fn, program);
+
+    // statementp --> K_FI | K_ELSE statement_seq K_FI
+    auto statementp = node->children[4];
+    if (statementp->children.front()->nodeType == "K_ELSE") {
+        string endLabel = newLabel(fn);
+        emit(fn, "b", endLabel);
+        emit(fn, "label", elseLabel);
+        ICG_STATEMENTS(statementp->children[1], fn, program);
+        emit(fn, "label", endLabel);
     }
+    else emit(fn, "label", elseLabel);
+}
 
-    // Generate keywords, transition table and LL1 sparse map:
-    generateTable(); 
-    loadKeywords();
-    loadLL1(); // Load ll1
+// statement --> K_WHILE bexpr K_DO statement_seq K_OD
+void ICG_K_WHILE(const shared_ptr<ASTNode>& node, ICGFunction& fn, const ICGProgram& program) {
+    string loopLabel = newLabel(fn, "loop");
+    string exitLabel = newLabel(fn);
+    string bodyLabel = newLabel(fn);
+    emit(fn, "label", loopLabel);
+    ICG_COND(node->children[1], bodyLabel, exitLabel, true, fn, program);
+    emit(fn, "label", bodyLabel);
+    ICG_STATEMENTS(node->children[3], fn, program);
+    emit(fn, "b", loopLabel);
+    emit(fn, "label", exitLabel);
+}
 
-    // Phase 1: Run lexical parsing and open file if succesful
-    vector<Token> tokenList;
-    lexicalAnalysis(tokenList); // Phase 1
+void ICG_STATEMENT(const shared_ptr<ASTNode>& node, ICGFunction& fn, const ICGProgram& program) {
+    if (node->children.empty()) return;
+    string first = node->children.front()->nodeType;
+
+    if (first == "K_IF" && node->children.size() == 5) ICG_K_IF(node, fn, program);
+    else if (first == "K_WHILE" && node->children.size() == 5) ICG_K_WHILE(node, fn, program);
+    else if (first == "K_PRINT") emit(fn, "print", "", ICG_EXPR(node->children[1], fn, program));
+    else if (first == "K_RETURN") emit(fn, "return", "", ICG_EXPR(node->children[1], fn, program));
+
+    // Assignment: var K_EQL expr (var --> id varp)
+    else if (first == "var" && node->children.size() == 3) {
+        auto var = node->children[0];
+        string name = var->children.front()->children.front()->value;
+        auto varp = (var->children.size() > 1) ? var->children[1] : nullptr;
+
+        if (varp && !varp->children.empty() && varp->children.front()->nodeType == "K_LBRACKET") {
+            string index = ICG_EXPR(varp->children[1], fn, program);
+            string value = ICG_EXPR(node->children[2], fn, program);
+            emit(fn, "[]=", name, index, value);
+            return;
+        }
 
-    lexemmeFile.open("tokens.txt");
-    if (!lexemmeFile.is_open()) {
-        cerr << "Error opening files" << endl;
-        return 1;
+        // Write straight into var if expression ended in a fresh temp (t1 = a + b; x = t1 --> x = a + b)
+        size_t codeSize = fn.code.size();
+        string value = ICG_EXPR(node->children[2], fn, program);
+        if (fn.code.size() > codeSize && fn.code.back().dest == value && value[0] == 't' && fn.code.back().op != "[]=") {
+            fn.code.back().dest = name;
+            fn.varTypes.erase(value);
+        }
+        else emit(fn, "=", name, value);
     }
+}
 
-    // Phase 2: Run syntax analysis to build AST and then generate symbol table
-    auto root = syntaxAnalysis(); 
-    auto symbolTable = generateSymbolTable(root);
-
-    // Phase 3: Perform semantic analysis
-    semanticAnalysis(root, symbolTable);
+// statement_seq --> statement statement_seqp, statement_seqp --> K_SEMI_COL statement_seq
+void ICG_STATEMENTS(shared_ptr<ASTNode> node, ICGFunction& fn, const ICGProgram& program) {
+    while (node && node->children.size() == 2) {
+        ICG_STATEMENT(node->children[0], fn, program);
+        auto statement_seqp = node->children[1];
+        node = (statement_seqp->children.size() == 2) ? statement_seqp->children[1] : nullptr;
+    }
+}
+
+// Numbers fn's labels and conditional branches so profile counts can be matched back to them
+void numberSites(ICGFunction& fn, ICGProgram& program) {
+    for (auto& q : fn.code) {
+        if (q.op == "label" || isBranchOp(q.op)) q.site = ++program.siteNum;
+    }
+}
+
+// Generate intermediate code for compiling
+// Lowers the global statements into main
+void createMainICG(shared_ptr<ASTNode> statements, ICGProgram& program) {
+    ICGFunction fn;
+    fn.name = "main";
+    ICG_STATEMENTS(statements, fn, program);
+    numberSites(fn, program);
+    program.functions.push_back(fn);
+}
+
+void createICG(CompilerContext& ctx, shared_ptr<ASTNode> node, shared_ptr<SymbolTable> table, ICGProgram& program) {
+    if (!node) return;
+
+    // Generate Function ICG(s) if they exist
+    if (node->nodeType == "fdec") {
+        auto fnameNode = findChild(node, "fname");
+        if (!fnameNode) return;
+        auto functionEntry = table->findEntry(fnameNode->children.front()->children.front()->value);
+        if (!functionEntry || functionEntry->type != "K_DEF") return;
+
+        ICGFunction fn;
+        fn.name = functionEntry->varName;
+        fn.returnType = functionEntry->returnType;
+        fn.params = functionEntry->params;
+        for (const auto& p : fn.params) fn.varTypes[p.second] = p.first;
+        ICG_DECLS(ctx, findChild(node, "declarations"), fn.varTypes, fn.arraySizes);
+        ICG_STATEMENTS(findChild(node, "statement_seq"), fn, program);
+        numberSites(fn, program);
+
+        program.functions.push_back(fn);
+
+        // Nested function declarations
+        auto declarations = findChild(node, "declarations");
+        if (declarations) createICG(ctx, declarations, functionEntry->childTable, program);
+        return;
+    }
+
+    // Process all nodes:
+    for (auto& child: node->children) {
+        createICG(ctx, child, table, program);
+    }
+
+    // Global statements are lowered last into main
+    if (node->nodeType == "program") createMainICG(findChild(node, "statement_seq"), program);
+}
+
+/**
+ * Scalar Optimizations (run on each function's 3TAC)
+ * - constant folding and copy propagation within basic blocks
+ * - dead code elimination of unused params, locals and temps
+ * - unreachable code, branch to next quad and unused label removal
+*/
+// Operands a quad reads (excluding array and function names)
+vector<string*> quadUses(Quad& q) {
+    if (q.op == "=" || q.op == "not" || q.op == "param" || q.op == "print" || q.op == "return") return {&q.arg1};
+    if (isBinaryOp(q.op) || isBranchOp(q.op) || q.op == "[]=") return {&q.arg1, &q.arg2};
+    if (q.op == "=[]") return {&q.arg2};
+    return {};
+}
+
+// Names a quad reads including arrays
+vector<string> quadReads(const Quad& q) {
+    Quad copy = q;
+    vector<string> reads;
+    for (string* use : quadUses(copy)) reads.push_back(*use);
+    if (q.op == "=[]") reads.push_back(q.arg1);
+    if (q.op == "[]=") reads.push_back(q.dest);
+    return reads;
+}
+
+// Scalar vars written by quad (arrays and dropped dests excluded)
+vector<string> quadDefs(const Quad& q) {
+    if (isPureOp(q.op) || q.op == "call") return {q.dest};
+    return {};
+}
+
+bool compareLiterals(const string& op, double a, double b) {
+    if (op == "<" || op == "blt") return a < b;
+    if (op == ">" || op == "bgt") return a > b;
+    if (op == "==" || op == "beq") return a == b;
+    if (op == "<=" || op == "ble") return a <= b;
+    if (op == ">=" || op == "bge") return a >= b;
+    return a != b; // <>, bne
+}
+
+// Evaluates op on two literals --> returns false if it can't be folded (eg. divide by zero)
+bool foldBinary(CompilerContext& ctx, const string& op, const string& a, const string& b, const string& type, string& result) {
+    if (isRelOp(op)) {
+        result = compareLiterals(op, literalConstant(ctx, a).doubleValue, literalConstant(ctx, b).doubleValue) ? "1" : "0";
+        return true;
+    }
+    if (op == "and" || op == "or") {
+        bool x = literalConstant(ctx, a).doubleValue != 0, y = literalConstant(ctx, b).doubleValue != 0;
+        result = ((op == "and") ? (x && y) : (x || y)) ? "1" : "0";
+        return true;
+    }
+    if (type == "K_DOUBLE") {
+        double x = literalConstant(ctx, a).doubleValue, y = literalConstant(ctx, b).doubleValue, value = 0;
+        if (op == "+") value = x + y;
+        else if (op == "-") value = x - y;
+        else if (op == "*") value = x * y;
+        else if (op == "/" && y != 0) value = x / y;
+        else return false;
+        if (value != value || value - value != 0) return false; // nan or inf
+        result = doubleLiteralText(ctx, value);
+        return true;
+    }
+    long long x = literalConstant(ctx, a).intValue, y = literalConstant(ctx, b).intValue;
+    if ((op == "/" || op == "%") && y == 0) return false;
+    if (op == "+") result = intLiteralText(ctx, x + y);
+    else if (op == "-") result = intLiteralText(ctx, x - y);
+    else if (op == "*") result = intLiteralText(ctx, x * y);
+    else if (op == "/") result = intLiteralText(ctx, x / y);
+    else if (op == "%") result = intLiteralText(ctx, x % y);
+    return true;
+}
+
+bool isZero(CompilerContext& ctx, const string& operand) { return isLiteral(operand) && literalConstant(ctx, operand).doubleValue == 0; }
+bool isOne(CompilerContext& ctx, const string& operand) { return isLiteral(operand) && literalConstant(ctx, operand).doubleValue == 1; }
+
+// Folds quad in place --> returns true if quad should be dropped
+bool foldQuad(CompilerContext& ctx, Quad& q, const ICGFunction& fn, const ICGProgram& program) {
+    if (isBinaryOp(q.op) && isLiteral(q.arg1) && isLiteral(q.arg2)) {
+        string result;
+        if (foldBinary(ctx, q.op, q.arg1, q.arg2, operandType(fn, program, q.dest), result)) q = {"=", q.dest, result, ""};
+    }
+    else if (q.op == "not" && isLiteral(q.arg1)) q = {"=", q.dest, isZero(ctx, q.arg1) ? "1" : "0", ""};
+    else if (isBranchOp(q.op) && isLiteral(q.arg1) && isLiteral(q.arg2)) {
+        if (!compareLiterals(q.op, literalConstant(ctx, q.arg1).doubleValue, literalConstant(ctx, q.arg2).doubleValue)) return true;
+        q = {"b", q.dest, "", ""};
+    }
+
+    // Algebraic identities: x + 0, x - 0, x * 1, x / 1, 0 + x, 1 * x, (int) x * 0
+    else if ((q.op == "+" || q.op == "-") && isZero(ctx, q.arg2)) q = {"=", q.dest, q.arg1, ""};
+    else if ((q.op == "*" || q.op == "/") && isOne(ctx, q.arg2)) q = {"=", q.dest, q.arg1, ""};
+    else if (q.op == "+" && isZero(ctx, q.arg1)) q = {"=", q.dest, q.arg2, ""};
+    else if (q.op == "*" && isOne(ctx, q.arg1)) q = {"=", q.dest, q.arg2, ""};
+    else if (q.op == "*" && operandType(fn, program, q.dest) == "K_INT" && (isZero(ctx, q.arg1) || isZero(ctx, q.arg2))) q = {"=", q.dest, "0", ""};
+
+    return q.op == "=" && q.dest == q.arg1;
+}
+
+bool propagateConstants(CompilerContext& ctx, ICGFunction& fn, const ICGProgram& program) {
+    bool changed = false;
+    map<string, string> values; // var --> literal or var it was copied from
+    auto kill = [&values](const string& name) {
+        values.erase(name);
+        for (auto it = values.begin(); it != values.end();) {
+            if (it->second == name) it = values.erase(it);
+            else ++it;
+        }
+    };
+
+    vector<Quad> result;
+    result.reserve(fn.code.size());
+    for (Quad q : fn.code) {
+        if (q.op == "label") values.clear();
+
+        Quad original = q;
+        for (string* use : quadUses(q)) {
+            auto it = values.find(*use);
+            if (it != values.end()) *use = it->second;
+        }
+
+        bool drop = foldQuad(ctx, q, fn, program);
+        if (drop || original.op != q.op || original.arg1 != q.arg1 || original.arg2 != q.arg2) changed = true;
+
+        // Calls may write any global var
+        if (q.op == "call") {
+            for (auto it = values.begin(); it != values.end();) {
+                bool global = !fn.varTypes.count(it->first) || (!isLiteral(it->second) && !fn.varTypes.count(it->second));
+                if (global) it = values.erase(it);
+                else ++it;
+            }
+        }
+        if (isPureOp(q.op) || q.op == "call") {
+            kill(q.dest);
+            if (q.op == "=" && q.dest != q.arg1 && operandType(fn, program, q.dest) == operandType(fn, program, q.arg1)) values[q.dest] = q.arg1;
+        }
+        if (!drop) result.push_back(q);
+    }
+
+    fn.code = result;
+    return changed;
+}
+
+/**
+ * Local common subexpression elimination
+ * - Within a block, a binary or not quad that repeats an earlier one (same op and operands, either
+ *   order for commutative ops) becomes a copy of the var still holding the earlier result
+ * - Entries die when their dest or an operand is written, at labels and at calls (globals)
+ * - Array loads aren't reused since stores between them aren't tracked
+*/
+bool eliminateCommonSubexpressions(ICGFunction& fn, const ICGProgram& program) {
+    static const set<string> commutative = {"+", "*", "==", "<>", "and", "or"};
+    bool changed = false;
+    map<tuple<string, string, string>, string> available; // (op, arg1, arg2) --> var holding it
+
+    for (Quad& q : fn.code) {
+        if (q.op == "label" || q.op == "call") available.clear();
+        if (isBinaryOp(q.op) || q.op == "not") {
+            string arg1 = q.arg1, arg2 = q.arg2;
+            if (commutative.count(q.op) && arg2 < arg1) swap(arg1, arg2);
+            auto it = available.find({q.op, arg1, arg2});
+            if (it != available.end() && it->second != q.dest && operandType(fn, program, it->second) == operandType(fn, program, q.dest)) {
+                q = {"=", q.dest, it->second, "", q.site, q.inBounds};
+                changed = true;
+            }
+        }
+
+        for (const auto& def : quadDefs(q)) {
+            for (auto it = available.begin(); it != available.end();) {
+                const auto& key = it->first;
+                if (it->second == def || get<1>(key) == def || get<2>(key) == def) it = available.erase(it);
+                else ++it;
+            }
+        }
+        if ((isBinaryOp(q.op) || q.op == "not") && q.dest != q.arg1 && q.dest != q.arg2) {
+            string arg1 = q.arg1, arg2 = q.arg2;
+            if (commutative.count(q.op) && arg2 < arg1) swap(arg1, arg2);
+            available[{q.op, arg1, arg2}] = q.dest;
+        }
+    }
+    return changed;
+}
+
+// Removes pure quads whose dest (param, local or temp) is never read
+bool eliminateDeadCode(ICGFunction& fn) {
+    bool changed = false;
+    bool removed = true;
+    while (removed) {
+        removed = false;
+        map<string, int> uses;
+        for (const auto& q : fn.code) {
+            for (const auto& name : quadReads(q)) uses[name] += 1;
+        }
+
+        vector<Quad> result;
+        for (const auto& q : fn.code) {
+            if (isPureOp(q.op) && fn.varTypes.count(q.dest) && !uses.count(q.dest)) removed = true;
+            else result.push_back(q);
+        }
+        fn.code = result;
+        changed = changed || removed;
+    }
+    return changed;
+}
+
+// Removes unreachable quads, branches to the next quad and unused labels
+bool simplifyControlFlow(ICGFunction& fn) {
+    bool changed = false;
+    vector<Quad> result;
+    bool reachable = true;
+    for (const auto& q : fn.code) {
+        if (q.op == "label") reachable = true;
+        if (!reachable) {
+            changed = true;
+            continue;
+        }
+        result.push_back(q);
+        if (q.op == "b" || q.op == "return") reachable = false;
+    }
+
+    // Branch straight to following label(s) --> drop
+    vector<Quad> cleaned;
+    for (size_t i = 0; i < result.size(); i++) {
+        const auto& q = result[i];
+        if (q.op == "b" || isBranchOp(q.op)) {
+            bool toNext = false;
+            for (size_t j = i + 1; j < result.size() && result[j].op == "label"; j++) {
+                if (result[j].dest == q.dest) toNext = true;
+            }
+            if (toNext) {
+                changed = true;
+                continue;
+            }
+        }
+        cleaned.push_back(q);
+    }
+
+    map<string, int> references;
+    for (const auto& q : cleaned) {
+        if (q.op == "b" || isBranchOp(q.op)) references[q.dest] += 1;
+    }
+    fn.code.clear();
+    for (const auto& q : cleaned) {
+        if (q.op == "label" && !references.count(q.dest)) {
+            changed = true;
+            continue;
+        }
+        fn.code.push_back(q);
+    }
+    return changed;
+}
+
+/**
+ * Jump Threading
+ * - a branch to a label whose next quad is "b L2" goes straight to L2
+ * - "bXX L1; b L2; L1:" --> inverted "bYY L2" falling into L1
+*/
+bool threadJumps(ICGFunction& fn) {
+    bool changed = false;
+    auto& code = fn.code;
+
+    // Final target of each label (following chains of labels and unconditional branches)
+    map<string, size_t> labels;
+    for (size_t i = 0; i < code.size(); i++) {
+        if (code[i].op == "label") labels[code[i].dest] = i;
+    }
+    auto resolve = [&](string label) {
+        for (size_t hops = 0; hops < labels.size(); hops++) {
+            auto it = labels.find(label);
+            if (it == labels.end()) break;
+            size_t i = it->second;
+            while (i < code.size() && code[i].op == "label") i++;
+            if (i >= code.size() || code[i].op != "b" || code[i].dest == label) break;
+            label = code[i].dest;
+        }
+        return label;
+    };
+    for (auto& q : code) {
+        if (q.op != "b" && !isBranchOp(q.op)) continue;
+        string target = resolve(q.dest);
+        if (target != q.dest) {
+            q.dest = target;
+            changed = true;
+        }
+    }
+
+    // Conditional branch over an unconditional one
+    vector<Quad> result;
+    for (size_t i = 0; i < code.size(); i++) {
+        const Quad& q = code[i];
+        if (isBranchOp(q.op) && i + 2 < code.size() && code[i + 1].op == "b") {
+            bool skipsBranch = false;
+            for (size_t j = i + 2; j < code.size() && code[j].op == "label"; j++) {
+                if (code[j].dest == q.dest) skipsBranch = true;
+            }
+            if (skipsBranch) {
+                result.push_back({invertBranch(q.op), code[i + 1].dest, q.arg1, q.arg2, -q.site});
+                i += 1;
+                changed = true;
+                continue;
+            }
+        }
+        result.push_back(q);
+    }
+    code = result;
+    return changed;
+}
+
+// Runs the scalar passes until nothing changes (at most 10 rounds) --> true if any pass changed fn
+bool optimizeICG(CompilerContext& ctx, ICGFunction& fn, const ICGProgram& program) {
+    bool optimized = false;
+    for (int pass = 0; pass < 10; pass++) {
+        bool changed = propagateConstants(ctx, fn, program);
+        changed = eliminateCommonSubexpressions(fn, program) || changed;
+        changed = eliminateDeadCode(fn) || changed;
+        changed = threadJumps(fn) || changed;
+        changed = simplifyControlFlow(fn) || changed;
+        if (!changed) break;
+        optimized = true;
+    }
+    return optimized;
+}
+
+/**
+ * Function Inlining
+ * - Call graph: one node per K_DEF entry in the symbol table, edges from each call quad
+ * - Callees are visited before callers so helpers are inlined into helpers first
+ * - A call site is inlined if the callee is not recursive and its cost fits options.inlineBudget
+ *    - cost = callee quads - quads saved at the call site (params and BL)
+*/
+using CallGraph = map<string, set<string>>;
+
+CallGraph buildCallGraph(const ICGProgram& program, const shared_ptr<SymbolTable>& table) {
+    CallGraph graph;
+    for (const auto& entry : table->table) {
+        if (entry.second.type == "K_DEF") graph[entry.first];
+    }
+    for (const auto& fn : program.functions) {
+        graph[fn.name];
+        for (const auto& q : fn.code) {
+            if (q.op == "call") graph[fn.name].insert(q.arg1);
+        }
+    }
+    return graph;
+}
+
+// True if function can reach itself through the call graph
+bool isRecursive(const CallGraph& graph, const string& name) {
+    set<string> visited;
+    vector<string> stack(1, name);
+    while (!stack.empty()) {
+        string current = stack.back();
+        stack.pop_back();
+        auto it = graph.find(current);
+        if (it == graph.end()) continue;
+        for (const auto& callee : it->second) {
+            if (callee == name) return true;
+            if (visited.insert(callee).second) stack.push_back(callee);
+        }
+    }
+    return false;
+}
+
+// Post order from main --> callees before callers
+void callGraphOrder(const CallGraph& graph, const string& name, set<string>& visited, vector<string>& order) {
+    if (!visited.insert(name).second) return;
+    auto it = graph.find(name);
+    if (it != graph.end()) {
+        for (const auto& callee : it->second) callGraphOrder(graph, callee, visited, order);
+    }
+    order.push_back(name);
+}
+
+ICGFunction* findFunction(ICGProgram& program, const string& name) {
+    for (auto& fn : program.functions) {
+        if (fn.name == name) return &fn;
+    }
+    return nullptr;
+}
+
+int inlineCost(const ICGFunction& callee) {
+    int size = 0;
+    for (const auto& q : callee.code) {
+        if (q.op != "label") size += 1;
+    }
+    return size - static_cast<int>(callee.params.size() + 1);
+}
+
+// Callee reads a global var that the caller shadows with a local
+bool shadowsGlobal(const ICGFunction& caller, const ICGFunction& callee) {
+    for (const auto& q : callee.code) {
+        for (const auto& name : quadReads(q)) {
+            if (!isLiteral(name) && !callee.varTypes.count(name) && caller.varTypes.count(name)) return true;
+        }
+        if ((isPureOp(q.op) || q.op == "call") && !callee.varTypes.count(q.dest) && caller.varTypes.count(q.dest)) return true;
+    }
+    return false;
+}
+
+// Call at callIndex is preceded by its argc param quads
+bool hasParams(const vector<Quad>& code, size_t callIndex, size_t argc) {
+    if (callIndex < argc) return false;
+    for (size_t i = callIndex - argc; i < callIndex; i++) {
+        if (code[i].op != "param") return false;
+    }
+    return true;
+}
+
+struct LiveInterval {
+    string var;
+    int start = -1;
+    int end = -1;
+    double weight = 0; // spill cost
+    bool isDouble = false;
+};
+
+vector<LiveInterval> buildIntervals(CompilerContext& ctx, const ICGFunction& fn, const ICGProgram& program, const set<string>& allocatable, set<string>& liveAtEntry);
+
+// Replaces params + call at callIndex with a renamed copy of callee's body
+// (its locals and local arrays that can be read before they're written start at 0, as they would in a fresh call)
+void inlineCall(CompilerContext& ctx, ICGFunction& caller, size_t callIndex, const ICGFunction& callee, const ICGProgram& program) {
+    Quad call = caller.code[callIndex];
+    size_t argc = callee.params.size();
+    size_t first = callIndex - argc;
+
+    // Rename callee params, locals, temps and labels into the caller
+    map<string, string> rename;
+    for (const auto& var : callee.varTypes) {
+        rename[var.first] = newTemp(caller, var.second);
+        auto array = callee.arraySizes.find(var.first);
+        if (array != callee.arraySizes.end()) caller.arraySizes[rename[var.first]] = array->second;
+    }
+    for (const auto& q : callee.code) {
+        if (q.op == "label") rename[q.dest] = newLabel(caller);
+    }
+    string exitLabel = newLabel(caller);
+    auto renamed = [&rename](const string& name) {
+        auto it = rename.find(name);
+        return (it != rename.end()) ? it->second : name;
+    };
+
+    // Locals live at callee entry --> read before any write on some path (arrays are never written whole, so any used one)
+    set<string> locals, uninitialized;
+    for (const auto& var : callee.varTypes) locals.insert(var.first);
+    for (const auto& param : callee.params) locals.erase(param.second);
+    buildIntervals(ctx, callee, program, locals, uninitialized);
+
+    vector<Quad> body;
+    for (size_t i = 0; i < argc; i++) body.push_back({"=", renamed(callee.params[i].second), caller.code[first + i].arg1, ""});
+    for (const auto& var : uninitialized) {
+        string zero = (callee.varTypes.at(var) == "K_DOUBLE") ? doubleLiteralText(ctx, 0) : intLiteralText(ctx, 0);
+        auto array = callee.arraySizes.find(var);
+        if (array == callee.arraySizes.end()) {
+            body.push_back({"=", renamed(var), zero, ""});
+            continue;
+        }
+        // i = 0; loop: bge done, i, size; a[i] = 0; i = i + 1; b loop; done:
+        string index = newTemp(caller, "K_INT"), loop = newLabel(caller, "loop"), done = newLabel(caller);
+        body.push_back({"=", index, intLiteralText(ctx, 0), ""});
+        body.push_back({"label", loop, "", ""});
+        body.push_back({"bge", done, index, intLiteralText(ctx, array->second)});
+        body.push_back({"[]=", renamed(var), index, zero});
+        body.push_back({"+", index, index, intLiteralText(ctx, 1)});
+        body.push_back({"b", loop, "", ""});
+        body.push_back({"label", done, "", ""});
+    }
+    for (const auto& q : callee.code) {
+        if (q.op == "return") {
+            body.push_back({"=", call.dest, renamed(q.arg1), ""});
+            body.push_back({"b", exitLabel, "", ""});
+            continue;
+        }
+        Quad copy = {q.op, renamed(q.dest), q.arg1, renamed(q.arg2), q.site};
+        if (q.op != "call") copy.arg1 = renamed(q.arg1);
+        body.push_back(copy);
+    }
+    body.push_back({"label", exitLabel, "", ""});
+
+    caller.code.erase(caller.code.begin() + first, caller.code.begin() + callIndex + 1);
+    caller.code.insert(caller.code.begin() + first, body.begin(), body.end());
+}
+
+// Inlines caller's calls to small helpers (find looks callees up by name), then re-optimizes it --> true if any call was inlined
+bool inlineCalls(CompilerContext& ctx, ICGFunction& caller, const ICGProgram& program, const CallGraph& graph, uint64_t hottestCalls, const function<const ICGFunction*(const string&)>& find) {
+    bool inlined = false;
+    for (size_t i = 0; i < caller.code.size(); i++) {
+        if (caller.code[i].op != "call") continue;
+        string calleeName = caller.code[i].arg1;
+        const ICGFunction* callee = find(calleeName);
+        if (!callee || callee == &caller) continue;
+
+        // Profiled callees: never entered --> keep the call, within 10x of the hottest --> 4x budget
+        string reason;
+        int cost = inlineCost(*callee);
+        int budget = ctx.options.inlineBudget;
+        uint64_t calls = ctx.profile.calls.count(calleeName) ? ctx.profile.calls.at(calleeName) : 0;
+        if (ctx.profile.loaded && calls > 0 && calls * 10 >= hottestCalls) budget *= 4;
+        if (isRecursive(graph, calleeName)) reason = "recursive";
+        else if (ctx.profile.loaded && calls == 0) reason = "never called in profile";
+        else if (cost > budget) reason = "cost " + to_string(cost) + " > budget " + to_string(budget);
+        else if (static_cast<int>(caller.code.size()) + cost > ctx.options.inlineCallerLimit) reason = "caller " + caller.name + " too large";
+        else if (!hasParams(caller.code, i, callee->params.size())) reason = "args not found";
+        else if (shadowsGlobal(caller, *callee)) reason = "caller shadows a global";
+
+        if (ctx.options.inlineReport) {
+            if (reason.empty()) ctx.out << "Inline: " << calleeName << " into " << caller.name << " (cost " << cost << ")" << endl;
+            else ctx.out << "Not inlined: " << calleeName << " into " << caller.name << " (" << reason << ")" << endl;
+        }
+        if (!reason.empty()) continue;
+
+        ICGFunction calleeCopy = *callee; // inlineCall can grow program.functions' caller in place
+        inlineCall(ctx, caller, i, calleeCopy, program);
+        inlined = true;
+        i = i - calleeCopy.params.size();
+    }
+    if (inlined) optimizeICG(ctx, caller, program);
+    return inlined;
+}
+
+void inlineFunctions(CompilerContext& ctx, ICGProgram& program, const shared_ptr<SymbolTable>& table) {
+    CallGraph graph = buildCallGraph(program, table);
+    set<string> visited;
+    vector<string> order;
+    callGraphOrder(graph, "main", visited, order);
+    uint64_t hottestCalls = 0;
+    for (const auto& entry : ctx.profile.calls) {
+        if (entry.first != "main") hottestCalls = max(hottestCalls, entry.second);
+    }
+
+    auto find = [&program](const string& name) -> const ICGFunction* { return findFunction(program, name); };
+    for (const auto& callerName : order) {
+        ICGFunction* caller = findFunction(program, callerName);
+        if (caller) inlineCalls(ctx, *caller, program, graph, hottestCalls, find);
+    }
+}
+
+// Drops functions that are no longer called from main (after inlining or partial evaluation)
+void removeUncalledFunctions(CompilerContext& ctx, ICGProgram& program, const shared_ptr<SymbolTable>& table) {
+    CallGraph graph = buildCallGraph(program, table);
+    set<string> visited;
+    vector<string> order;
+    callGraphOrder(graph, "main", visited, order);
+
+    vector<ICGFunction> reachable;
+    for (const auto& fn : program.functions) {
+        if (visited.count(fn.name)) reachable.push_back(fn);
+        else if (ctx.options.inlineReport) ctx.out << "Removed: " << fn.name << " (no calls left)" << endl;
+    }
+    program.functions = reachable;
+}
+
+/**
+ * Compile-time Partial Evaluation
+ * - A function is pure if it never prints, only touches its own params, locals and temps
+ *   and only calls pure functions
+ * - Calls to pure functions with literal args are run by a small 3TAC interpreter and
+ *   replaced by the returned literal
+ * - Evaluation gives up (and leaves the call alone) past options.evalStepLimit quads,
+ *   options.evalDepthLimit nested calls, on divide by zero or out of range array indexes
+*/
+// True if fn never prints and only touches its own params, locals and temps (calls aside) --> callees gets what it calls
+bool touchesOnlyLocals(const ICGFunction& fn, set<string>& callees) {
+    bool isPure = true;
+    for (const auto& q : fn.code) {
+        if (q.op == "print") isPure = false;
+        else if (q.op == "call") callees.insert(q.arg1);
+        else if ((isPureOp(q.op) || q.op == "[]=") && !fn.varTypes.count(q.dest)) isPure = false;
+        for (const auto& name : quadReads(q)) {
+            if (!isLiteral(name) && !fn.varTypes.count(name)) isPure = false;
+        }
+    }
+    return isPure;
+}
+
+// Calling an impure (or unknown) function makes the caller impure
+void propagateImpurity(map<string, bool>& pure, const map<string, set<string>>& callees) {
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto& entry : pure) {
+            auto calls = callees.find(entry.first);
+            if (!entry.second || calls == callees.end()) continue;
+            for (const auto& callee : calls->second) {
+                auto it = pure.find(callee);
+                if (it == pure.end() || !it->second) {
+                    entry.second = false;
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+map<string, bool> analyzePurity(const ICGProgram& program) {
+    map<string, bool> pure;
+    map<string, set<string>> callees;
+    for (const auto& fn : program.functions) {
+        if (fn.name != "main") pure[fn.name] = touchesOnlyLocals(fn, callees[fn.name]);
+    }
+    propagateImpurity(pure, callees);
+    return pure;
+}
+
+struct EvalValue {
+    bool isDouble = false;
+    long long intVal = 0;
+    double doubleVal = 0;
+
+    double asDouble() const { return isDouble ? doubleVal : static_cast<double>(intVal); }
+};
+
+EvalValue literalValue(CompilerContext& ctx, const string& literal) {
+    const Constant& constant = literalConstant(ctx, literal);
+    EvalValue value;
+    value.isDouble = constant.isDouble;
+    if (constant.isDouble) value.doubleVal = constant.doubleValue;
+    else value.intVal = constant.intValue;
+    return value;
+}
+
+string valueLiteral(CompilerContext& ctx, const EvalValue& value, const string& type) {
+    if (type == "K_DOUBLE") return doubleLiteralText(ctx, value.asDouble());
+    return intLiteralText(ctx, value.isDouble ? static_cast<long long>(value.doubleVal) : value.intVal);
+}
+
+struct PartialEvaluator {
+    CompilerContext& ctx;
+    const ICGProgram& program;
+    const map<string, bool>& pure;
+    map<string, const ICGFunction*> functions; // name --> code it runs (first function of that name)
+    long steps = 0; // quads run so far for the current call site
+    map<string, map<string, size_t>> labels; // function --> label --> quad index
+
+    PartialEvaluator(CompilerContext& context, const ICGProgram& prog, const map<string, bool>& purity, map<string, const ICGFunction*> code)
+        : ctx(context), program(prog), pure(purity), functions(move(code)) {}
+
+    PartialEvaluator(CompilerContext& context, const ICGProgram& prog, const map<string, bool>& purity) : ctx(context), program(prog), pure(purity) {
+        for (const auto& fn : program.functions) functions.emplace(fn.name, &fn);
+    }
+
+    const ICGFunction* function(const string& name) const {
+        auto it = functions.find(name);
+        return it != functions.end() ? it->second : nullptr;
+    }
+
+    // Runs name(args) --> returns false if the call can't be evaluated at compile time
+    bool call(const string& name, const vector<EvalValue>& args, int depth, EvalValue& result) {
+        auto isPure = pure.find(name);
+        const ICGFunction* fn = function(name);
+        if (!fn || isPure == pure.end() || !isPure->second || depth > ctx.options.evalDepthLimit) return false;
+        if (args.size() != fn->params.size()) return false;
+
+        if (!labels.count(name)) {
+            auto& index = labels[name];
+            for (size_t i = 0; i < fn->code.size(); i++) {
+                if (fn->code[i].op == "label") index[fn->code[i].dest] = i;
+            }
+        }
+        const auto& labelIndex = labels[name];
+
+        map<string, EvalValue> frame;
+        map<string, vector<EvalValue>> arrays;
+        for (size_t i = 0; i < args.size(); i++) frame[fn->params[i].second] = args[i];
+        for (const auto& array : fn->arraySizes) arrays[array.first].resize(array.second);
+        vector<EvalValue> pending; // params pushed for the next call
+
+        auto read = [this, &frame](const string& operand, EvalValue& value) {
+            if (isLiteral(operand)) {
+                value = literalValue(ctx, operand);
+                return true;
+            }
+            auto it = frame.find(operand);
+            if (it == frame.end()) return false; // read before write
+            value = it->second;
+            return true;
+        };
+        auto write = [&](const string& dest, EvalValue value) {
+            string type = operandType(*fn, program, dest);
+            if (type == "K_DOUBLE" && !value.isDouble) value = {true, 0, static_cast<double>(value.intVal)};
+            else if (type == "K_INT" && value.isDouble) value = {false, static_cast<long long>(value.doubleVal), 0};
+            else if (type == "K_INT") value.intVal = static_cast<int>(static_cast<unsigned int>(value.intVal));
+            frame[dest] = value;
+        };
+
+        size_t pc = 0;
+        while (pc < fn->code.size()) {
+            if (++steps > ctx.options.evalStepLimit) return false;
+            const Quad& q = fn->code[pc++];
+            EvalValue a, b;
+
+            if (q.op == "label") continue;
+            else if (q.op == "b") pc = labelIndex.at(q.dest);
+            else if (q.op == "=") {
+                if (!read(q.arg1, a)) return false;
+                write(q.dest, a);
+            }
+            else if (q.op == "not") {
+                if (!read(q.arg1, a)) return false;
+                write(q.dest, {false, a.asDouble() == 0, 0});
+            }
+            else if (isBinaryOp(q.op)) {
+                if (!read(q.arg1, a) || !read(q.arg2, b)) return false;
+                EvalValue value;
+                if (isRelOp(q.op)) value.intVal = compareLiterals(q.op, a.asDouble(), b.asDouble());
+                else if (q.op == "and") value.intVal = a.asDouble() != 0 && b.asDouble() != 0;
+                else if (q.op == "or") value.intVal = a.asDouble() != 0 || b.asDouble() != 0;
+                else if (a.isDouble || b.isDouble) {
+                    double x = a.asDouble(), y = b.asDouble();
+                    value.isDouble = true;
+                    if (q.op == "+") value.doubleVal = x + y;
+                    else if (q.op == "-") value.doubleVal = x - y;
+                    else if (q.op == "*") value.doubleVal = x * y;
+                    else if (q.op == "/" && y != 0) value.doubleVal = x / y;
+                    else return false;
+                }
+                else {
+                    long long x = a.intVal, y = b.intVal;
+                    if ((q.op == "/" || q.op == "%") && y == 0) return false;
+                    if (q.op == "+") value.intVal = x + y;
+                    else if (q.op == "-") value.intVal = x - y;
+                    else if (q.op == "*") value.intVal = x * y;
+                    else if (q.op == "/") value.intVal = x / y;
+                    else value.intVal = x % y;
+                }
+                write(q.dest, value);
+            }
+            else if (isBranchOp(q.op)) {
+                if (!read(q.arg1, a) || !read(q.arg2, b)) return false;
+                if (compareLiterals(q.op, a.asDouble(), b.asDouble())) pc = labelIndex.at(q.dest);
+            }
+            else if (q.op == "=[]" || q.op == "[]=") {
+                auto& array = arrays[(q.op == "=[]") ? q.arg1 : q.dest];
+                if (!read((q.op == "=[]") ? q.arg2 : q.arg1, a) || a.isDouble) return false;
+                if (a.intVal < 0 || a.intVal >= static_cast<long long>(array.size())) return false;
+                if (q.op == "=[]") write(q.dest, array[a.intVal]);
+                else {
+                    if (!read(q.arg2, b)) return false;
+                    array[a.intVal] = b;
+                }
+            }
+            else if (q.op == "param") {
+                if (!read(q.arg1, a)) return false;
+                pending.push_back(a);
+            }
+            else if (q.op == "call") {
+                size_t argc = stoul(q.arg2);
+                if (pending.size() < argc) return false;
+                vector<EvalValue> callArgs(pending.end() - argc, pending.end());
+                pending.resize(pending.size() - argc);
+                EvalValue value;
+                if (!call(q.arg1, callArgs, depth + 1, value)) return false;
+                write(q.dest, value);
+            }
+            else if (q.op == "return") {
+                if (!read(q.arg1, result)) return false;
+                if (fn->returnType == "K_DOUBLE" && !result.isDouble) result = {true, 0, static_cast<double>(result.intVal)};
+                return true;
+            }
+            else return false;
+        }
+        return false; // fell off the end without a return
+    }
+};
+
+// Replaces fn's calls to pure functions that only take literals with their result
+bool evaluateCalls(CompilerContext& ctx, ICGFunction& fn, const ICGProgram& program, PartialEvaluator& evaluator) {
+    bool changed = false;
+    for (size_t i = 0; i < fn.code.size(); i++) {
+        const Quad& q = fn.code[i];
+        auto isPure = evaluator.pure.find(q.arg1);
+        if (q.op != "call" || isPure == evaluator.pure.end() || !isPure->second) continue;
+
+        size_t argc = stoul(q.arg2);
+        if (!hasParams(fn.code, i, argc)) continue;
+        vector<EvalValue> args;
+        for (size_t j = i - argc; j < i; j++) {
+            if (isLiteral(fn.code[j].arg1)) args.push_back(literalValue(ctx, fn.code[j].arg1));
+        }
+        if (args.size() != argc) continue;
+
+        EvalValue result;
+        evaluator.steps = 0;
+        if (!evaluator.call(q.arg1, args, 0, result)) continue;
+
+        Quad folded = {"=", q.dest, valueLiteral(ctx, result, operandType(fn, program, q.dest)), ""};
+        fn.code.erase(fn.code.begin() + (i - argc), fn.code.begin() + i + 1);
+        fn.code.insert(fn.code.begin() + (i - argc), folded);
+        i -= argc;
+        changed = true;
+    }
+    return changed;
+}
+
+// Evaluates every function's calls against the code as it was before the pass, so a function's
+// result doesn't depend on where it sits in the list (and the evaluator's label index can't go stale)
+bool evaluatePureCalls(CompilerContext& ctx, ICGProgram& program) {
+    map<string, bool> pure = analyzePurity(program);
+    PartialEvaluator evaluator(ctx, program, pure);
+    vector<ICGFunction> evaluated = program.functions;
+    bool changed = false;
+    for (auto& fn : evaluated) changed = evaluateCalls(ctx, fn, program, evaluator) || changed;
+    program.functions = move(evaluated);
+    return changed;
+}
+
+// Intermediate code for a single quad in the notes format
+string formatQuad(const Quad& q, const ICGFunction& fn) {
+    if (q.op == "=") return q.dest + " = " + q.arg1;
+    if (isBinaryOp(q.op)) return q.dest + " = " + q.arg1 + " " + q.op + " " + q.arg2;
+    if (q.op == "not") return q.dest + " = not " + q.arg1;
+    if (q.op == "=[]") return q.dest + " = " + q.arg1 + "[" + q.arg2 + "]";
+    if (q.op == "[]=") return q.dest + "[" + q.arg1 + "] = " + q.arg2;
+    if (q.op == "param") return "push {" + q.arg1 + "}";
+    if (q.op == "call") return q.dest + " = BL " + q.arg1;
+    if (q.op == "print") return "print(" + q.arg1 + ")";
+    if (q.op == "return") return "fp - 4 = " + q.arg1 + "\nb exit" + fn.name;
+    if (q.op == "label") return q.dest + ":";
+    if (q.op == "b") return "b " + q.dest;
+    if (isBranchOp(q.op)) return "cmp " + q.arg1 + ", " + q.arg2 + "\n" + q.op + " " + q.dest;
+    return q.op;
+}
+
+// Writes the 3TAC of each function then main
+void printICG(const ICGProgram& program, ostream& out) {
+    out << "B main" << endl;
+    for (const auto& fn : program.functions) {
+        out << endl;
+        if (fn.name == "main") out << "main:" << endl << "Begin: " << fn.bytesRequired << endl;
+        else {
+            out << fn.name << ": " << fn.bytesRequired << endl << "Begin:" << endl;
+            out << "push {LR}" << endl << "push {FP}" << endl;
+
+            // Params were pushed in order so the last one is closest to fp
+            int fpCounter = 8;
+            for (auto p = fn.params.rbegin(); p != fn.params.rend(); ++p) {
+                out << p->second << " = fp + " << fpCounter << endl;
+                fpCounter += typeSize(p->first);
+            }
+        }
+
+        bool returns = false;
+        for (const auto& q : fn.code) {
+            out << formatQuad(q, fn) << endl;
+            if (q.op == "return") returns = true;
+        }
+
+        if (fn.name != "main") out << "exit" << fn.name << ":" << endl << "pop {FP}" << endl << "pop {PC}" << endl;
+        else if (returns) out << "exitmain:" << endl;
+    }
+}
+
+/**
+ * Bounds Check Elimination (while loops)
+ * - A loop is the single entry region from its header label to the last b back to it. Its induction
+ *   var v is the int the header's exit branch tests and is written once per iteration by v = v +/- c
+ * - Until that write every quad in the loop sees v between its entry value and the exit test's bound,
+ *   so the indexes v, v + k and v % c (v >= 0) get a range from the two
+ * - Ranges that only depend on literals are proven at compile time. Otherwise the loop is versioned:
+ *   guards before the header send bad entry values or bounds to the original loop and everything
+ *   else to a copy without the checks
+ * - Proven "=[]" and "[]=" quads are marked inBounds so the VM, JIT and x86-64 skip their checks
+*/
+vector<int> loopDepths(const vector<Quad>& code);
+
+// Value of var + offset (var empty --> just the offset)
+struct LoopBound {
+    string var;
+    long long offset = 0;
+};
+
+const long long maxIndexOffset = 1 << 20; // keeps v + step and v + k far from int overflow
+const size_t maxVersionedLoop = 500; // quads a loop may have and still be copied
+
+// Int literal operand --> false for vars and doubles
+bool intLiteral(CompilerContext& ctx, const string& operand, long long& value) {
+    if (!isLiteral(operand) || literalType(operand) != "K_INT") return false;
+    value = literalConstant(ctx, operand).intValue;
+    return true;
+}
+
+/**
+ * Counted loop (bounds check elimination and unrolling)
+ * - The region [first, last] runs from the header's labels to the last b back to it and nothing
+ *   outside branches into it
+ * - test is the first quad after the labels: a branch out of the loop on var REL limit (REL holds
+ *   while the loop runs)
+ * - var is an int written once per iteration (outside inner loops) by var = var +/- step and limit
+ *   is a literal or an int the loop doesn't write
+*/
+struct CountedLoop {
+    size_t first = 0, test = 0, update = 0, last = 0;
+    set<string> labels;
+    bool hasCall = false;
+    string var, rel;
+    long long step = 0;
+    LoopBound limit;
+    LoopBound entry; // var's value entering the loop (a literal when set just before it)
+};
+
+// Quads in [from, to] that write name
+vector<size_t> definitionsIn(const vector<Quad>& code, const string& name, size_t from, size_t to) {
+    vector<size_t> defs;
+    for (size_t i = from; i <= to; i++) {
+        for (const auto& def : quadDefs(code[i])) {
+            if (def == name) defs.push_back(i);
+        }
+    }
+    return defs;
+}
+
+// Int var a callee in the loop can't change
+bool loopIntVar(const ICGFunction& fn, const ICGProgram& program, const CountedLoop& loop, const string& name) {
+    return !isLiteral(name) && operandType(fn, program, name) == "K_INT" && !fn.arraySizes.count(name) && !program.globalArrays.count(name) &&
+        (fn.varTypes.count(name) || !loop.hasCall);
+}
+
+bool findCountedLoop(CompilerContext& ctx, const ICGFunction& fn, const ICGProgram& program, const string& header, CountedLoop& loop) {
+    const auto& code = fn.code;
+    size_t h = 0;
+    while (h < code.size() && !(code[h].op == "label" && code[h].dest == header)) h++;
+    for (size_t i = h + 1; i < code.size(); i++) {
+        if (code[i].op == "b" && code[i].dest == header) loop.last = i;
+    }
+    if (h >= code.size() || loop.last == 0) return false;
+    loop.first = h;
+    while (loop.first > 0 && code[loop.first - 1].op == "label") loop.first--;
+
+    // Single entry: nothing outside the loop branches into it
+    for (size_t i = loop.first; i <= loop.last; i++) {
+        if (code[i].op == "label") loop.labels.insert(code[i].dest);
+        if (code[i].op == "call") loop.hasCall = true;
+    }
+    for (size_t i = 0; i < code.size(); i++) {
+        if ((i < loop.first || i > loop.last) && (code[i].op == "b" || isBranchOp(code[i].op)) && loop.labels.count(code[i].dest)) return false;
+    }
+
+    // Exit test: first quad after the header's labels
+    loop.test = h;
+    while (loop.test <= loop.last && code[loop.test].op == "label") loop.test++;
+    const Quad& exit = code[loop.test];
+    if (!isBranchOp(exit.op) || loop.labels.count(exit.dest)) return false;
+    string rel;
+    for (const auto& entry : branchOps) {
+        if (entry.second.second == exit.op) rel = entry.first;
+    }
+
+    auto intVar = [&](const string& name) { return loopIntVar(fn, program, loop, name); };
+
+    // Induction var: the tested int with a single v = v +/- c
+    string boundOperand;
+    static const map<string, string> swapped = {{"<", ">"}, {">", "<"}, {"<=", ">="}, {">=", "<="}, {"==", "=="}, {"<>", "<>"}};
+    for (int side = 0; side < 2 && loop.var.empty(); side++) {
+        string candidate = side ? exit.arg2 : exit.arg1;
+        if (!intVar(candidate)) continue;
+        vector<size_t> defs = definitionsIn(code, candidate, loop.first, loop.last);
+        if (defs.size() != 1) continue;
+        const Quad& q = code[defs[0]];
+        long long c;
+        if (q.op == "+" && q.arg1 == candidate && intLiteral(ctx, q.arg2, c)) loop.step = c;
+        else if (q.op == "+" && q.arg2 == candidate && intLiteral(ctx, q.arg1, c)) loop.step = c;
+        else if (q.op == "-" && q.arg1 == candidate && intLiteral(ctx, q.arg2, c)) loop.step = -c;
+        else continue;
+        if (loop.step == 0 || llabs(loop.step) > maxIndexOffset) continue;
+        loop.var = candidate;
+        loop.rel = side ? swapped.at(rel) : rel;
+        loop.update = defs[0];
+        boundOperand = side ? exit.arg1 : exit.arg2;
+    }
+    if (loop.var.empty()) return false;
+    vector<int> depth = loopDepths(code);
+    if (depth[loop.update] != depth[loop.test]) return false; // written in an inner loop
+
+    long long literal;
+    if (intLiteral(ctx, boundOperand, literal)) loop.limit = {"", literal};
+    else if (intVar(boundOperand) && definitionsIn(code, boundOperand, loop.first, loop.last).empty()) loop.limit = {boundOperand, 0};
+    else return false;
+
+    loop.entry = {loop.var, 0};
+    for (size_t i = loop.first; i-- > 0;) {
+        const Quad& q = code[i];
+        if (q.op == "label" || q.op == "b" || q.op == "return" || isBranchOp(q.op)) break;
+        vector<string> defs = quadDefs(q);
+        if (find(defs.begin(), defs.end(), loop.var) == defs.end()) continue;
+        if (q.op == "=" && intLiteral(ctx, q.arg1, literal)) loop.entry = {"", literal};
+        break;
+    }
+    return true;
+}
+
+bool eliminateLoopChecks(CompilerContext& ctx, ICGFunction& fn, const ICGProgram& program, const string& header) {
+    CountedLoop loop;
+    if (!findCountedLoop(ctx, fn, program, header, loop)) return false;
+    auto& code = fn.code;
+    const string& v = loop.var;
+    size_t first = loop.first, test = loop.test, update = loop.update, last = loop.last;
+
+    // Loop bounds: the exit test limits one side, v's entry value the other
+    LoopBound low, high;
+    if (loop.step > 0 && (loop.rel == "<" || loop.rel == "<=")) {
+        low = loop.entry;
+        high = loop.limit;
+        if (loop.rel == "<") high.offset -= 1;
+    }
+    else if (loop.step < 0 && (loop.rel == ">" || loop.rel == ">=")) {
+        high = loop.entry;
+        low = loop.limit;
+        if (loop.rel == ">") low.offset += 1;
+    }
+    else return false;
+
+    // Guards: "blt var, n" (var must be >= n) and "bgt var, n" (var must be <= n) send the loop to the checked copy
+    map<pair<string, string>, long long> guards;
+    auto require = [&guards](const LoopBound& bound, long long k, bool atLeast, long long n) { // bound + k >= n or <= n
+        long long value = n - bound.offset - k;
+        if (bound.var.empty()) return atLeast ? value <= 0 : value >= 0;
+        auto key = make_pair(string(atLeast ? "blt" : "bgt"), bound.var);
+        auto it = guards.find(key);
+        if (it == guards.end()) guards[key] = value;
+        else it->second = atLeast ? max(it->second, value) : min(it->second, value);
+        return true;
+    };
+
+    vector<size_t> proven;
+    for (size_t i = test + 1; i < update; i++) {
+        const Quad& q = code[i];
+        if (q.op != "=[]" && q.op != "[]=") continue;
+        const string& array = (q.op == "=[]") ? q.arg1 : q.dest;
+        const string& index = (q.op == "=[]") ? q.arg2 : q.arg1;
+        long long size = fn.arraySizes.count(array) ? fn.arraySizes.at(array) : program.globalArrays.at(array);
+
+        // Index --> v + k, or v % c defined earlier in the same block
+        long long k = 0, modulus = 0;
+        bool found = index == v;
+        for (size_t j = i; !found && j-- > test + 1;) {
+            const Quad& def = code[j];
+            if (def.op == "label" || def.op == "b" || isBranchOp(def.op)) break;
+            vector<string> defs = quadDefs(def);
+            if (find(defs.begin(), defs.end(), v) != defs.end()) break;
+            if (find(defs.begin(), defs.end(), index) == defs.end()) continue;
+            if (!loopIntVar(fn, program, loop, index)) break;
+            if (def.op == "+" && def.arg1 == v) found = intLiteral(ctx, def.arg2, k);
+            else if (def.op == "+" && def.arg2 == v) found = intLiteral(ctx, def.arg1, k);
+            else if (def.op == "-" && def.arg1 == v && intLiteral(ctx, def.arg2, k)) {
+                k = -k;
+                found = true;
+            }
+            else if (def.op == "%" && def.arg1 == v) found = intLiteral(ctx, def.arg2, modulus) && modulus > 0;
+            break;
+        }
+        if (!found || llabs(k) > maxIndexOffset) continue;
+
+        map<pair<string, string>, long long> saved = guards;
+        bool inRange = modulus ? require(low, 0, true, 0) && modulus <= size : require(low, k, true, 0) && require(high, k, false, size - 1);
+        if (inRange) proven.push_back(i);
+        else guards = saved;
+    }
+    if (proven.empty()) return false;
+    if (guards.empty()) {
+        for (size_t i : proven) code[i].inBounds = true;
+        return true;
+    }
+    if (last - first + 1 > maxVersionedLoop) return false;
+
+    // Versioned: guards, the unchecked copy (ends with its own back edge) then the original loop
+    map<string, string> rename;
+    for (const auto& label : loop.labels) rename[label] = newLabel(fn);
+    vector<Quad> versioned;
+    for (const auto& guard : guards) versioned.push_back({guard.first.first, code[first].dest, guard.first.second, to_string(guard.second)});
+    for (size_t i = first; i <= last; i++) {
+        Quad copy = code[i];
+        if (rename.count(copy.dest) && (copy.op == "label" || copy.op == "b" || isBranchOp(copy.op))) copy.dest = rename.at(copy.dest);
+        if (find(proven.begin(), proven.end(), i) != proven.end()) copy.inBounds = true;
+        versioned.push_back(copy);
+    }
+    code.insert(code.begin() + first, versioned.begin(), versioned.end());
+    return true;
+}
+
+// Drops the bounds checks of fn's counted loops that can't fail --> true if any loop changed
+bool eliminateBoundsChecks(CompilerContext& ctx, ICGFunction& fn, const ICGProgram& program) {
+    // Loops by header, innermost (shortest) first so outer copies take their proven bodies along
+    map<string, size_t> labels, backEdges;
+    for (size_t i = 0; i < fn.code.size(); i++) {
+        const Quad& q = fn.code[i];
+        if (q.op == "label") labels[q.dest] = i;
+        else if (q.op == "b" && labels.count(q.dest)) backEdges[q.dest] = i;
+    }
+    vector<pair<size_t, string>> loops;
+    for (const auto& edge : backEdges) loops.push_back({edge.second - labels.at(edge.first), edge.first});
+    sort(loops.begin(), loops.end());
+    bool changed = false;
+    for (const auto& loop : loops) changed = eliminateLoopChecks(ctx, fn, program, loop.second) || changed;
+    return changed;
+}
+
+/**
+ * Loop Vectorization (x86-64)
+ * - Counted loops "L: bge exit, i, n; body; i = i + 1; b L" whose body is straight line
+ *   arithmetic on one element type over a[i] loads and stores get a vector loop in front of the
+ *   scalar one: SSE2 does 2 doubles / 4 ints per iteration, --avx2 does 4 doubles / 8 ints
+ * - Every access must index with i itself and be proven in range (bounds check elimination), so
+ *   lanes never depend on each other and the vector loop touches only what the scalar loop would
+ * - Vars the body writes live in xmm/ymm registers and must not be read after the loop, loop
+ *   invariant operands are broadcast once before it
+ * - The scalar loop runs the remaining iterations (fewer than the vector width)
+*/
+struct VectorLoop {
+    string counter, limit; // loop runs while counter < limit
+    size_t bodyStart = 0, bodyEnd = 0; // body quads [bodyStart, bodyEnd), bodyEnd is the counter update
+    bool isDouble = false;
+    vector<string> invariants; // operands read but not written by the body
+};
+
+const int vectorRegisters = 16;
+
+// Vectorizable loops of fn --> keyed by the index of their exit test
+map<size_t, VectorLoop> findVectorLoops(CompilerContext& ctx, const ICGFunction& fn, const ICGProgram& program) {
+    map<size_t, VectorLoop> loops;
+    const auto& code = fn.code;
+    auto typeOf = [&](const string& operand) { return operandType(fn, program, operand); };
+
+    for (size_t test = 1; test + 1 < code.size(); test++) {
+        const Quad& exit = code[test];
+        if (code[test - 1].op != "label") continue;
+        VectorLoop loop;
+        if (exit.op == "bge") {
+            loop.counter = exit.arg1;
+            loop.limit = exit.arg2;
+        }
+        else if (exit.op == "ble") {
+            loop.counter = exit.arg2;
+            loop.limit = exit.arg1;
+        }
+        else continue;
+        if (isLiteral(loop.counter) || typeOf(loop.counter) != "K_INT" || typeOf(loop.limit) != "K_INT") continue;
+
+        // Straight line body up to "i = i + 1; b header"
+        size_t update = test + 1;
+        while (update < code.size() && (isPureOp(code[update].op) || code[update].op == "[]=")) {
+            const Quad& q = code[update];
+            if (q.op == "+" && q.dest == loop.counter && q.arg1 == loop.counter && q.arg2 == "1") break;
+            update++;
+        }
+        if (update + 1 >= code.size() || code[update].dest != loop.counter || code[update + 1].op != "b") continue;
+        size_t header = test - 1;
+        bool backEdge = false;
+        while (true) {
+            if (code[header].dest == code[update + 1].dest) backEdge = true;
+            if (header == 0 || code[header - 1].op != "label") break;
+            header--;
+        }
+        if (!backEdge) continue;
+        loop.bodyStart = test + 1;
+        loop.bodyEnd = update;
+
+        // One element type, i only as an index, proven accesses, written vars defined once before use
+        bool ok = true, stores = false;
+        string type;
+        set<string> written, invariants;
+        auto operand = [&](const string& name) {
+            if (name == loop.counter) ok = false;
+            else if (!written.count(name)) invariants.insert(name);
+            if (type.empty()) type = typeOf(name);
+            if (typeOf(name) != type) ok = false;
+        };
+        for (size_t i = loop.bodyStart; i < loop.bodyEnd && ok; i++) {
+            const Quad& q = code[i];
+            if (q.op == "=[]") {
+                ok = q.inBounds && q.arg2 == loop.counter;
+                operand(q.arg1);
+                invariants.erase(q.arg1);
+            }
+            else if (q.op == "[]=") {
+                ok = q.inBounds && q.arg1 == loop.counter;
+                operand(q.dest);
+                invariants.erase(q.dest);
+                operand(q.arg2);
+                stores = true;
+            }
+            else if (q.op == "=") operand(q.arg1);
+            else if (q.op == "+" || q.op == "-" || q.op == "*" || q.op == "/") {
+                operand(q.arg1);
+                operand(q.arg2);
+            }
+            else ok = false;
+            if (q.op == "[]=") continue;
+            if (!fn.varTypes.count(q.dest) || written.count(q.dest) || invariants.count(q.dest) || q.dest == loop.counter) ok = false;
+            operand(q.dest);
+            invariants.erase(q.dest);
+            written.insert(q.dest);
+        }
+        loop.isDouble = type == "K_DOUBLE";
+        if (!ok || !stores || written.count(loop.limit) || (!loop.isDouble && type != "K_INT")) continue;
+        for (size_t i = loop.bodyStart; i < loop.bodyEnd && !loop.isDouble; i++) {
+            if (code[i].op == "/" || (code[i].op == "*" && !ctx.options.avx2)) ok = false; // no packed int divide (or SSE2 multiply)
+        }
+        for (size_t i = 0; i < code.size() && ok; i++) {
+            if (i >= loop.bodyStart && i < loop.bodyEnd) continue;
+            for (const auto& name : quadReads(code[i])) {
+                if (written.count(name)) ok = false;
+            }
+        }
+        size_t registers = invariants.size();
+        for (size_t i = loop.bodyStart; i < loop.bodyEnd; i++) {
+            if (code[i].op != "=" && code[i].op != "[]=") registers++;
+        }
+        if (!ok || registers > vectorRegisters) continue;
+        loop.invariants.assign(invariants.begin(), invariants.end());
+        loops[test] = loop;
+    }
+    return loops;
+}
+
+/**
+ * Loop Unrolling
+ * - Innermost counted loops (see CountedLoop) whose var is updated on every path, once per iteration
+ * - Full: an entry literal, a literal limit and the step give the trip count and if trip count x
+ *   body quads fits options.unrollBudget the loop is replaced by that many copies of its body
+ * - Partial: a new loop runs options.unrollFactor copies of the body per exit test while
+ *   var REL limit - (factor - 1) * step holds, the original loop runs what's left
+ * - Copies are plain straight line code again so constant propagation, folding and CSE run over
+ *   them afterwards (loops the x86-64 vectorizer takes are left alone)
+*/
+
+// Body quads [from, to] with the labels defined in them renamed --> appended to out
+void appendBodyCopy(ICGFunction& fn, const vector<Quad>& code, size_t from, size_t to, vector<Quad>& out) {
+    map<string, string> rename;
+    for (size_t i = from; i <= to; i++) {
+        if (code[i].op == "label") rename[code[i].dest] = newLabel(fn);
+    }
+    for (size_t i = from; i <= to; i++) {
+        Quad copy = code[i];
+        if (rename.count(copy.dest) && (copy.op == "label" || copy.op == "b" || isBranchOp(copy.op))) copy.dest = rename.at(copy.dest);
+        out.push_back(copy);
+    }
+}
+
+bool unrollLoop(CompilerContext& ctx, ICGFunction& fn, const ICGProgram& program, const string& header) {
+    CountedLoop loop;
+    if (!findCountedLoop(ctx, fn, program, header, loop)) return false;
+    auto& code = fn.code;
+    size_t test = loop.test, last = loop.last;
+    long long step = loop.step;
+    bool increasing = step > 0 && (loop.rel == "<" || loop.rel == "<=");
+    bool decreasing = step < 0 && (loop.rel == ">" || loop.rel == ">=");
+    if (!increasing && !decreasing) return false;
+
+    // Innermost, with the update on the straight line run into the back edge
+    map<string, size_t> labels;
+    for (size_t i = loop.first; i <= last; i++) {
+        if (code[i].op == "label") labels[code[i].dest] = i;
+    }
+    for (size_t i = test + 1; i < last; i++) {
+        const Quad& q = code[i];
+        if ((q.op == "b" || isBranchOp(q.op)) && labels.count(q.dest) && labels.at(q.dest) <= i) return false;
+        if (q.op == "label" && i > loop.update) return false;
+    }
+    if (ctx.options.vectorize && (ctx.options.target == "x86-64" || ctx.options.link) && findVectorLoops(ctx, fn, program).count(test)) return false;
+
+    const Quad exit = code[test];
+    size_t bodyQuads = last - test - 1;
+    vector<Quad> unrolled;
+
+    // Full: trip count known, var ends in range
+    if (loop.entry.var.empty() && loop.limit.var.empty()) {
+        long long entry = loop.entry.offset, limit = loop.limit.offset, distance = increasing ? limit - entry : entry - limit, stride = llabs(step);
+        long long trip = 0;
+        if (loop.rel == "<" || loop.rel == ">") trip = (distance > 0) ? (distance + stride - 1) / stride : 0;
+        else trip = (distance >= 0) ? distance / stride + 1 : 0;
+        long long end = entry + trip * step;
+        if (trip * static_cast<long long>(bodyQuads) <= ctx.options.unrollBudget && end >= INT32_MIN && end <= INT32_MAX) {
+            for (size_t i = loop.first; i < test; i++) unrolled.push_back(code[i]);
+            for (long long copy = 0; copy < trip; copy++) appendBodyCopy(fn, code, test + 1, last - 1, unrolled);
+            unrolled.push_back({"b", exit.dest, "", ""});
+            code.erase(code.begin() + loop.first, code.begin() + last + 1);
+            code.insert(code.begin() + loop.first, unrolled.begin(), unrolled.end());
+            if (ctx.options.unrollReport) ctx.out << "Unrolled: " << fn.name << " loop at quad " << test << " (full x" << trip << ")" << endl;
+            return true;
+        }
+    }
+
+    // Partial: factor copies per test of var REL adjusted, guarded so adjusted can't overflow
+    long long factor = ctx.options.unrollFactor;
+    while (factor > 1 && factor * static_cast<long long>(bodyQuads) > ctx.options.unrollBudget) factor--;
+    if (factor < 2) return false;
+    long long shift = (factor - 1) * step; // adjusted = limit - shift
+    string remainder = newLabel(fn), adjusted;
+    if (loop.limit.var.empty()) {
+        long long value = loop.limit.offset - shift;
+        if (value < INT32_MIN || value > INT32_MAX) return false;
+        adjusted = to_string(value);
+    }
+    else {
+        if (increasing) unrolled.push_back({"blt", remainder, loop.limit.var, to_string(INT32_MIN + shift)});
+        else unrolled.push_back({"bgt", remainder, loop.limit.var, to_string(INT32_MAX + shift)});
+        adjusted = newTemp(fn, "K_INT");
+        unrolled.push_back({"-", adjusted, loop.limit.var, to_string(shift)});
+    }
+    string unrolledHeader = newLabel(fn, "loop");
+    unrolled.push_back({"label", unrolledHeader, "", ""});
+    Quad adjustedExit = exit;
+    adjustedExit.dest = remainder;
+    adjustedExit.site = 0;
+    if (adjustedExit.arg1 == loop.var) adjustedExit.arg2 = adjusted;
+    else adjustedExit.arg1 = adjusted;
+    unrolled.push_back(adjustedExit);
+    for (long long copy = 0; copy < factor; copy++) appendBodyCopy(fn, code, test + 1, last - 1, unrolled);
+    unrolled.push_back({"b", unrolledHeader, "", ""});
+    unrolled.push_back({"label", remainder, "", ""});
+    code.insert(code.begin() + loop.first, unrolled.begin(), unrolled.end());
+    if (ctx.options.unrollReport) ctx.out << "Unrolled: " << fn.name << " loop at quad " << test << " (x" << factor << ")" << endl;
+    return true;
+}
+
+bool unrollLoops(CompilerContext& ctx, ICGFunction& fn, const ICGProgram& program) {
+    vector<string> headers;
+    set<string> seen;
+    for (size_t i = 0; i < fn.code.size(); i++) {
+        const Quad& q = fn.code[i];
+        if (q.op == "label") seen.insert(q.dest);
+        else if (q.op == "b" && seen.count(q.dest)) headers.push_back(q.dest);
+    }
+    bool changed = false;
+    for (const auto& header : headers) changed = unrollLoop(ctx, fn, program, header) || changed;
+    return changed;
+}
+
+/**
+ * Profile Guided Optimization
+ * - --profile-generate runs the program on the VM with a counter at every function entry, label and
+ *   conditional branch. Sites are numbered when the 3TAC is generated so counts still match after
+ *   the optimizer moves, copies or inverts them
+ * - --profile-use reads the counts back: blocks are laid out so the hotter successor falls through,
+ *   callees are inlined by call count and register allocation weighs uses by block count
+*/
+
+// Profile file: "sites N" then "call name count", "label site count" and "branch site executed taken" lines
+bool readProfile(CompilerContext& ctx, const string& path, const ICGProgram& program) {
+    ifstream in(path);
+    if (!in.is_open()) {
+        ctx.err << "Error opening profile " << path << endl;
+        return false;
+    }
+    int sites = -1;
+    string kind;
+    while (in >> kind) {
+        if (kind == "sites") in >> sites;
+        else if (kind == "call") {
+            string name;
+            in >> name;
+            in >> ctx.profile.calls[name];
+        }
+        else if (kind == "label") {
+            int site;
+            in >> site;
+            in >> ctx.profile.labels[site];
+        }
+        else if (kind == "branch") {
+            int site;
+            in >> site;
+            auto& counts = ctx.profile.branches[site];
+            in >> counts.first >> counts.second;
+        }
+        else getline(in, kind); // # comment
+    }
+    if (sites != program.siteNum) {
+        ctx.err << "Profile " << path << " is from a different program, ignoring it" << endl;
+        ctx.profile = Profile();
+        return false;
+    }
+    ctx.profile.loaded = true;
+    return true;
+}
+
+// Profiled (executed, taken) counts of conditional branch q --> false if it has none
+bool branchProfile(CompilerContext& ctx, const Quad& q, uint64_t& executed, uint64_t& taken) {
+    auto counts = ctx.profile.branches.find(abs(q.site));
+    if (q.site == 0 || counts == ctx.profile.branches.end()) return false;
+    executed = counts->second.first;
+    taken = (q.site > 0) ? counts->second.second : executed - counts->second.second;
+    return true;
+}
+
+/**
+ * Times each quad ran in the profile (empty if fn wasn't profiled)
+ * - Profiled labels reset the count, a conditional branch leaves its not taken count and b/return zero
+ * - Labels the optimizer added (inlined exits, layout) get the counts of the branches to them
+*/
+vector<double> quadFrequencies(CompilerContext& ctx, const ICGFunction& fn) {
+    auto calls = ctx.profile.calls.find(fn.name);
+    if (!ctx.profile.loaded || calls == ctx.profile.calls.end()) return {};
+
+    const auto& code = fn.code;
+    vector<double> frequency(code.size());
+    map<string, double> incoming;
+    for (int pass = 0; pass < 2; pass++) { // second pass sees the back edges too
+        map<string, double> branchedTo;
+        double count = static_cast<double>(calls->second);
+        for (size_t i = 0; i < code.size(); i++) {
+            const Quad& q = code[i];
+            if (q.op == "label") {
+                auto label = ctx.profile.labels.find(q.site);
+                if (q.site != 0 && label != ctx.profile.labels.end()) count = static_cast<double>(label->second);
+                else count += incoming[q.dest];
+            }
+            frequency[i] = count;
+
+            uint64_t executed, taken;
+            if (isBranchOp(q.op) && branchProfile(ctx, q, executed, taken)) {
+                branchedTo[q.dest] += static_cast<double>(taken);
+                count = static_cast<double>(executed - taken);
+            }
+            else if (isBranchOp(q.op)) branchedTo[q.dest] += count;
+            else if (q.op == "b") {
+                branchedTo[q.dest] += count;
+                count = 0;
+            }
+            else if (q.op == "return") count = 0;
+        }
+        incoming = branchedTo;
+    }
+    return frequency;
+}
+
+/**
+ * Profile guided block layout (greedy chains like Pettis-Hansen)
+ * - From the entry each block is followed by its hottest successor not yet placed, so the likely
+ *   side of every if/while falls through (an else run more often than its then arm goes first)
+ * - When a chain runs out it continues at the next block (in source order) that ran, blocks that
+ *   never ran go last
+ * - Branches are then inverted or followed by a b so every edge still reaches its target
+*/
+void layoutBlocks(CompilerContext& ctx, ICGFunction& fn) {
+    if (!ctx.profile.loaded || !ctx.profile.calls.count(fn.name)) return;
+
+    // Every block but the entry starts with a label and falling off the end goes to a last (empty) block
+    auto endsBlock = [](const Quad& q) { return q.op == "b" || q.op == "return" || isBranchOp(q.op); };
+    vector<Quad> code;
+    for (size_t i = 0; i < fn.code.size(); i++) {
+        if (i > 0 && endsBlock(fn.code[i - 1]) && fn.code[i].op != "label") code.push_back({"label", newLabel(fn), "", ""});
+        code.push_back(fn.code[i]);
+    }
+    code.push_back({"label", newLabel(fn), "", ""});
+    fn.code = code;
+    vector<double> frequency = quadFrequencies(ctx, fn);
+
+    vector<size_t> starts;
+    map<string, int> blockOf;
+    for (size_t i = 0; i < code.size(); i++) {
+        bool leader = (i == 0) || (code[i].op == "label" && code[i - 1].op != "label") || endsBlock(code[i - 1]);
+        if (leader) starts.push_back(i);
+        if (code[i].op == "label") blockOf[code[i].dest] = static_cast<int>(starts.size() - 1);
+    }
+    int blocks = static_cast<int>(starts.size());
+    int endBlock = blocks - 1;
+    auto blockEnd = [&](int b) { return (b + 1 < blocks) ? starts[b + 1] : code.size(); };
+
+    // (successor, times the edge ran) --> fall through first so ties keep the source order
+    vector<vector<pair<int, double>>> successors(blocks);
+    for (int b = 0; b < endBlock; b++) {
+        const Quad& last = code[blockEnd(b) - 1];
+        double count = frequency[blockEnd(b) - 1];
+        uint64_t executed, taken;
+        if (isBranchOp(last.op)) {
+            bool profiled = branchProfile(ctx, last, executed, taken);
+            successors[b].push_back({b + 1, profiled ? static_cast<double>(executed - taken) : count / 2});
+            successors[b].push_back({blockOf.at(last.dest), profiled ? static_cast<double>(taken) : count / 2});
+        }
+        else if (last.op == "b") successors[b].push_back({blockOf.at(last.dest), count});
+        else if (last.op != "return") successors[b].push_back({b + 1, count});
+    }
+
+    vector<int> order;
+    vector<bool> placed(blocks, false);
+    placed[endBlock] = true;
+    for (int current = 0; current >= 0;) {
+        placed[current] = true;
+        order.push_back(current);
+
+        int next = -1;
+        double best = 0;
+        for (const auto& successor : successors[current]) {
+            if (!placed[successor.first] && successor.second > best) {
+                next = successor.first;
+                best = successor.second;
+            }
+        }
+        for (int b = 0; b < blocks && next < 0; b++) {
+            if (!placed[b] && frequency[starts[b]] > 0) next = b;
+        }
+        for (int b = 0; b < blocks && next < 0; b++) {
+            if (!placed[b]) next = b;
+        }
+        current = next;
+    }
+    if (endBlock > 0) order.push_back(endBlock);
+
+    vector<Quad> result;
+    for (size_t k = 0; k < order.size(); k++) {
+        int b = order[k];
+        int following = (k + 1 < order.size()) ? order[k + 1] : -1;
+        result.insert(result.end(), code.begin() + starts[b], code.begin() + blockEnd(b));
+        if (b == endBlock) continue;
+
+        string fallLabel = code[starts[b + 1]].dest;
+        Quad& last = result.back();
+        if (isBranchOp(last.op) && b + 1 != following) {
+            if (blockOf.at(last.dest) == following) {
+                last = {invertBranch(last.op), fallLabel, last.arg1, last.arg2, -last.site};
+            }
+            else result.push_back({"b", fallLabel, "", ""});
+        }
+        else if (!endsBlock(last) && b + 1 != following) result.push_back({"b", fallLabel, "", ""});
+    }
+    fn.code = result;
+    simplifyControlFlow(fn);
+}
+
+/**
+ * Register Allocation (linear scan)
+ * - Liveness is solved per basic block over each function's 3TAC, then every scalar var gets
+ *   one live interval [first quad live, last quad live] (loops extend it to the back edge)
+ * - Intervals are scanned by start point and handed callee saved registers (r4-r10 for ints,
+ *   d8-d15 for doubles) so values survive calls without caller saves
+ * - When a class runs out of registers the interval with the lowest spill weight is spilled
+ *   (uses weighted by 10^loop depth, or by block count with --profile-use) so hot loop vars stay in registers
+ * - Spilled vars get a stack slot below the saved registers and the frame size is computed from them
+*/
+struct TargetRegisters {
+    vector<string> ints; // callee saved --> values survive calls
+    vector<string> doubles;
+    int intBytes; // bytes each saved int reg takes below fp
+    int paramRegisters; // int/double params passed in registers (0 --> all params on the stack)
+};
+
+const TargetRegisters armRegisters = {{"r4", "r5", "r6", "r7", "r8", "r9", "r10"}, {"d8", "d9", "d10", "d11", "d12", "d13", "d14", "d15"}, 4, 0};
+
+struct FrameLayout {
+    map<string, string> registers; // var --> r4-r10 or d8-d15
+    map<string, int> slots; // spilled var, param or array --> offset from fp
+    set<string> promotedGlobals; // globals main keeps in registers or slots
+    set<string> liveAtEntry; // vars read before they are written
+    vector<string> savedInt; // callee saved regs pushed in the prologue
+    vector<string> savedDouble;
+    int savedBytes = 0; // bytes of saved regs below fp
+    int frameSize = 0; // bytes of spill slots and arrays below the saved regs
+    int spills = 0;
+};
+
+// Globals each function may read or write (directly or through calls)
+map<string, set<string>> globalsTouched(const ICGProgram& program) {
+    map<string, set<string>> touched;
+    map<string, set<string>> callees;
+    for (const auto& fn : program.functions) {
+        auto& globals = touched[fn.name];
+        for (const auto& q : fn.code) {
+            if (q.op == "call") callees[fn.name].insert(q.arg1);
+            vector<string> names = quadReads(q);
+            if (isPureOp(q.op) || q.op == "call") names.push_back(q.dest);
+            for (const auto& name : names) {
+                if (!isLiteral(name) && !fn.varTypes.count(name) && (program.globals.count(name))) globals.insert(name);
+            }
+        }
+    }
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto& entry : touched) {
+            for (const auto& callee : callees[entry.first]) {
+                for (const auto& global : touched[callee]) changed = entry.second.insert(global).second || changed;
+            }
+        }
+    }
+    return touched;
+}
+
+// Loop depth of every quad --> a branch back to an earlier label closes a loop
+vector<int> loopDepths(const vector<Quad>& code) {
+    map<string, size_t> labels;
+    for (size_t i = 0; i < code.size(); i++) {
+        if (code[i].op == "label") labels[code[i].dest] = i;
+    }
+    vector<int> depth(code.size(), 0);
+    for (size_t i = 0; i < code.size(); i++) {
+        if (code[i].op != "b" && !isBranchOp(code[i].op)) continue;
+        auto target = labels.find(code[i].dest);
+        if (target == labels.end() || target->second > i) continue;
+        for (size_t j = target->second; j <= i; j++) depth[j] += 1;
+    }
+    return depth;
+}
+
+vector<LiveInterval> buildIntervals(CompilerContext& ctx, const ICGFunction& fn, const ICGProgram& program, const set<string>& allocatable, set<string>& liveAtEntry) {
+    const auto& code = fn.code;
+    size_t n = code.size();
+
+    // Var ids for bitsets
+    map<string, int> ids;
+    vector<string> vars;
+    for (const auto& var : allocatable) {
+        ids[var] = static_cast<int>(vars.size());
+        vars.push_back(var);
+    }
+    size_t words = (vars.size() + 63) / 64;
+    auto setBit = [](vector<uint64_t>& bits, int id) { bits[id / 64] |= (1ULL << (id % 64)); };
+    auto clearBit = [](vector<uint64_t>& bits, int id) { bits[id / 64] &= ~(1ULL << (id % 64)); };
+
+    // Basic blocks: leaders are the first quad, labels and quads after branches
+    map<string, size_t> labels;
+    vector<size_t> blockStart;
+    for (size_t i = 0; i < n; i++) {
+        if (code[i].op == "label") labels[code[i].dest] = i;
+        bool leader = (i == 0) || code[i].op == "label" || code[i - 1].op == "b" || code[i - 1].op == "return" || isBranchOp(code[i - 1].op);
+        if (leader) blockStart.push_back(i);
+    }
+    size_t blocks = blockStart.size();
+    vector<size_t> blockEnd(blocks);
+    vector<int> blockOf(n);
+    for (size_t b = 0; b < blocks; b++) {
+        blockEnd[b] = (b + 1 < blocks) ? blockStart[b + 1] - 1 : n - 1;
+        for (size_t i = blockStart[b]; i <= blockEnd[b]; i++) blockOf[i] = static_cast<int>(b);
+    }
+
+    vector<vector<int>> successors(blocks);
+    for (size_t b = 0; b < blocks; b++) {
+        const Quad& last = code[blockEnd[b]];
+        if (last.op == "b" || isBranchOp(last.op)) {
+            auto target = labels.find(last.dest);
+            if (target != labels.end()) successors[b].push_back(blockOf[target->second]);
+        }
+        if (last.op != "b" && last.op != "return" && b + 1 < blocks) successors[b].push_back(static_cast<int>(b + 1));
+    }
+
+    // Gen (used before written) and kill (written) per block
+    vector<vector<uint64_t>> gen(blocks, vector<uint64_t>(words)), kill(blocks, vector<uint64_t>(words));
+    for (size_t b = 0; b < blocks; b++) {
+        for (size_t i = blockStart[b]; i <= blockEnd[b]; i++) {
+            for (const auto& name : quadReads(code[i])) {
+                auto id = ids.find(name);
+                if (id != ids.end() && !(kill[b][id->second / 64] & (1ULL << (id->second % 64)))) setBit(gen[b], id->second);
+            }
+            for (const auto& name : quadDefs(code[i])) {
+                auto id = ids.find(name);
+                if (id != ids.end()) setBit(kill[b], id->second);
+            }
+        }
+    }
+
+    vector<vector<uint64_t>> liveIn(blocks, vector<uint64_t>(words)), liveOut(blocks, vector<uint64_t>(words));
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t b = blocks; b-- > 0;) {
+            vector<uint64_t> out(words, 0);
+            for (int s : successors[b]) {
+                for (size_t w = 0; w < words; w++) out[w] |= liveIn[s][w];
+            }
+            vector<uint64_t> in(words);
+            for (size_t w = 0; w < words; w++) in[w] = gen[b][w] | (out[w] & ~kill[b][w]);
+            if (in != liveIn[b] || out != liveOut[b]) {
+                liveIn[b] = in;
+                liveOut[b] = out;
+                changed = true;
+            }
+        }
+    }
+
+    // Intervals --> walk each block backwards from its live out set
+    vector<LiveInterval> intervals(vars.size());
+    vector<int> depth = loopDepths(code);
+    vector<double> frequency = quadFrequencies(ctx, fn);
+    for (size_t v = 0; v < vars.size(); v++) {
+        intervals[v].var = vars[v];
+        intervals[v].isDouble = operandType(fn, program, vars[v]) == "K_DOUBLE";
+    }
+    auto extend = [&intervals](int id, int position) {
+        auto& interval = intervals[id];
+        if (interval.start < 0 || position < interval.start) interval.start = position;
+        if (position > interval.end) interval.end = position;
+    };
+
+    for (size_t b = 0; b < blocks; b++) {
+        vector<uint64_t> live = liveOut[b];
+        for (size_t v = 0; v < vars.size(); v++) {
+            if (live[v / 64] & (1ULL << (v % 64))) extend(static_cast<int>(v), static_cast<int>(blockEnd[b]));
+        }
+        for (size_t i = blockEnd[b] + 1; i-- > blockStart[b];) {
+            double weight = frequency.empty() ? pow(10.0, min(depth[i], 6)) : 1 + frequency[i];
+            for (const auto& name : quadDefs(code[i])) {
+                auto id = ids.find(name);
+                if (id == ids.end()) continue;
+                extend(id->second, static_cast<int>(i));
+                intervals[id->second].weight += weight;
+                clearBit(live, id->second);
+            }
+            for (const auto& name : quadReads(code[i])) {
+                auto id = ids.find(name);
+                if (id == ids.end()) continue;
+                extend(id->second, static_cast<int>(i));
+                intervals[id->second].weight += weight;
+                setBit(live, id->second);
+            }
+        }
+        for (size_t v = 0; v < vars.size(); v++) {
+            if (live[v / 64] & (1ULL << (v % 64))) extend(static_cast<int>(v), static_cast<int>(blockStart[b]));
+        }
+    }
+
+    // Params (and promoted globals read before written) are loaded at entry
+    if (blocks > 0) {
+        for (size_t v = 0; v < vars.size(); v++) {
+            if (!(liveIn[0][v / 64] & (1ULL << (v % 64)))) continue;
+            extend(static_cast<int>(v), 0);
+            liveAtEntry.insert(vars[v]);
+        }
+    }
+
+    vector<LiveInterval> result;
+    for (const auto& interval : intervals) {
+        if (interval.start >= 0) result.push_back(interval);
+    }
+    sort(result.begin(), result.end(), [](const LiveInterval& a, const LiveInterval& b) {
+        return a.start < b.start || (a.start == b.start && a.var < b.var);
+    });
+    return result;
+}
+
+// Linear scan over one register class --> fills frame.registers, returns spilled intervals
+vector<LiveInterval> linearScan(const vector<LiveInterval>& intervals, const vector<string>& registers, FrameLayout& frame) {
+    vector<LiveInterval> active; // sorted by end
+    vector<string> freeRegisters(registers.rbegin(), registers.rend());
+    vector<LiveInterval> spilled;
+
+    for (const auto& current : intervals) {
+        // Expire intervals that ended before current starts
+        for (auto it = active.begin(); it != active.end();) {
+            if (it->end >= current.start) break;
+            freeRegisters.push_back(frame.registers[it->var]);
+            it = active.erase(it);
+        }
+
+        if (!freeRegisters.empty()) {
+            frame.registers[current.var] = freeRegisters.back();
+            freeRegisters.pop_back();
+        }
+        else {
+            // Spill the cheapest of the active intervals and current
+            auto cheapest = min_element(active.begin(), active.end(), [](const LiveInterval& a, const LiveInterval& b) {
+                return a.weight < b.weight || (a.weight == b.weight && a.end > b.end);
+            });
+            if (cheapest != active.end() && cheapest->weight < current.weight) {
+                frame.registers[current.var] = frame.registers[cheapest->var];
+                frame.registers.erase(cheapest->var);
+                spilled.push_back(*cheapest);
+                active.erase(cheapest);
+            }
+            else {
+                spilled.push_back(current);
+                continue;
+            }
+        }
+
+        auto position = find_if(active.begin(), active.end(), [&current](const LiveInterval& a) { return a.end > current.end; });
+        active.insert(position, current);
+    }
+    return spilled;
+}
+
+/**
+ * Stack Slots (interference coloring)
+ * - Spilled vars whose live intervals don't overlap share a slot, intervals are colored in start
+ *   order so the number of slots is the most vars ever live at once
+ * - Doubles get 8 byte aligned slots first, then ints 4 byte slots, then arrays (live for the
+ *   whole function) get their own space
+*/
+void colorSlots(const vector<LiveInterval>& intervals, int bytes, int& offset, map<string, int>& slots) {
+    vector<pair<int, int>> colors; // (fp offset, end of the last interval in the slot)
+    for (const auto& interval : intervals) {
+        auto color = find_if(colors.begin(), colors.end(), [&interval](const pair<int, int>& c) { return c.second < interval.start; });
+        if (color == colors.end()) {
+            offset = (offset + 2 * bytes - 1) / bytes * bytes;
+            colors.push_back({-offset, interval.end});
+            color = colors.end() - 1;
+        }
+        else color->second = interval.end;
+        slots[interval.var] = color->first;
+    }
+}
+
+// Lays out spilled vars and arrays below offset base --> returns bytes used (multiple of 8)
+int layoutStackSlots(const ICGFunction& fn, const ICGProgram& program, const vector<LiveInterval>& spilled, int base, map<string, int>& slots) {
+    vector<LiveInterval> doubles, ints;
+    for (const auto& interval : spilled) {
+        if (slots.count(interval.var)) continue; // params keep their incoming slot
+        (interval.isDouble ? doubles : ints).push_back(interval);
+    }
+    auto byStart = [](const LiveInterval& a, const LiveInterval& b) { return a.start < b.start; };
+    sort(doubles.begin(), doubles.end(), byStart);
+    sort(ints.begin(), ints.end(), byStart);
+
+    int offset = base;
+    colorSlots(doubles, 8, offset, slots);
+    colorSlots(ints, 4, offset, slots);
+    for (const auto& array : fn.arraySizes) {
+        int size = typeSize(operandType(fn, program, array.first));
+        offset = (offset + size * array.second + size - 1) / size * size;
+        slots[array.first] = -offset;
+    }
+    return (offset - base + 7) / 8 * 8;
+}
+
+void assignStackSlots(const ICGFunction& fn, const ICGProgram& program, const vector<LiveInterval>& spilled, FrameLayout& frame) {
+    frame.frameSize = layoutStackSlots(fn, program, spilled, frame.savedBytes, frame.slots);
+}
+
+// Bytes for locals and temps kept in memory (slots shared by colouring) plus the return value at fp - 4
+void computeFrameSize(CompilerContext& ctx, ICGFunction& fn, const ICGProgram& program) {
+    set<string> locals;
+    for (const auto& var : fn.varTypes) {
+        if (!fn.arraySizes.count(var.first)) locals.insert(var.first);
+    }
+    map<string, int> slots;
+    for (const auto& p : fn.params) slots[p.second] = 0;
+
+    set<string> liveAtEntry;
+    int base = (fn.name == "main") ? 0 : 4;
+    fn.bytesRequired = base + layoutStackSlots(fn, program, buildIntervals(ctx, fn, program, locals, liveAtEntry), base, slots);
+}
+
+FrameLayout allocateRegisters(CompilerContext& ctx, const ICGFunction& fn, const ICGProgram& program, const set<string>& promotedGlobals, const TargetRegisters& target = armRegisters) {
+    FrameLayout frame;
+    frame.promotedGlobals = promotedGlobals;
+
+    // Params arrive on the stack --> the last param is at fp + 8
+    if (target.paramRegisters == 0) {
+        int offset = 8;
+        for (auto p = fn.params.rbegin(); p != fn.params.rend(); ++p) {
+            frame.slots[p->second] = offset;
+            offset += typeSize(p->first);
+        }
+    }
+
+    // Params past the register ones are pushed right to left --> the first is at fp + 16
+    else {
+        int ints = 0, doubles = 0, offset = 16;
+        for (const auto& p : fn.params) {
+            int& used = (p.first == "K_DOUBLE") ? doubles : ints;
+            if (used++ < ((p.first == "K_DOUBLE") ? 8 : target.paramRegisters)) continue;
+            frame.slots[p.second] = offset;
+            offset += 8;
+        }
+    }
+
+    set<string> allocatable(promotedGlobals);
+    for (const auto& var : fn.varTypes) {
+        if (!fn.arraySizes.count(var.first)) allocatable.insert(var.first);
+    }
+
+    vector<LiveInterval> intervals = buildIntervals(ctx, fn, program, allocatable, frame.liveAtEntry);
+    vector<LiveInterval> ints, doubles;
+    for (const auto& interval : intervals) (interval.isDouble ? doubles : ints).push_back(interval);
+
+    vector<LiveInterval> spilled;
+    if (ctx.options.registerAllocation) {
+        spilled = linearScan(ints, target.ints, frame);
+        vector<LiveInterval> spilledDoubles = linearScan(doubles, target.doubles, frame);
+        spilled.insert(spilled.end(), spilledDoubles.begin(), spilledDoubles.end());
+    }
+    else spilled = intervals;
+    frame.spills = static_cast<int>(spilled.size());
+
+    for (const auto& reg : target.ints) {
+        for (const auto& entry : frame.registers) if (entry.second == reg) { frame.savedInt.push_back(reg); break; }
+    }
+    for (const auto& reg : target.doubles) {
+        for (const auto& entry : frame.registers) if (entry.second == reg) { frame.savedDouble.push_back(reg); break; }
+    }
+    frame.savedBytes = target.intBytes * static_cast<int>(frame.savedInt.size()) + 8 * static_cast<int>(frame.savedDouble.size());
+
+    assignStackSlots(fn, program, spilled, frame);
+    return frame;
+}
+
+/**
+ * ARM Code Generation
+ * - Args are pushed in order (last arg at fp + 8), results come back in r0 / d0
+ * - Spilled operands are loaded into scratch regs (r0-r2, d0-d2) and r3 holds addresses
+ * - print lowers to bl print_int / bl print_double
+*/
+struct Instr {
+    string op; // mov, add, ldr, b, label, etc...
+    vector<string> args;
+};
+
+struct ARMGenerator {
+    CompilerContext& ctx;
+    const ICGProgram& program;
+    const ICGFunction& fn;
+    const FrameLayout& frame;
+    vector<Instr>& out;
+    int pushedBytes = 0; // args pushed for the next call
+
+    ARMGenerator(CompilerContext& context, const ICGProgram& prog, const ICGFunction& function, const FrameLayout& layout, vector<Instr>& instrs)
+        : ctx(context), program(prog), fn(function), frame(layout), out(instrs) {}
+
+    void add(const string& op, const vector<string>& args = {}) { out.push_back({op, args}); }
+
+    string label(const string& name) const { return fn.name + "_" + name; }
+
+    bool isDouble(const string& operand) const { return operandType(fn, program, operand) == "K_DOUBLE"; }
+
+    bool isGlobal(const string& name) const {
+        return !fn.varTypes.count(name) && !frame.promotedGlobals.count(name) && (program.globals.count(name) || program.globalArrays.count(name));
+    }
+
+    string slot(const string& var) const {
+        return "[fp, #" + to_string(frame.slots.at(var)) + "]";
+    }
+
+    // Register holding operand (loads literals and spilled vars into scratch k)
+    string use(const string& operand, int k, bool asDouble) {
+        string scratch = (asDouble ? "d" : "r") + to_string(k);
+        if (isLiteral(operand)) {
+            if (asDouble) add("vldr", {scratch, "=" + doubleLiteralText(ctx, literalConstant(ctx, operand).doubleValue)});
+            else add("mov", {scratch, "#" + operand});
+            return scratch;
+        }
+
+        string reg;
+        auto allocated = frame.registers.find(operand);
+        if (allocated != frame.registers.end()) reg = allocated->second;
+        else if (isGlobal(operand)) {
+            add("ldr", {"r3", "=" + operand});
+            reg = isDouble(operand) ? "d" + to_string(k) : "r" + to_string(k);
+            add(isDouble(operand) ? "vldr" : "ldr", {reg, "[r3]"});
+        }
+        else {
+            reg = isDouble(operand) ? "d" + to_string(k) : "r" + to_string(k);
+            add(isDouble(operand) ? "vldr" : "ldr", {reg, slot(operand)});
+        }
+
+        // int --> double conversion
+        if (asDouble && reg[0] == 'r') {
+            add("vmov", {"s0", reg});
+            add("vcvt.f64.s32", {scratch, "s0"});
+            return scratch;
+        }
+        return reg;
+    }
+
+    // Register to compute dest into
+    string target(const string& dest) {
+        auto allocated = frame.registers.find(dest);
+        if (allocated != frame.registers.end()) return allocated->second;
+        return isDouble(dest) ? "d0" : "r0";
+    }
+
+    // Store dest back if it lives in memory
+    void store(const string& dest, const string& reg) {
+        if (frame.registers.count(dest)) return;
+        if (isGlobal(dest)) {
+            add("ldr", {"r3", "=" + dest});
+            add(reg[0] == 'd' ? "vstr" : "str", {reg, "[r3]"});
+        }
+        else add(reg[0] == 'd' ? "vstr" : "str", {reg, slot(dest)});
+    }
+
+    void move(const string& dest, const string& src) {
+        if (dest == src) return;
+        add(dest[0] == 'd' ? "vmov.f64" : "mov", {dest, src});
+    }
+
+    // Compares arg1 with arg2 and sets flags
+    void compare(const Quad& q) {
+        bool asDouble = isDouble(q.arg1) || isDouble(q.arg2);
+        string a = use(q.arg1, 1, asDouble);
+        if (!asDouble && isLiteral(q.arg2)) {
+            add("cmp", {a, "#" + q.arg2});
+            return;
+        }
+        string b = use(q.arg2, 2, asDouble);
+        if (asDouble) {
+            add("vcmp.f64", {a, b});
+            add("vmrs", {"APSR_nzcv", "fpscr"});
+        }
+        else add("cmp", {a, b});
+    }
+
+    // Address of array element in r3
+    void elementAddress(const string& array, const string& index) {
+        string i = use(index, 2, false);
+        if (isGlobal(array)) add("ldr", {"r3", "=" + array});
+        else add("add", {"r3", "fp", "#" + to_string(frame.slots.at(array))});
+        add("add", {"r3", "r3", i, "lsl #" + string(isDouble(array) ? "3" : "2")});
+    }
+
+    void lower(const Quad& q) {
+        static const map<string, string> conditions = {
+            {"<", "lt"}, {">", "gt"}, {"==", "eq"}, {"<=", "le"}, {">=", "ge"}, {"<>", "ne"},
+            {"blt", "lt"}, {"bgt", "gt"}, {"beq", "eq"}, {"ble", "le"}, {"bge", "ge"}, {"bne", "ne"}};
+
+        if (q.op == "label") add("label", {label(q.dest)});
+        else if (q.op == "b") add("b", {label(q.dest)});
+        else if (isBranchOp(q.op)) {
+            compare(q);
+            add("b" + conditions.at(q.op), {label(q.dest)});
+        }
+        else if (q.op == "=") {
+            string d = target(q.dest);
+            if (isLiteral(q.arg1) && d[0] == 'r') add("mov", {d, "#" + q.arg1});
+            else if (isLiteral(q.arg1)) add("vldr", {d, "=" + doubleLiteralText(ctx, literalConstant(ctx, q.arg1).doubleValue)});
+            else move(d, use(q.arg1, d[0] == 'd' ? 0 : 1, d[0] == 'd'));
+            store(q.dest, d);
+        }
+        else if (isArithOp(q.op) && isDouble(q.dest)) {
+            static const map<string, string> ops = {{"+", "vadd.f64"}, {"-", "vsub.f64"}, {"*", "vmul.f64"}, {"/", "vdiv.f64"}};
+            string a = use(q.arg1, 1, true);
+            string b = use(q.arg2, 2, true);
+            string d = target(q.dest);
+            if (q.op == "%") {
+                move("d0", a);
+                move("d1", b);
+                add("bl", {"fmod"});
+                move(d, "d0");
+            }
+            else add(ops.at(q.op), {d, a, b});
+            store(q.dest, d);
+        }
+        else if (isArithOp(q.op)) {
+            static const map<string, string> ops = {{"+", "add"}, {"-", "sub"}, {"*", "mul"}, {"/", "sdiv"}};
+            string a = use(q.arg1, 1, false);
+            string d = target(q.dest);
+            bool immediate = (q.op == "+" || q.op == "-") && isLiteral(q.arg2);
+            string b = immediate ? "#" + q.arg2 : use(q.arg2, 2, false);
+            if (q.op == "%") {
+                add("sdiv", {"r0", a, b});
+                add("mls", {d, "r0", b, a});
+            }
+            else add(ops.at(q.op), {d, a, b});
+            store(q.dest, d);
+        }
+        else if (isRelOp(q.op)) {
+            compare({q.op, "", q.arg1, q.arg2});
+            string d = target(q.dest);
+            add("mov", {d, "#0"});
+            add("mov" + conditions.at(q.op), {d, "#1"});
+            store(q.dest, d);
+        }
+        else if (q.op == "and" || q.op == "or") {
+            string a = use(q.arg1, 1, false);
+            string b = use(q.arg2, 2, false);
+            string d = target(q.dest);
+            add(q.op == "and" ? "and" : "orr", {d, a, b});
+            store(q.dest, d);
+        }
+        else if (q.op == "not") {
+            string a = use(q.arg1, 1, false);
+            string d = target(q.dest);
+            add("cmp", {a, "#0"});
+            add("mov", {d, "#0"});
+            add("moveq", {d, "#1"});
+            store(q.dest, d);
+        }
+        else if (q.op == "=[]") {
+            elementAddress(q.arg1, q.arg2);
+            string d = target(q.dest);
+            add(d[0] == 'd' ? "vldr" : "ldr", {d, "[r3]"});
+            store(q.dest, d);
+        }
+        else if (q.op == "[]=") {
+            string v = use(q.arg2, 1, isDouble(q.dest));
+            elementAddress(q.dest, q.arg1);
+            add(v[0] == 'd' ? "vstr" : "str", {v, "[r3]"});
+        }
+        else if (q.op == "param") {
+            string v = use(q.arg1, 0, isDouble(q.arg1));
+            add(v[0] == 'd' ? "vpush" : "push", {"{" + v + "}"});
+            pushedBytes += typeSize(operandType(fn, program, q.arg1));
+        }
+        else if (q.op == "call") {
+            add("bl", {q.arg1});
+            if (pushedBytes > 0) add("add", {"sp", "sp", "#" + to_string(pushedBytes)});
+            pushedBytes = 0;
+            string d = target(q.dest);
+            move(d, d[0] == 'd' ? "d0" : "r0");
+            store(q.dest, d);
+        }
+        else if (q.op == "print") {
+            bool asDouble = isDouble(q.arg1);
+            move(asDouble ? "d0" : "r0", use(q.arg1, 0, asDouble));
+            add("bl", {asDouble ? "print_double" : "print_int"});
+        }
+        else if (q.op == "return") {
+            bool asDouble = fn.returnType == "K_DOUBLE";
+            move(asDouble ? "d0" : "r0", use(q.arg1, 0, asDouble));
+            add("b", {"exit" + fn.name});
+        }
+    }
+
+    void generate() {
+        add("label", {fn.name});
+        add("push", {"{fp, lr}"});
+        add("mov", {"fp", "sp"});
+        if (!frame.savedInt.empty()) add("push", {"{" + joinRegs(frame.savedInt) + "}"});
+        if (!frame.savedDouble.empty()) add("vpush", {"{" + joinRegs(frame.savedDouble) + "}"});
+        if (frame.frameSize > 0) add("sub", {"sp", "sp", "#" + to_string(frame.frameSize)});
+
+        // Params and globals kept in registers are loaded once at entry
+        for (const auto& p : fn.params) {
+            auto reg = frame.registers.find(p.second);
+            if (reg != frame.registers.end()) add(reg->second[0] == 'd' ? "vldr" : "ldr", {reg->second, slot(p.second)});
+        }
+        for (const auto& global : frame.promotedGlobals) {
+            if (!frame.liveAtEntry.count(global)) continue;
+            auto reg = frame.registers.find(global);
+            string zero = isDouble(global) ? "=0.0" : "#0";
+            if (reg != frame.registers.end()) add(reg->second[0] == 'd' ? "vldr" : "mov", {reg->second, zero});
+            else if (frame.slots.count(global)) {
+                add(isDouble(global) ? "vldr" : "mov", {isDouble(global) ? "d0" : "r0", zero});
+                store(global, isDouble(global) ? "d0" : "r0");
+            }
+        }
+
+        for (const auto& q : fn.code) lower(q);
+
+        add("label", {"exit" + fn.name});
+        if (fn.name == "main") add("mov", {"r0", "#0"});
+        if (frame.savedBytes > 0) add("sub", {"sp", "fp", "#" + to_string(frame.savedBytes)});
+        else add("mov", {"sp", "fp"});
+        if (!frame.savedDouble.empty()) add("vpop", {"{" + joinRegs(frame.savedDouble) + "}"});
+        if (!frame.savedInt.empty()) add("pop", {"{" + joinRegs(frame.savedInt) + "}"});
+        add("pop", {"{fp, pc}"});
+    }
+
+    static string joinRegs(const vector<string>& regs) {
+        string joined;
+        for (const auto& reg : regs) joined += (joined.empty() ? "" : ", ") + reg;
+        return joined;
+    }
+};
+
+// Globals main can keep in registers --> no function it calls touches them
+set<string> promotableGlobals(const ICGProgram& program) {
+    set<string> promoted;
+    auto touched = globalsTouched(program);
+    set<string> touchedByCalls;
+    for (const auto& fn : program.functions) {
+        if (fn.name == "main") continue;
+        touchedByCalls.insert(touched[fn.name].begin(), touched[fn.name].end());
+    }
+    for (const auto& global : program.globals) {
+        if (!program.globalArrays.count(global.first) && !touchedByCalls.count(global.first)) promoted.insert(global.first);
+    }
+    return promoted;
+}
+
+string formatInstr(const Instr& instr) {
+    if (instr.op == "label") return instr.args.front() + ":";
+    string line = instr.op;
+    for (size_t i = 0; i < instr.args.size(); i++) line += (i == 0 ? " " : ", ") + instr.args[i];
+    return line;
+}
+
+/**
+ * Peephole Optimizer (ARM)
+ * - Rules are a table of op patterns ("*" matches any op) plus a rewrite that returns false to decline
+ * - Instrs are pushed one at a time onto the output and only the rules whose last op matches the
+ *   newest instr are tried against the tail, so the pass is a single linear scan
+ * - A rewrite replaces the matched tail and the new tail is checked again (eg. mov r4, r4 left by
+ *   store/load forwarding is dropped right away)
+*/
+struct PeepholeRule {
+    string name;
+    vector<string> ops;
+    bool (*rewrite)(const vector<Instr>& window, vector<Instr>& replacement);
+};
+
+bool isMemoryOperand(const string& arg) { return !arg.empty() && arg[0] == '['; }
+
+const vector<PeepholeRule> peepholeRules = {
+    // mov r4, r4 --> (nothing)
+    {"self move", {"mov"}, [](const vector<Instr>& w, vector<Instr>&) {
+        return w[0].args.size() == 2 && w[0].args[0] == w[0].args[1];
+    }},
+    {"self move", {"vmov.f64"}, [](const vector<Instr>& w, vector<Instr>&) {
+        return w[0].args[0] == w[0].args[1];
+    }},
+
+    // b lab1; lab1: --> lab1:
+    {"branch to next", {"b", "label"}, [](const vector<Instr>& w, vector<Instr>& r) {
+        if (w[0].args[0] != w[1].args[0]) return false;
+        r = {w[1]};
+        return true;
+    }},
+
+    // str r0, [fp, #-4]; ldr r1, [fp, #-4] --> str r0, [fp, #-4]; mov r1, r0
+    {"store load", {"str", "ldr"}, [](const vector<Instr>& w, vector<Instr>& r) {
+        if (!isMemoryOperand(w[1].args[1]) || w[0].args[1] != w[1].args[1] || w[1].args[1].find(w[1].args[0]) != string::npos) return false;
+        r = {w[0], {"mov", {w[1].args[0], w[0].args[0]}}};
+        return true;
+    }},
+    {"store load", {"vstr", "vldr"}, [](const vector<Instr>& w, vector<Instr>& r) {
+        if (!isMemoryOperand(w[1].args[1]) || w[0].args[1] != w[1].args[1]) return false;
+        r = {w[0], {"vmov.f64", {w[1].args[0], w[0].args[0]}}};
+        return true;
+    }},
+
+    // ldr r0, [fp, #-4]; str r0, [fp, #-4] --> ldr r0, [fp, #-4]
+    {"load store", {"ldr", "str"}, [](const vector<Instr>& w, vector<Instr>& r) {
+        if (!isMemoryOperand(w[0].args[1]) || w[0].args != w[1].args) return false;
+        r = {w[0]};
+        return true;
+    }},
+    {"load store", {"vldr", "vstr"}, [](const vector<Instr>& w, vector<Instr>& r) {
+        if (w[0].args != w[1].args) return false;
+        r = {w[0]};
+        return true;
+    }},
+
+    // str r0, [fp, #-4]; str r1, [fp, #-4] --> str r1, [fp, #-4]
+    {"dead store", {"str", "str"}, [](const vector<Instr>& w, vector<Instr>& r) {
+        if (w[0].args[1] != w[1].args[1]) return false;
+        r = {w[1]};
+        return true;
+    }},
+
+    // ldr r3, =x; <use of [r3]>; ldr r3, =x --> address is still in r3
+    {"reload address", {"ldr", "*", "ldr"}, [](const vector<Instr>& w, vector<Instr>& r) {
+        if (w[0].args != w[2].args || w[0].args[0] != "r3" || w[0].args[1][0] != '=') return false;
+        if (w[1].op == "label" || w[1].op[0] == 'b' || w[1].args.empty() || w[1].args[0] == "r3") return false;
+        r = {w[0], w[1]};
+        return true;
+    }},
+
+    // push {r0}; pop {r1} --> mov r1, r0
+    {"push pop", {"push", "pop"}, [](const vector<Instr>& w, vector<Instr>& r) {
+        const string& pushed = w[0].args[0];
+        const string& popped = w[1].args[0];
+        if (pushed.find(',') != string::npos || popped.find(',') != string::npos) return false;
+        r = {{"mov", {popped.substr(1, popped.size() - 2), pushed.substr(1, pushed.size() - 2)}}};
+        return true;
+    }},
+
+    // mov r0, r4; mov r4, r0 --> mov r0, r4
+    {"move back", {"mov", "mov"}, [](const vector<Instr>& w, vector<Instr>& r) {
+        if (w[0].args.size() != 2 || w[1].args.size() != 2 || w[0].args[0] != w[1].args[1] || w[0].args[1] != w[1].args[0]) return false;
+        r = {w[0]};
+        return true;
+    }},
+
+    // cmp r4, #0; beq lab1 --> cbz r4, lab1 (bne --> cbnz)
+    {"compare branch", {"cmp", "beq"}, [](const vector<Instr>& w, vector<Instr>& r) {
+        if (w[0].args[1] != "#0") return false;
+        r = {{"cbz", {w[0].args[0], w[1].args[0]}}};
+        return true;
+    }},
+    {"compare branch", {"cmp", "bne"}, [](const vector<Instr>& w, vector<Instr>& r) {
+        if (w[0].args[1] != "#0") return false;
+        r = {{"cbnz", {w[0].args[0], w[1].args[0]}}};
+        return true;
+    }},
+};
+
+// Single pass over instrs --> counts rewrites per rule in stats
+void peephole(vector<Instr>& instrs, map<string, int>& stats) {
+    map<string, vector<const PeepholeRule*>> byLastOp;
+    for (const auto& rule : peepholeRules) byLastOp[rule.ops.back()].push_back(&rule);
+
+    vector<Instr> out;
+    out.reserve(instrs.size());
+    for (auto& instr : instrs) {
+        out.push_back(move(instr));
+
+        bool matched = true;
+        while (matched && !out.empty()) {
+            matched = false;
+            auto candidates = byLastOp.find(out.back().op);
+            if (candidates == byLastOp.end()) break;
+
+            for (const auto* rule : candidates->second) {
+                size_t length = rule->ops.size();
+                if (out.size() < length) continue;
+                size_t start = out.size() - length;
+
+                bool opsMatch = true;
+                for (size_t i = 0; i < length; i++) {
+                    const string& op = rule->ops[i];
+                    if (op != "*" && op != out[start + i].op) opsMatch = false;
+                    if (i + 1 < length && out[start + i].op == "label" && op != "label") opsMatch = false; // don't match across labels
+                }
+                if (!opsMatch) continue;
+
+                vector<Instr> window(out.begin() + start, out.end());
+                vector<Instr> replacement;
+                if (!rule->rewrite(window, replacement)) continue;
+
+                out.resize(start);
+                for (auto& r : replacement) out.push_back(r);
+                stats[rule->name] += 1;
+                matched = true;
+                break;
+            }
+        }
+    }
+    instrs = move(out);
+}
+
+// Lowers every function to ARM and writes it with the global data section
+void generateARM(CompilerContext& ctx, const ICGProgram& program, ostream& out) {
+    set<string> promoted = ctx.options.registerAllocation ? promotableGlobals(program) : set<string>();
+    map<string, int> peepholeStats;
+    out << "B main" << endl;
+    for (const auto& fn : program.functions) {
+        FrameLayout frame = allocateRegisters(ctx, fn, program, (fn.name == "main") ? promoted : set<string>());
+        if (ctx.options.allocationReport) {
+            ctx.out << fn.name << ": frame " << frame.frameSize << " bytes, " << frame.spills << " spilled" << endl;
+            for (const auto& reg : frame.registers) ctx.out << "  " << reg.first << " --> " << reg.second << endl;
+            for (const auto& slot : frame.slots) ctx.out << "  " << slot.first << " --> fp " << (slot.second >= 0 ? "+ " : "- ") << abs(slot.second) << endl;
+        }
+
+        vector<Instr> instrs;
+        ARMGenerator generator(ctx, program, fn, frame, instrs);
+        generator.generate();
+        if (ctx.options.peephole) peephole(instrs, peepholeStats);
+        out << endl;
+        for (const auto& instr : instrs) out << formatInstr(instr) << endl;
+    }
+
+    if (ctx.options.peepholeReport) {
+        for (const auto& rule : peepholeStats) ctx.out << "Peephole: " << rule.first << " x" << rule.second << endl;
+    }
+
+    // Global data
+    out << endl << ".data" << endl;
+    for (const auto& global : program.globals) {
+        auto array = program.globalArrays.find(global.first);
+        if (array != program.globalArrays.end()) out << global.first << ": .space " << typeSize(global.second) * array->second << endl;
+        else out << global.first << ": " << (global.second == "K_DOUBLE" ? ".double 0" : ".word 0") << endl;
+    }
+}
+
+/**
+ * x86-64 Code Generation (System V, GNU assembler syntax)
+ * - Args go in edi, esi, edx, ecx, r8d, r9d / xmm0-xmm7 (the rest are pushed right to left),
+ *   results come back in eax / xmm0
+ * - Ints are 32 bit and get rbx, r12-r15 (callee saved). SysV has no callee saved xmm regs so
+ *   doubles live in stack slots and are worked on in xmm0-xmm2
+ * - Scratch regs are eax, r10d, r11d; r11 and rdx hold array indexes and addresses
+ * - Functions and globals are prefixed with cp_ so they can't clash with libc, print calls the
+ *   cp471_print_* runtime (buffered, written out when full and at exit), array indexes and
+ *   divisors are checked like on the VM
+*/
+const TargetRegisters x86Registers = {{"rbx", "r12", "r13", "r14", "r15"}, {}, 8, 6};
+
+// Runtime linked with the generated assembly (--link)
+const char* const x86Runtime = R"(#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Output buffer: prints format straight into it, it's written out only when full and at exit */
+static char cp471_out[1 << 16];
+static size_t cp471_used;
+
+static void cp471_flush(void) {
+    size_t done = 0;
+    while (done < cp471_used) {
+        ssize_t written = write(1, cp471_out + done, cp471_used - done);
+        if (written <= 0) break;
+        done += (size_t)written;
+    }
+    cp471_used = 0;
+}
+
+__attribute__((destructor)) static void cp471_exit(void) {
+    cp471_flush();
+}
+
+/* Room for n more chars */
+static char* cp471_reserve(size_t n) {
+    if (cp471_used + n > sizeof(cp471_out)) cp471_flush();
+    return cp471_out + cp471_used;
+}
+
+static const char cp471_pairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+void cp471_print_int(int value) {
+    char text[12];
+    char* p = text + 11;
+    unsigned int magnitude = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+    *p = '\n';
+    while (magnitude >= 100) {
+        const char* pair = cp471_pairs + (magnitude % 100) * 2;
+        magnitude /= 100;
+        *--p = pair[1];
+        *--p = pair[0];
+    }
+    if (magnitude >= 10) {
+        *--p = cp471_pairs[magnitude * 2 + 1];
+        *--p = cp471_pairs[magnitude * 2];
+    }
+    else *--p = (char)('0' + magnitude);
+    if (value < 0) *--p = '-';
+    size_t length = (size_t)(text + 12 - p);
+    memcpy(cp471_reserve(length), p, length);
+    cp471_used += length;
+}
+
+/* Shortest form that reads back as the same double, laid out like %g at that many digits (like the compiler and VM print it) */
+void cp471_print_double(double value) {
+    char scientific[40], digits[20];
+    char* out = cp471_reserve(40);
+    char* start = out;
+    int count = 0;
+    if (value != value || value - value != 0) {
+        int length = snprintf(out, 40, "%g.0\n", value);
+        cp471_used += (size_t)length;
+        return;
+    }
+
+    /* At most 17 digits round trip and a shorter form's digits are the 15 or 16 digit one's without its
+       trailing zeros (subnormals have fewer bits so they try every precision) */
+    int normal = value <= -2.2250738585072014e-308 || value >= 2.2250738585072014e-308;
+    for (int precision = normal ? 15 : 1; precision <= 17; precision++) {
+        snprintf(scientific, sizeof(scientific), "%.*e", precision - 1, value);
+        if (strtod(scientific, NULL) == value) break;
+    }
+    const char* p = scientific;
+    if (*p == '-') *out++ = *p++;
+    for (; *p != 'e'; p++) {
+        if (*p != '.') digits[count++] = *p;
+    }
+    while (count > 1 && digits[count - 1] == '0') count--;
+    int exponent = atoi(p + 1);
+
+    if (exponent < -4 || exponent >= count) {
+        *out++ = digits[0];
+        if (count > 1) {
+            *out++ = '.';
+            memcpy(out, digits + 1, (size_t)count - 1);
+            out += count - 1;
+        }
+        out += sprintf(out, "e%c%02d", exponent < 0 ? '-' : '+', exponent < 0 ? -exponent : exponent);
+    }
+    else if (exponent < 0) {
+        *out++ = '0';
+        *out++ = '.';
+        for (int zero = 1; zero < -exponent; zero++) *out++ = '0';
+        memcpy(out, digits, (size_t)count);
+        out += count;
+    }
+    else {
+        memcpy(out, digits, (size_t)exponent + 1);
+        out += exponent + 1;
+        *out++ = '.';
+        if (count > exponent + 1) {
+            memcpy(out, digits + exponent + 1, (size_t)(count - exponent - 1));
+            out += count - exponent - 1;
+        }
+        else *out++ = '0';
+    }
+    *out++ = '\n';
+    cp471_used += (size_t)(out - start);
+}
+
+void cp471_bounds_error(int index, const char* function) {
+    cp471_flush();
+    fprintf(stderr, "Runtime error: array index %d out of range in %s\n", index, function);
+    exit(1);
+}
+
+void cp471_divide_error(const char* function) {
+    cp471_flush();
+    fprintf(stderr, "Runtime error: division by zero in %s\n", function);
+    exit(1);
+}
+)";
+
+string x86Register32(const string& reg) {
+    if (reg[0] == 'r' && isdigit(static_cast<unsigned char>(reg[1]))) return "%" + reg + "d";
+    return "%e" + reg.substr(1);
+}
+
+string x86Register64(const string& reg32) {
+    if (reg32[1] == 'e') return "%r" + reg32.substr(2);
+    return reg32.substr(0, reg32.size() - 1);
+}
+
+struct X86Generator {
+    CompilerContext& ctx;
+    const ICGProgram& program;
+    const ICGFunction& fn;
+    const FrameLayout& frame;
+    vector<Instr>& out;
+    map<int, int>& constants; // constant pool entry (doubles) loaded from .rodata --> .LC number, in order of first use
+    vector<string> pendingArgs; // param quads waiting for their call
+    bool checksBounds = false;
+    bool checksDivision = false;
+    int divisions = 0;
+    int vectorized = 0;
+
+    X86Generator(CompilerContext& context, const ICGProgram& prog, const ICGFunction& function, const FrameLayout& layout, vector<Instr>& instrs, map<int, int>& pool)
+        : ctx(context), program(prog), fn(function), frame(layout), out(instrs), constants(pool) {}
+
+    void add(const string& op, const vector<string>& args = {}) { out.push_back({op, args}); }
+
+    string label(const string& name) const { return ".L" + fn.name + "_" + name; }
+
+    bool isDouble(const string& operand) const { return operandType(fn, program, operand) == "K_DOUBLE"; }
+
+    bool isGlobal(const string& name) const {
+        return !fn.varTypes.count(name) && !frame.promotedGlobals.count(name) && (program.globals.count(name) || program.globalArrays.count(name));
+    }
+
+    string constant(const string& literal) {
+        int index = ctx.constantPool.intern(literalConstant(ctx, literal).doubleValue);
+        int number = constants.emplace(index, static_cast<int>(constants.size())).first->second;
+        return ".LC" + to_string(number) + "(%rip)";
+    }
+
+    // Where operand lives: $imm, a register, a stack slot or a global (double literals come from .rodata)
+    string location(const string& operand) {
+        if (isLiteral(operand)) return (literalType(operand) == "K_DOUBLE") ? constant(operand) : "$" + operand;
+        auto reg = frame.registers.find(operand);
+        if (reg != frame.registers.end()) return x86Register32(reg->second);
+        if (isGlobal(operand)) return "cp_" + operand + "(%rip)";
+        return to_string(frame.slots.at(operand)) + "(%rbp)";
+    }
+
+    static bool isMemory(const string& loc) { return loc.back() == ')'; }
+
+    static string scratch(bool asDouble, int k) {
+        static const string ints[] = {"%eax", "%r10d", "%r11d"};
+        return asDouble ? "%xmm" + to_string(k) : ints[k];
+    }
+
+    // Operand usable as a source (int imm/reg/mem, double xmm/mem), converting into scratch k if needed
+    string source(const string& operand, int k, bool asDouble) {
+        bool operandDouble = isDouble(operand);
+        if (asDouble && !operandDouble) {
+            if (isLiteral(operand)) return constant(operand);
+            add("cvtsi2sdl", {location(operand), scratch(true, k)});
+            return scratch(true, k);
+        }
+        if (!asDouble && operandDouble) {
+            add("cvttsd2si", {location(operand), scratch(false, k)});
+            return scratch(false, k);
+        }
+        return location(operand);
+    }
+
+    // Operand in a register (scratch k unless it is allocated one)
+    string reg(const string& operand, int k, bool asDouble) {
+        string src = source(operand, k, asDouble);
+        if (src[0] == '%') return src;
+        add(asDouble ? "movsd" : "movl", {src, scratch(asDouble, k)});
+        return scratch(asDouble, k);
+    }
+
+    // Register to compute dest into
+    string target(const string& dest, bool asDouble) {
+        string loc = location(dest);
+        return (!asDouble && loc[0] == '%') ? loc : scratch(asDouble, 0);
+    }
+
+    // Store a result computed into reg over to dest (converting between int and double)
+    void store(const string& dest, const string& reg, bool asDouble) {
+        bool destDouble = isDouble(dest);
+        string loc = location(dest);
+        if (destDouble && !asDouble) {
+            add("cvtsi2sdl", {reg, "%xmm0"});
+            add("movsd", {"%xmm0", loc});
+        }
+        else if (!destDouble && asDouble) add("cvttsd2si", {reg, loc});
+        else if (loc != reg) add(asDouble ? "movsd" : "movl", {reg, loc});
+    }
+
+    // cmp / ucomisd arg1 with arg2 --> returns condition code suffix for op
+    string compare(const string& op, const string& arg1, const string& arg2) {
+        static const map<string, string> signedCodes = {{"<", "l"}, {">", "g"}, {"==", "e"}, {"<=", "le"}, {">=", "ge"}, {"<>", "ne"},
+            {"blt", "l"}, {"bgt", "g"}, {"beq", "e"}, {"ble", "le"}, {"bge", "ge"}, {"bne", "ne"}};
+        static const map<string, string> unsignedCodes = {{"<", "b"}, {">", "a"}, {"==", "e"}, {"<=", "be"}, {">=", "ae"}, {"<>", "ne"},
+            {"blt", "b"}, {"bgt", "a"}, {"beq", "e"}, {"ble", "be"}, {"bge", "ae"}, {"bne", "ne"}};
+        bool asDouble = isDouble(arg1) || isDouble(arg2);
+        string a = reg(arg1, 1, asDouble);
+        string b = source(arg2, 2, asDouble);
+        add(asDouble ? "ucomisd" : "cmpl", {b, a});
+        return asDouble ? unsignedCodes.at(op) : signedCodes.at(op);
+    }
+
+    // Bounds checks the index into r11 (unless proven in range) --> returns the element's address
+    string element(const string& array, const string& index, bool checked) {
+        int size = fn.arraySizes.count(array) ? fn.arraySizes.at(array) : program.globalArrays.at(array);
+        string i = source(index, 2, false);
+        if (i[0] == '$') {
+            int constantIndex = stoi(i.substr(1));
+            if (constantIndex < 0 || constantIndex >= size) {
+                add("movl", {i, "%r11d"});
+                add("jmp", {label("bounds")});
+                checksBounds = true;
+            }
+            if (isGlobal(array)) return "cp_" + array + "+" + to_string(constantIndex * typeSize(operandType(fn, program, array))) + "(%rip)";
+            return to_string(frame.slots.at(array) + constantIndex * typeSize(operandType(fn, program, array))) + "(%rbp)";
+        }
+
+        add("movslq", {i, "%r11"});
+        if (checked) {
+            add("cmpq", {"$" + to_string(size), "%r11"});
+            add("jae", {label("bounds")});
+            checksBounds = true;
+        }
+        string scale = to_string(typeSize(operandType(fn, program, array)));
+        if (isGlobal(array)) {
+            add("leaq", {"cp_" + array + "(%rip)", "%rdx"});
+            return "(%rdx,%r11," + scale + ")";
+        }
+        return to_string(frame.slots.at(array)) + "(%rbp,%r11," + scale + ")";
+    }
+
+    // Vector loop in front of a counted loop's exit test (see findVectorLoops)
+    void vectorize(const VectorLoop& loop) {
+        static const map<string, string> doubleOps = {{"+", "addpd"}, {"-", "subpd"}, {"*", "mulpd"}, {"/", "divpd"}};
+        static const map<string, string> intOps = {{"+", "paddd"}, {"-", "psubd"}, {"*", "pmulld"}};
+        bool avx = ctx.options.avx2;
+        int width = (avx ? 32 : 16) / (loop.isDouble ? 8 : 4);
+        auto packed = [avx](const string& op) { return avx ? "v" + op : op; };
+        string move = packed(loop.isDouble ? "movupd" : "movdqu");
+        string copy = packed(loop.isDouble ? "movapd" : "movdqa");
+        const auto& ops = loop.isDouble ? doubleOps : intOps;
+
+        // Vars the body writes get their own register, invariants are broadcast into one first
+        map<string, string> regs;
+        int next = 0;
+        auto fresh = [&next, avx]() { return (avx ? "%ymm" : "%xmm") + to_string(next++); };
+        for (const auto& name : loop.invariants) {
+            string r = fresh();
+            string x = "%xmm" + r.substr(4);
+            if (loop.isDouble) {
+                add(packed("movsd"), {location(name), x});
+                if (avx) add("vbroadcastsd", {x, r});
+                else add("unpcklpd", {x, x});
+            }
+            else {
+                add("movl", {location(name), "%eax"});
+                add(packed("movd"), {"%eax", x});
+                if (avx) add("vpbroadcastd", {x, r});
+                else add("pshufd", {"$0", x, x});
+            }
+            regs[name] = r;
+        }
+
+        string top = label("vec" + to_string(vectorized)), done = label("vecdone" + to_string(vectorized));
+        vectorized++;
+        add("label", {top});
+        add("movl", {location(loop.counter), "%eax"});
+        add("addl", {"$" + to_string(width - 1), "%eax"});
+        add("cmpl", {location(loop.limit), "%eax"});
+        add("jge", {done});
+        for (size_t i = loop.bodyStart; i < loop.bodyEnd; i++) {
+            const Quad& q = fn.code[i];
+            if (q.op == "=[]") {
+                string address = element(q.arg1, loop.counter, false);
+                regs[q.dest] = fresh();
+                add(move, {address, regs[q.dest]});
+            }
+            else if (q.op == "[]=") add(move, {regs.at(q.arg2), element(q.dest, loop.counter, false)});
+            else if (q.op == "=") regs[q.dest] = regs.at(q.arg1);
+            else {
+                string a = regs.at(q.arg1), b = regs.at(q.arg2), d = fresh();
+                if (avx) add(packed(ops.at(q.op)), {b, a, d});
+                else {
+                    add(copy, {a, d});
+                    add(ops.at(q.op), {b, d});
+                }
+                regs[q.dest] = d;
+            }
+        }
+        add("addl", {"$" + to_string(width), location(loop.counter)});
+        add("jmp", {top});
+        add("label", {done});
+        if (avx) add("vzeroupper");
+
+        if (ctx.options.vectorizeReport) ctx.out << "Vectorized: " << fn.name << " loop at quad " << loop.bodyStart - 1 << " (" << (loop.isDouble ? "double" : "int") << " x" << width << ")" << endl;
+    }
+
+    const ICGFunction* callee(const string& name) const {
+        for (const auto& f : program.functions) {
+            if (f.name == name) return &f;
+        }
+        return nullptr;
+    }
+
+    void call(const Quad& q) {
+        static const string intArgs[] = {"%edi", "%esi", "%edx", "%ecx", "%r8d", "%r9d"};
+        const ICGFunction* target = callee(q.arg1);
+        size_t argc = stoul(q.arg2);
+        vector<string> args(pendingArgs.end() - min(argc, pendingArgs.size()), pendingArgs.end());
+        pendingArgs.resize(pendingArgs.size() - args.size());
+
+        // Split args into registers and stack (by the callee's param types)
+        vector<pair<string, string>> inRegisters; // arg --> register
+        vector<pair<string, bool>> onStack; // (arg, as double)
+        int ints = 0, doubles = 0;
+        for (size_t i = 0; i < args.size(); i++) {
+            bool asDouble = (target && i < target->params.size()) ? target->params[i].first == "K_DOUBLE" : isDouble(args[i]);
+            if (asDouble && doubles < 8) inRegisters.push_back({args[i], "%xmm" + to_string(doubles++)});
+            else if (!asDouble && ints < 6) inRegisters.push_back({args[i], intArgs[ints++]});
+            else onStack.push_back({args[i], asDouble});
+        }
+
+        // Stack args first (they go through eax / xmm0), keeping rsp 16 byte aligned at the call
+        int stackBytes = 8 * static_cast<int>(onStack.size());
+        if (stackBytes % 16) {
+            add("subq", {"$8", "%rsp"});
+            stackBytes += 8;
+        }
+        for (auto arg = onStack.rbegin(); arg != onStack.rend(); ++arg) {
+            string r = reg(arg->first, 0, arg->second);
+            if (arg->second) {
+                add("subq", {"$8", "%rsp"});
+                add("movsd", {r, "(%rsp)"});
+            }
+            else add("pushq", {x86Register64(r)});
+        }
+        for (const auto& arg : inRegisters) {
+            bool asDouble = arg.second[1] == 'x';
+            if (asDouble == isDouble(arg.first) || (asDouble && isLiteral(arg.first))) {
+                string src = source(arg.first, 0, asDouble);
+                if (src != arg.second) add(asDouble ? "movsd" : "movl", {src, arg.second});
+            }
+            else add(asDouble ? "cvtsi2sdl" : "cvttsd2si", {location(arg.first), arg.second}); // convert straight into the arg reg
+        }
+
+        add("call", {"cp_" + q.arg1});
+        if (stackBytes > 0) add("addq", {"$" + to_string(stackBytes), "%rsp"});
+        bool returnsDouble = target && target->returnType == "K_DOUBLE";
+        if (!q.dest.empty()) store(q.dest, returnsDouble ? "%xmm0" : "%eax", returnsDouble);
+    }
+
+    void lower(const Quad& q) {
+        if (q.op == "label") add("label", {label(q.dest)});
+        else if (q.op == "b") add("jmp", {label(q.dest)});
+        else if (isBranchOp(q.op)) add("j" + compare(q.op, q.arg1, q.arg2), {label(q.dest)});
+        else if (q.op == "=") {
+            bool asDouble = isDouble(q.dest);
+            string src = source(q.arg1, 1, asDouble);
+            string loc = location(q.dest);
+            if (isMemory(src) && isMemory(loc)) src = reg(q.arg1, 1, asDouble);
+            if (src != loc) add(asDouble ? "movsd" : "movl", {src, loc});
+        }
+        else if (isArithOp(q.op) && (isDouble(q.dest) || isDouble(q.arg1) || isDouble(q.arg2))) {
+            static const map<string, string> ops = {{"+", "addsd"}, {"-", "subsd"}, {"*", "mulsd"}, {"/", "divsd"}};
+            if (q.op == "%") {
+                string a = source(q.arg1, 0, true);
+                if (a != "%xmm0") add("movsd", {a, "%xmm0"});
+                string b = source(q.arg2, 1, true);
+                if (b != "%xmm1") add("movsd", {b, "%xmm1"});
+                add("call", {"fmod"});
+            }
+            else {
+                string a = source(q.arg1, 0, true);
+                if (a != "%xmm0") add("movsd", {a, "%xmm0"});
+                add(ops.at(q.op), {source(q.arg2, 1, true), "%xmm0"});
+            }
+            store(q.dest, "%xmm0", true);
+        }
+        else if (q.op == "/" || q.op == "%") {
+            add("movl", {source(q.arg1, 0, false), "%eax"});
+            bool literal = isLiteral(q.arg2);
+            string b = reg(q.arg2, 1, false);
+            if (!literal) {
+                add("testl", {b, b});
+                add("je", {label("divzero")});
+                checksDivision = true;
+            }
+
+            // x / -1 --> -x and x % -1 --> 0 (idiv traps on INT_MIN / -1, the VM wraps)
+            string divide = label("div" + to_string(divisions)), done = label("divdone" + to_string(divisions));
+            divisions++;
+            if (!literal || q.arg2 == "-1") {
+                add("cmpl", {"$-1", b});
+                add("jne", {divide});
+                if (q.op == "/") add("negl", {"%eax"});
+                else add("movl", {"$0", "%edx"});
+                add("jmp", {done});
+                add("label", {divide});
+            }
+            add("cltd");
+            add("idivl", {b});
+            add("label", {done});
+            store(q.dest, q.op == "/" ? "%eax" : "%edx", false);
+        }
+        else if (isArithOp(q.op)) {
+            static const map<string, string> ops = {{"+", "addl"}, {"-", "subl"}, {"*", "imull"}};
+            string a = source(q.arg1, 1, false);
+            string b = source(q.arg2, 2, false);
+            string d = target(q.dest, false);
+            if (b == d && a != d) {
+                if (q.op == "-") d = scratch(false, 0); // d = a - d --> compute into eax
+                else swap(a, b);
+            }
+            if (a != d) add("movl", {a, d});
+            add(ops.at(q.op), {b, d});
+            store(q.dest, d, false);
+        }
+        else if (isRelOp(q.op)) {
+            string code = compare(q.op, q.arg1, q.arg2);
+            add("set" + code, {"%al"});
+            add("movzbl", {"%al", "%eax"});
+            store(q.dest, "%eax", false);
+        }
+        else if (q.op == "and" || q.op == "or") {
+            add("cmpl", {"$0", reg(q.arg1, 1, false)});
+            add("setne", {"%al"});
+            add("cmpl", {"$0", reg(q.arg2, 2, false)});
+            add("setne", {"%cl"});
+            add(q.op == "and" ? "andb" : "orb", {"%cl", "%al"});
+            add("movzbl", {"%al", "%eax"});
+            store(q.dest, "%eax", false);
+        }
+        else if (q.op == "not") {
+            add("cmpl", {"$0", reg(q.arg1, 1, false)});
+            add("sete", {"%al"});
+            add("movzbl", {"%al", "%eax"});
+            store(q.dest, "%eax", false);
+        }
+        else if (q.op == "=[]") {
+            bool asDouble = isDouble(q.arg1);
+            string address = element(q.arg1, q.arg2, !q.inBounds);
+            string d = target(q.dest, asDouble);
+            add(asDouble ? "movsd" : "movl", {address, d});
+            store(q.dest, d, asDouble);
+        }
+        else if (q.op == "[]=") {
+            bool asDouble = isDouble(q.dest);
+            string v = reg(q.arg2, 1, asDouble);
+            add(asDouble ? "movsd" : "movl", {v, element(q.dest, q.arg1, !q.inBounds)});
+        }
+        else if (q.op == "param") pendingArgs.push_back(q.arg1);
+        else if (q.op == "call") call(q);
+        else if (q.op == "print") {
+            bool asDouble = isDouble(q.arg1);
+            string src = source(q.arg1, 0, asDouble);
+            if (src != "%xmm0") add(asDouble ? "movsd" : "movl", {src, asDouble ? "%xmm0" : "%edi"});
+            add("call", {asDouble ? "cp471_print_double" : "cp471_print_int"});
+        }
+        else if (q.op == "return") {
+            bool asDouble = fn.returnType == "K_DOUBLE";
+            string src = source(q.arg1, 0, asDouble);
+            string result = asDouble ? "%xmm0" : "%eax";
+            if (src != result) add(asDouble ? "movsd" : "movl", {src, result});
+            add("jmp", {label("exit")});
+        }
+    }
+
+    void generate() {
+        string name = (fn.name == "main") ? "main" : "cp_" + fn.name;
+        add(".globl", {name});
+        add("label", {name});
+        add("pushq", {"%rbp"});
+        add("movq", {"%rsp", "%rbp"});
+        for (const auto& reg : frame.savedInt) add("pushq", {"%" + reg});
+        int frameBytes = frame.frameSize;
+        if ((frame.savedBytes + frameBytes) % 16) frameBytes += 8;
+        if (frameBytes > 0) add("subq", {"$" + to_string(frameBytes), "%rsp"});
+
+        // Register params are moved to their reg or slot, stack params kept in a reg are loaded
+        static const string intArgs[] = {"%edi", "%esi", "%edx", "%ecx", "%r8d", "%r9d"};
+        int ints = 0, doubles = 0;
+        for (const auto& p : fn.params) {
+            bool asDouble = p.first == "K_DOUBLE";
+            int index = asDouble ? doubles++ : ints++;
+            bool inRegister = index < (asDouble ? 8 : 6);
+            if (!frame.liveAtEntry.count(p.second)) continue;
+            string incoming = inRegister ? (asDouble ? "%xmm" + to_string(index) : intArgs[index]) : to_string(frame.slots.at(p.second)) + "(%rbp)";
+            string loc = location(p.second);
+            if (incoming != loc) add(asDouble ? "movsd" : "movl", {incoming, loc});
+        }
+        // Promoted globals and locals read before they're written start at 0, as do local arrays (count down r11 over each)
+        set<string> params;
+        for (const auto& p : fn.params) params.insert(p.second);
+        for (const auto& var : frame.liveAtEntry) {
+            if (params.count(var)) continue;
+            if (isDouble(var)) {
+                add("xorpd", {"%xmm0", "%xmm0"});
+                add("movsd", {"%xmm0", location(var)});
+            }
+            else add("movl", {"$0", location(var)});
+        }
+        for (const auto& array : fn.arraySizes) {
+            int size = typeSize(operandType(fn, program, array.first));
+            add("movq", {"$" + to_string(array.second), "%r11"});
+            add("label", {label("zero_" + array.first)});
+            add(size == 8 ? "movq" : "movl", {"$0", to_string(frame.slots.at(array.first) - size) + "(%rbp,%r11," + to_string(size) + ")"});
+            add("decq", {"%r11"});
+            add("jnz", {label("zero_" + array.first)});
+        }
+
+        map<size_t, VectorLoop> vectorLoops;
+        if (ctx.options.vectorize) vectorLoops = findVectorLoops(ctx, fn, program);
+        for (size_t i = 0; i < fn.code.size(); i++) {
+            auto loop = vectorLoops.find(i);
+            if (loop != vectorLoops.end()) vectorize(loop->second);
+            lower(fn.code[i]);
+        }
+
+        add("label", {label("exit")});
+        if (fn.name == "main") add("movl", {"$0", "%eax"});
+        if (frame.savedBytes > 0) add("leaq", {"-" + to_string(frame.savedBytes) + "(%rbp)", "%rsp"});
+        else add("movq", {"%rbp", "%rsp"});
+        for (auto reg = frame.savedInt.rbegin(); reg != frame.savedInt.rend(); ++reg) add("popq", {"%" + *reg});
+        add("popq", {"%rbp"});
+        add("ret");
+
+        // Runtime error stubs (report the function name like the VM)
+        if (checksBounds) {
+            add("label", {label("bounds")});
+            add("movl", {"%r11d", "%edi"});
+            add("leaq", {label("name") + "(%rip)", "%rsi"});
+            add("call", {"cp471_bounds_error"});
+        }
+        if (checksDivision) {
+            add("label", {label("divzero")});
+            add("leaq", {label("name") + "(%rip)", "%rdi"});
+            add("call", {"cp471_divide_error"});
+        }
+        if (checksBounds || checksDivision) {
+            add(".section", {".rodata"});
+            add("label", {label("name")});
+            add(".string", {"\"" + fn.name + "\""});
+            add(".text");
+        }
+    }
+};
+
+string formatX86(const Instr& instr) {
+    if (instr.op == "label") return instr.args.front() + ":";
+    return "\t" + formatInstr(instr);
+}
+
+// Lowers every function to x86-64 assembly with the data and constant sections
+void generateX86(CompilerContext& ctx, const ICGProgram& program, ostream& out) {
+    set<string> promoted = ctx.options.registerAllocation ? promotableGlobals(program) : set<string>();
+    map<int, int> constants;
+    out << "\t.text" << endl;
+    for (const auto& fn : program.functions) {
+        FrameLayout frame = allocateRegisters(ctx, fn, program, (fn.name == "main") ? promoted : set<string>(), x86Registers);
+        if (ctx.options.allocationReport) {
+            ctx.out << fn.name << ": frame " << frame.frameSize << " bytes, " << frame.spills << " spilled" << endl;
+            for (const auto& reg : frame.registers) ctx.out << "  " << reg.first << " --> " << reg.second << endl;
+            for (const auto& slot : frame.slots) ctx.out << "  " << slot.first << " --> rbp " << (slot.second >= 0 ? "+ " : "- ") << abs(slot.second) << endl;
+        }
+
+        vector<Instr> instrs;
+        X86Generator generator(ctx, program, fn, frame, instrs, constants);
+        generator.generate();
+        out << endl;
+        for (const auto& instr : instrs) out << formatX86(instr) << endl;
+    }
+
+    // Global data
+    out << endl << "\t.data" << endl << "\t.p2align 3" << endl;
+    for (const auto& global : program.globals) {
+        auto array = program.globalArrays.find(global.first);
+        out << "cp_" << global.first << ":" << endl;
+        if (array != program.globalArrays.end()) out << "\t.zero " << typeSize(global.second) * array->second << endl;
+        else out << (global.second == "K_DOUBLE" ? "\t.double 0" : "\t.long 0\n\t.p2align 3") << endl;
+    }
+
+    // Double literals (bit patterns so they are exact)
+    out << endl << "\t.section .rodata" << endl << "\t.p2align 3" << endl;
+    vector<int> literals(constants.size()); // labels don't depend on the pool's order, so an incremental compile writes the same assembly
+    for (const auto& entry : constants) literals[entry.second] = entry.first;
+    for (size_t number = 0; number < literals.size(); number++) {
+        const Constant& constant = ctx.constantPool.entries[literals[number]];
+        uint64_t bits;
+        memcpy(&bits, &constant.doubleValue, sizeof(bits));
+        out << ".LC" << number << ":" << endl << "\t.quad " << bits << " # " << constant.text << endl;
+    }
+    out << "\t.section .note.GNU-stack,\"\",@progbits" << endl;
+}
+
+// Writes the runtime next to compile.s and links both with the system C compiler
+bool linkX86(const string& assembly, const string& executable) {
+    string runtimePath = (filesystem::path(assembly).parent_path() / "cp471_runtime.c").string();
+    ofstream runtime(runtimePath);
+    runtime << x86Runtime;
+    runtime.close();
+
+    const char* cc = getenv("CC");
+    string command = string(cc ? cc : "cc") + " -O2 -o \"" + executable + "\" \"" + assembly + "\" \"" + runtimePath + "\" -lm";
+    return system(command.c_str()) == 0;
+}
+
+/**
+ * Bytecode VM
+ * - Each function is compiled from its 3TAC to register bytecode: every param, local and temp gets
+ *   its own int or double register, literals live in constant registers copied in at call entry
+ * - Globals are read/written with GETG/SETG (main keeps the ones no other function touches in registers)
+ * - Arrays are contiguous buffers (locals are allocated per call, globals once per run)
+ * - With GCC/Clang each instr holds the address of its handler and dispatch is a computed goto
+ *   (direct threading), otherwise (or with -DVM_SWITCH_DISPATCH) a switch
+ * - Every VM call is a native call of execute, so the VM runs on its own thread with a stack sized
+ *   for --max-call-depth=N calls (default 1000000, only address space until it's used); deeper
+ *   recursion is a "call depth exceeded" runtime error, while native code from --target=x86-64 just
+ *   recurses until the OS stack runs out (8 MB usually holds a few hundred thousand small calls)
+*/
+#if defined(__GNUC__) && !defined(VM_SWITCH_DISPATCH)
+#define VM_THREADED
+#endif
+
+// op(a, b, c): I/D are the int/double registers of the current frame
+#define VM_OPS(X) \
+    X(MOV_I) X(MOV_D) X(I2D) X(D2I) X(GETG_I) X(GETG_D) X(SETG_I) X(SETG_D) \
+    X(ADD_I) X(SUB_I) X(MUL_I) X(DIV_I) X(MOD_I) X(ADD_D) X(SUB_D) X(MUL_D) X(DIV_D) X(MOD_D) \
+    X(LT_I) X(GT_I) X(EQ_I) X(LE_I) X(GE_I) X(NE_I) X(LT_D) X(GT_D) X(EQ_D) X(LE_D) X(GE_D) X(NE_D) \
+    X(AND) X(OR) X(NOT) \
+    X(JMP) X(LOOP) X(BLT_I) X(BGT_I) X(BEQ_I) X(BLE_I) X(BGE_I) X(BNE_I) X(BLT_D) X(BGT_D) X(BEQ_D) X(BLE_D) X(BGE_D) X(BNE_D) \
+    X(ALOAD_I) X(ALOAD_D) X(ASTORE_I) X(ASTORE_D) X(ALOADU_I) X(ALOADU_D) X(ASTOREU_I) X(ASTOREU_D) \
+    X(ARG_I) X(ARG_D) X(CALL) X(RET_I) X(RET_D) X(PRINT_I) X(PRINT_D) \
+    X(COUNT)
+
+#define VM_ENUM(op) VM_##op,
+#define VM_NAME(op) #op,
+enum VMOp { VM_OPS(VM_ENUM) };
+const char* const vmOpNames[] = { VM_OPS(VM_NAME) };
+
+struct VMInstr {
+    const void* handler; // filled in the first time the function runs (direct threading)
+    int32_t op, a, b, c;
+};
+
+union VMValue {
+    int32_t i;
+    double d;
+};
+
+// Array a function touches --> its own (allocated per call) or a global one
+struct VMArrayRef {
+    bool isDouble;
+    bool isGlobal;
+    int32_t index; // global array index or offset into the frame's array buffer
+    int32_t size;
+};
+
+struct VMFunction {
+    string name;
+    bool returnsDouble = false;
+    vector<VMInstr> code;
+    vector<int32_t> intInit; // initial int registers (constants, everything else 0)
+    vector<double> doubleInit;
+    vector<pair<bool, int32_t>> params; // (isDouble, register)
+    vector<VMArrayRef> arrays;
+    int32_t intArrayWords = 0, doubleArrayWords = 0;
+    bool threaded = false;
+    uint32_t calls = 0, backEdges = 0; // JIT counters
+    shared_ptr<uint8_t> jitCode; // entry(ctx, address) followed by the jitted instrs
+    vector<uint32_t> nativeOffsets; // instr --> offset in jitCode
+    bool jitFailed = false;
+};
+
+struct VMProgram {
+    vector<VMFunction> functions;
+    int32_t mainIndex = -1;
+    map<string, pair<bool, int32_t>> globals; // name --> (isDouble, index)
+    vector<VMArrayRef> globalArrays;
+    bool profiling = false; // COUNT instrs at function entries, labels and conditional branches
+    vector<uint64_t> counters;
+    vector<pair<string, string>> counterSites; // counter --> (call, function) or (label/branch/fall, site)
+};
+
+// Lowers one ICGFunction to bytecode
+struct BytecodeCompiler {
+    CompilerContext& ctx;
+    const ICGProgram& program;
+    const ICGFunction& fn;
+    VMProgram& vm;
+    VMFunction& out;
+    map<string, int32_t> intRegs, doubleRegs, arrays;
+    map<int, int32_t> intConsts, doubleConsts; // constant pool entry --> constant register
+    map<string, int32_t> labels;
+    vector<pair<size_t, string>> jumps; // instr --> label it branches to
+    int32_t scratchInt[3] = {-1, -1, -1}, scratchDouble[3] = {-1, -1, -1};
+
+    BytecodeCompiler(CompilerContext& context, const ICGProgram& prog, const ICGFunction& function, VMProgram& vmProgram, VMFunction& vmFunction)
+        : ctx(context), program(prog), fn(function), vm(vmProgram), out(vmFunction) {}
+
+    void add(VMOp op, int32_t a = 0, int32_t b = 0, int32_t c = 0) { out.code.push_back({nullptr, op, a, b, c}); }
+
+    int32_t newInt(int32_t init = 0) {
+        out.intInit.push_back(init);
+        return static_cast<int32_t>(out.intInit.size() - 1);
+    }
+
+    int32_t newDouble(double init = 0) {
+        out.doubleInit.push_back(init);
+        return static_cast<int32_t>(out.doubleInit.size() - 1);
+    }
+
+    int32_t scratch(bool asDouble, int k) {
+        int32_t& reg = asDouble ? scratchDouble[k] : scratchInt[k];
+        if (reg < 0) reg = asDouble ? newDouble() : newInt();
+        return reg;
+    }
+
+    bool isDouble(const string& operand) const { return operandType(fn, program, operand) == "K_DOUBLE"; }
+
+    bool isLocal(const string& name) const { return intRegs.count(name) || doubleRegs.count(name); }
+
+    int32_t constant(const string& literal, bool asDouble) {
+        const Constant& value = literalConstant(ctx, literal);
+        if (asDouble) {
+            int index = ctx.constantPool.intern(value.doubleValue);
+            auto it = doubleConsts.find(index);
+            if (it != doubleConsts.end()) return it->second;
+            return doubleConsts[index] = newDouble(value.doubleValue);
+        }
+        int index = ctx.constantPool.intern(value.intValue);
+        auto it = intConsts.find(index);
+        if (it != intConsts.end()) return it->second;
+        return intConsts[index] = newInt(value.intValue);
+    }
+
+    // int <--> double conversion of reg into scratch k
+    int32_t convert(int32_t reg, bool fromDouble, int k) {
+        int32_t converted = scratch(!fromDouble, k);
+        add(fromDouble ? VM_D2I : VM_I2D, converted, reg);
+        return converted;
+    }
+
+    // Register holding operand as an int or double (loads globals and converts into scratch k)
+    int32_t source(const string& operand, bool asDouble, int k) {
+        if (isLiteral(operand)) return constant(operand, asDouble);
+
+        bool operandDouble = isDouble(operand);
+        int32_t reg;
+        if (isLocal(operand)) reg = operandDouble ? doubleRegs.at(operand) : intRegs.at(operand);
+        else {
+            reg = scratch(operandDouble, k);
+            add(operandDouble ? VM_GETG_D : VM_GETG_I, reg, vm.globals.at(operand).second);
+        }
+        return (operandDouble == asDouble) ? reg : convert(reg, operandDouble, k);
+    }
+
+    // Operand as 0 or 1 for and/or/not
+    int32_t truth(const string& operand, int k) {
+        if (!isDouble(operand)) return source(operand, false, k);
+        int32_t truthValue = scratch(false, k);
+        add(VM_NE_D, truthValue, source(operand, true, k), constant("0.0", true));
+        return truthValue;
+    }
+
+    // Register to compute dest into
+    int32_t target(const string& dest, bool asDouble) {
+        auto& regs = asDouble ? doubleRegs : intRegs;
+        auto reg = regs.find(dest);
+        return (reg != regs.end()) ? reg->second : scratch(asDouble, 0);
+    }
+
+    // Moves a result computed into reg over to dest
+    void finish(const string& dest, int32_t reg, bool asDouble) {
+        bool destDouble = isDouble(dest);
+        if (destDouble != asDouble) {
+            reg = convert(reg, asDouble, 0);
+            asDouble = destDouble;
+        }
+        if (isLocal(dest)) {
+            int32_t destReg = destDouble ? doubleRegs.at(dest) : intRegs.at(dest);
+            if (destReg != reg) add(destDouble ? VM_MOV_D : VM_MOV_I, destReg, reg);
+        }
+        else add(destDouble ? VM_SETG_D : VM_SETG_I, vm.globals.at(dest).second, reg);
+    }
+
+    int32_t array(const string& name) {
+        auto it = arrays.find(name);
+        if (it != arrays.end()) return it->second;
+
+        VMArrayRef ref;
+        auto local = fn.arraySizes.find(name);
+        if (local != fn.arraySizes.end()) {
+            ref = {isDouble(name), false, 0, local->second};
+            int32_t& words = ref.isDouble ? out.doubleArrayWords : out.intArrayWords;
+            ref.index = words;
+            words += ref.size;
+        }
+        else ref = vm.globalArrays.at(vm.globals.at(name).second);
+        out.arrays.push_back(ref);
+        return arrays[name] = static_cast<int32_t>(out.arrays.size() - 1);
+    }
+
+    // COUNT instr for a profile site (--profile-generate)
+    void count(const string& kind, const string& site) {
+        vm.counterSites.push_back({kind, site});
+        vm.counters.push_back(0);
+        add(VM_COUNT, static_cast<int32_t>(vm.counters.size() - 1));
+    }
+
+    void jump(VMOp op, const string& label, int32_t a = 0, int32_t b = 0) {
+        jumps.push_back({out.code.size(), label});
+        add(op, 0, a, b);
+    }
+
+    void lower(const Quad& q) {
+        static const map<string, int> relOffsets = {{"<", 0}, {">", 1}, {"==", 2}, {"<=", 3}, {">=", 4}, {"<>", 5},
+            {"blt", 0}, {"bgt", 1}, {"beq", 2}, {"ble", 3}, {"bge", 4}, {"bne", 5}};
+        static const map<string, int> arithOffsets = {{"+", 0}, {"-", 1}, {"*", 2}, {"/", 3}, {"%", 4}};
+
+        bool profiled = vm.profiling && q.site != 0;
+        if (q.op == "label") {
+            labels[q.dest] = static_cast<int32_t>(out.code.size());
+            if (profiled) count("label", to_string(q.site));
+        }
+        else if (q.op == "b") jump(labels.count(q.dest) ? VM_LOOP : VM_JMP, q.dest); // backwards --> loop back edge
+        else if (isBranchOp(q.op)) {
+            bool asDouble = isDouble(q.arg1) || isDouble(q.arg2);
+            int32_t a = source(q.arg1, asDouble, 1);
+            int32_t b = source(q.arg2, asDouble, 2);
+            if (profiled) count("branch", to_string(q.site));
+            jump(static_cast<VMOp>((asDouble ? VM_BLT_D : VM_BLT_I) + relOffsets.at(q.op)), q.dest, a, b);
+            if (profiled) count("fall", to_string(q.site));
+        }
+        else if (q.op == "=") {
+            bool asDouble = isDouble(q.dest);
+            finish(q.dest, source(q.arg1, asDouble, 1), asDouble);
+        }
+        else if (isArithOp(q.op)) {
+            bool asDouble = isDouble(q.dest) || isDouble(q.arg1) || isDouble(q.arg2);
+            int32_t a = source(q.arg1, asDouble, 1);
+            int32_t b = source(q.arg2, asDouble, 2);
+            int32_t d = target(q.dest, asDouble);
+            add(static_cast<VMOp>((asDouble ? VM_ADD_D : VM_ADD_I) + arithOffsets.at(q.op)), d, a, b);
+            finish(q.dest, d, asDouble);
+        }
+        else if (isRelOp(q.op)) {
+            bool asDouble = isDouble(q.arg1) || isDouble(q.arg2);
+            int32_t a = source(q.arg1, asDouble, 1);
+            int32_t b = source(q.arg2, asDouble, 2);
+            int32_t d = target(q.dest, false);
+            add(static_cast<VMOp>((asDouble ? VM_LT_D : VM_LT_I) + relOffsets.at(q.op)), d, a, b);
+            finish(q.dest, d, false);
+        }
+        else if (q.op == "and" || q.op == "or") {
+            int32_t a = truth(q.arg1, 1);
+            int32_t b = truth(q.arg2, 2);
+            int32_t d = target(q.dest, false);
+            add(q.op == "and" ? VM_AND : VM_OR, d, a, b);
+            finish(q.dest, d, false);
+        }
+        else if (q.op == "not") {
+            int32_t a = truth(q.arg1, 1);
+            int32_t d = target(q.dest, false);
+            add(VM_NOT, d, a);
+            finish(q.dest, d, false);
+        }
+        else if (q.op == "=[]") {
+            bool asDouble = isDouble(q.arg1);
+            int32_t i = source(q.arg2, false, 2);
+            int32_t d = target(q.dest, asDouble);
+            if (q.inBounds) add(asDouble ? VM_ALOADU_D : VM_ALOADU_I, d, array(q.arg1), i);
+            else add(asDouble ? VM_ALOAD_D : VM_ALOAD_I, d, array(q.arg1), i);
+            finish(q.dest, d, asDouble);
+        }
+        else if (q.op == "[]=") {
+            bool asDouble = isDouble(q.dest);
+            int32_t v = source(q.arg2, asDouble, 1);
+            int32_t i = source(q.arg1, false, 2);
+            if (q.inBounds) add(asDouble ? VM_ASTOREU_D : VM_ASTOREU_I, array(q.dest), i, v);
+            else add(asDouble ? VM_ASTORE_D : VM_ASTORE_I, array(q.dest), i, v);
+        }
+        else if (q.op == "param") {
+            bool asDouble = isDouble(q.arg1);
+            add(asDouble ? VM_ARG_D : VM_ARG_I, source(q.arg1, asDouble, 1));
+        }
+        else if (q.op == "call") {
+            int32_t callee = -1;
+            for (size_t i = 0; i < program.functions.size(); i++) {
+                if (program.functions[i].name == q.arg1) callee = static_cast<int32_t>(i);
+            }
+            bool asDouble = program.functions[callee].returnType == "K_DOUBLE";
+            int32_t d = target(q.dest, asDouble);
+            add(VM_CALL, callee, stoi(q.arg2), d);
+            if (!q.dest.empty()) finish(q.dest, d, asDouble);
+        }
+        else if (q.op == "print") {
+            bool asDouble = isDouble(q.arg1);
+            add(asDouble ? VM_PRINT_D : VM_PRINT_I, source(q.arg1, asDouble, 1));
+        }
+        else if (q.op == "return") add(out.returnsDouble ? VM_RET_D : VM_RET_I, source(q.arg1, out.returnsDouble, 1));
+    }
+
+    void compile(const set<string>& promotedGlobals) {
+        out.name = fn.name;
+        out.returnsDouble = fn.returnType == "K_DOUBLE";
+        for (const auto& var : fn.varTypes) {
+            if (fn.arraySizes.count(var.first)) continue;
+            if (var.second == "K_DOUBLE") doubleRegs[var.first] = newDouble();
+            else intRegs[var.first] = newInt();
+        }
+        for (const auto& global : promotedGlobals) {
+            if (program.globals.at(global) == "K_DOUBLE") doubleRegs[global] = newDouble();
+            else intRegs[global] = newInt();
+        }
+        for (const auto& p : fn.params) out.params.push_back({p.first == "K_DOUBLE", p.first == "K_DOUBLE" ? doubleRegs.at(p.second) : intRegs.at(p.second)});
+
+        if (vm.profiling) count("call", fn.name);
+        for (const auto& q : fn.code) lower(q);
+        add(out.returnsDouble ? VM_RET_D : VM_RET_I, constant("0", out.returnsDouble)); // fell off the end
+
+        for (const auto& j : jumps) out.code[j.first].a = labels.at(j.second);
+    }
+};
+
+VMProgram compileBytecode(CompilerContext& ctx, const ICGProgram& program, bool profiling = false) {
+    VMProgram vm;
+    vm.profiling = profiling;
+    int32_t ints = 0, doubles = 0;
+    for (const auto& global : program.globals) {
+        bool isDouble = global.second == "K_DOUBLE";
+        auto array = program.globalArrays.find(global.first);
+        if (array != program.globalArrays.end()) {
+            vm.globals[global.first] = {isDouble, static_cast<int32_t>(vm.globalArrays.size())};
+            vm.globalArrays.push_back({isDouble, true, static_cast<int32_t>(vm.globalArrays.size()), array->second});
+        }
+        else vm.globals[global.first] = {isDouble, isDouble ? doubles++ : ints++};
+    }
+
+    // Main keeps globals no other function touches in registers
+    set<string> promoted = promotableGlobals(program);
+    vm.functions.resize(program.functions.size());
+    for (size_t i = 0; i < program.functions.size(); i++) {
+        const auto& fn = program.functions[i];
+        if (fn.name == "main") vm.mainIndex = static_cast<int32_t>(i);
+        BytecodeCompiler compiler(ctx, program, fn, vm, vm.functions[i]);
+        compiler.compile((fn.name == "main") ? promoted : set<string>());
+    }
+    return vm;
+}
+
+struct VMArray {
+    int32_t* ints;
+    double* doubles;
+    int32_t size;
+};
+
+/**
+ * JIT (x86-64)
+ * - Functions whose entry count or loop back edge (LOOP) count reaches options.jitThreshold are
+ *   compiled once from their bytecode to machine code with one template per instr
+ * - Jitted code works straight on the VM's register windows (rbx --> int regs, rbp --> double regs)
+ *   so the interpreter can enter it at any instr, a hot loop jumps in at its header
+ * - ARG, CALL and PRINT go back through jitHelper, calls run on the VM (and can be jitted themselves)
+ * - Code is written to an mmap'd RW buffer then flipped to RX
+*/
+#if defined(__x86_64__) && defined(__unix__)
+#define VM_JIT
+#endif
+
+struct VirtualMachine;
+
+// Shared with jitted code (offsets are baked into the machine code)
+struct JitContext {
+    int32_t* I;
+    double* D;
+    VMArray* arrays;
+    int32_t* G;
+    double* GD;
+    VirtualMachine* vm;
+    size_t intBase, doubleBase;
+    VMValue result;
+    int32_t errorIndex;
+};
+
+// Jitted code returns one of these
+enum JitStatus { JIT_RETURN, JIT_DIVIDE_BY_ZERO, JIT_OUT_OF_RANGE, JIT_ERROR };
+
+int jitHelper(JitContext* ctx, const VMInstr* instr);
+
+#ifdef VM_JIT
+struct X86Assembler {
+    enum Reg { RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7, R12 = 12, R13 = 13 };
+    enum Cond { CC_B = 2, CC_AE = 3, CC_E = 4, CC_NE = 5, CC_BE = 6, CC_A = 7, CC_P = 10, CC_NP = 11, CC_L = 12, CC_GE = 13, CC_LE = 14, CC_G = 15 };
+
+    vector<uint8_t> code;
+
+    void bytes(initializer_list<uint8_t> values) { code.insert(code.end(), values); }
+
+    void dword(int32_t value) {
+        for (int i = 0; i < 4; i++) code.push_back(static_cast<uint8_t>(static_cast<uint32_t>(value) >> (8 * i)));
+    }
+
+    void qword(uint64_t value) {
+        for (int i = 0; i < 8; i++) code.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+
+    // prefix [REX] opcode modrm [sib] disp32 --> reg, [base + disp]
+    void mem(uint8_t prefix, bool wide, initializer_list<uint8_t> opcode, int reg, int base, int32_t disp) {
+        if (prefix) code.push_back(prefix);
+        uint8_t rex = 0x40 | (wide ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((base & 8) ? 1 : 0);
+        if (rex != 0x40) code.push_back(rex);
+        bytes(opcode);
+        code.push_back(static_cast<uint8_t>(0x80 | ((reg & 7) << 3) | (base & 7)));
+        if ((base & 7) == RSP) code.push_back(0x24);
+        dword(disp);
+    }
+
+    // Int regs are [rbx + 4i], double regs [rbp + 8i]
+    void loadInt(int reg, int32_t index) { mem(0, false, {0x8B}, reg, RBX, 4 * index); }
+    void storeInt(int32_t index, int reg) { mem(0, false, {0x89}, reg, RBX, 4 * index); }
+    void intOp(initializer_list<uint8_t> opcode, int reg, int32_t index) { mem(0, false, opcode, reg, RBX, 4 * index); }
+    void loadDouble(int xmm, int32_t index) { mem(0xF2, false, {0x0F, 0x10}, xmm, RBP, 8 * index); }
+    void storeDouble(int32_t index, int xmm) { mem(0xF2, false, {0x0F, 0x11}, xmm, RBP, 8 * index); }
+    void doubleOp(uint8_t op, int xmm, int32_t index) { mem(0xF2, false, {0x0F, op}, xmm, RBP, 8 * index); }
+    void compareDouble(int xmm, int32_t index) { mem(0x66, false, {0x0F, 0x2E}, xmm, RBP, 8 * index); }
+    void loadContext(int reg, size_t offset) { mem(0, true, {0x8B}, reg, R12, static_cast<int32_t>(offset)); }
+
+    void setcc(int cond, bool low = true) { bytes({0x0F, static_cast<uint8_t>(0x90 + cond), static_cast<uint8_t>(low ? 0xC0 : 0xC1)}); } // al / cl
+    void zeroExtendAl() { bytes({0x0F, 0xB6, 0xC0}); }
+    void test(int reg) { bytes({0x85, static_cast<uint8_t>(0xC0 | (reg << 3) | reg)}); }
+    void callAbsolute(const void* target) {
+        bytes({0x48, 0xB8});
+        qword(reinterpret_cast<uint64_t>(target));
+        bytes({0xFF, 0xD0});
+    }
+
+    // Jumps return the offset of their rel32 for patching
+    size_t jump() {
+        code.push_back(0xE9);
+        dword(0);
+        return code.size() - 4;
+    }
+    size_t jump(int cond) {
+        bytes({0x0F, static_cast<uint8_t>(0x80 + cond)});
+        dword(0);
+        return code.size() - 4;
+    }
+    void patch(size_t at, size_t target) {
+        int32_t rel = static_cast<int32_t>(target) - static_cast<int32_t>(at + 4);
+        for (int i = 0; i < 4; i++) code[at + i] = static_cast<uint8_t>(static_cast<uint32_t>(rel) >> (8 * i));
+    }
+};
+
+// Compiles fn's bytecode --> false if executable memory couldn't be mapped
+bool compileJit(VMFunction& fn, uint64_t* counters) {
+    using A = X86Assembler;
+    A as;
+    vector<pair<size_t, int32_t>> jumps; // rel32 --> bytecode index
+    vector<pair<size_t, int>> exits; // rel32 --> JitStatus stub
+
+    // Entry(ctx, address): save callee saved regs, load the register windows and jump to address
+    as.bytes({0x55, 0x53, 0x41, 0x54, 0x41, 0x55, 0x48, 0x83, 0xEC, 0x08}); // push rbp, rbx, r12, r13; sub rsp, 8
+    as.bytes({0x49, 0x89, 0xFC}); // mov r12, rdi
+    as.loadContext(A::RBX, offsetof(JitContext, I));
+    as.loadContext(A::RBP, offsetof(JitContext, D));
+    as.loadContext(A::R13, offsetof(JitContext, arrays));
+    as.bytes({0xFF, 0xE6}); // jmp rsi
+
+    static const int intConds[] = {A::CC_L, A::CC_G, A::CC_E, A::CC_LE, A::CC_GE, A::CC_NE};
+    static const uint8_t doubleOps[] = {0x58, 0x5C, 0x59, 0x5E}; // addsd subsd mulsd divsd
+
+    // Doubles compare so NaN is false for everything but <> --> (a < b) is (b > a)
+    auto compareDoubles = [&as](int rel, int32_t b, int32_t c) {
+        bool swapped = (rel == 0 || rel == 3);
+        as.loadDouble(0, swapped ? c : b);
+        as.compareDouble(0, swapped ? b : c);
+    };
+    static const int doubleConds[] = {A::CC_A, A::CC_A, A::CC_E, A::CC_AE, A::CC_AE, A::CC_NE};
+
+    // Bounds checks I[index] against arrays[array] --> rax = &arrays[array], rcx = index
+    auto checkIndex = [&as, &exits](int32_t array, int32_t index, bool checked) {
+        as.loadInt(A::RCX, index);
+        as.mem(0, true, {0x8D}, A::RAX, A::R13, array * static_cast<int32_t>(sizeof(VMArray))); // lea rax, [r13 + array]
+        if (!checked) return; // ALOADU/ASTOREU
+        as.mem(0, false, {0x3B}, A::RCX, A::RAX, offsetof(VMArray, size)); // cmp ecx, size
+        exits.push_back({as.jump(A::CC_AE), JIT_OUT_OF_RANGE});
+    };
+
+    auto callHelper = [&as, &exits](const VMInstr& instr) {
+        as.bytes({0x4C, 0x89, 0xE7}); // mov rdi, r12
+        as.bytes({0x48, 0xBE});
+        as.qword(reinterpret_cast<uint64_t>(&instr)); // mov rsi, instr
+        as.callAbsolute(reinterpret_cast<const void*>(&jitHelper));
+        as.test(A::RAX);
+        exits.push_back({as.jump(A::CC_NE), JIT_ERROR});
+    };
+
+    fn.nativeOffsets.assign(fn.code.size(), 0);
+    for (size_t i = 0; i < fn.code.size(); i++) {
+        const VMInstr& instr = fn.code[i];
+        int32_t a = instr.a, b = instr.b, c = instr.c;
+        fn.nativeOffsets[i] = static_cast<uint32_t>(as.code.size());
+
+        switch (instr.op) {
+        case VM_MOV_I: as.loadInt(A::RAX, b); as.storeInt(a, A::RAX); break;
+        case VM_MOV_D: as.loadDouble(0, b); as.storeDouble(a, 0); break;
+        case VM_I2D: as.mem(0xF2, false, {0x0F, 0x2A}, 0, A::RBX, 4 * b); as.storeDouble(a, 0); break;
+        case VM_D2I: as.mem(0xF2, false, {0x0F, 0x2C}, A::RAX, A::RBP, 8 * b); as.storeInt(a, A::RAX); break;
+        case VM_GETG_I:
+            as.loadContext(A::RCX, offsetof(JitContext, G));
+            as.mem(0, false, {0x8B}, A::RAX, A::RCX, 4 * b);
+            as.storeInt(a, A::RAX);
+            break;
+        case VM_GETG_D:
+            as.loadContext(A::RCX, offsetof(JitContext, GD));
+            as.mem(0xF2, false, {0x0F, 0x10}, 0, A::RCX, 8 * b);
+            as.storeDouble(a, 0);
+            break;
+        case VM_SETG_I:
+            as.loadContext(A::RCX, offsetof(JitContext, G));
+            as.loadInt(A::RAX, b);
+            as.mem(0, false, {0x89}, A::RAX, A::RCX, 4 * a);
+            break;
+        case VM_SETG_D:
+            as.loadContext(A::RCX, offsetof(JitContext, GD));
+            as.loadDouble(0, b);
+            as.mem(0xF2, false, {0x0F, 0x11}, 0, A::RCX, 8 * a);
+            break;
+
+        case VM_ADD_I: case VM_SUB_I: case VM_MUL_I: {
+            static const map<int, vector<uint8_t>> ops = {{VM_ADD_I, {0x03}}, {VM_SUB_I, {0x2B}}, {VM_MUL_I, {0x0F, 0xAF}}};
+            const auto& op = ops.at(instr.op);
+            as.loadInt(A::RAX, b);
+            if (op.size() == 1) as.intOp({op[0]}, A::RAX, c);
+            else as.intOp({op[0], op[1]}, A::RAX, c);
+            as.storeInt(a, A::RAX);
+            break;
+        }
+        case VM_DIV_I: case VM_MOD_I: {
+            bool isDiv = instr.op == VM_DIV_I;
+            as.loadInt(A::RCX, c);
+            as.test(A::RCX);
+            exits.push_back({as.jump(A::CC_E), JIT_DIVIDE_BY_ZERO});
+            as.bytes({0x83, 0xF9, 0xFF}); // cmp ecx, -1
+            size_t minusOne = as.jump(A::CC_E);
+            as.loadInt(A::RAX, b);
+            as.bytes({0x99, 0xF7, 0xF9}); // cdq; idiv ecx
+            as.storeInt(a, isDiv ? A::RAX : A::RDX);
+            size_t done = as.jump();
+            as.patch(minusOne, as.code.size()); // x / -1 --> -x (wraps), x % -1 --> 0
+            if (isDiv) {
+                as.loadInt(A::RAX, b);
+                as.bytes({0xF7, 0xD8}); // neg eax
+            }
+            else as.bytes({0x31, 0xC0}); // xor eax, eax
+            as.storeInt(a, A::RAX);
+            as.patch(done, as.code.size());
+            break;
+        }
+        case VM_ADD_D: case VM_SUB_D: case VM_MUL_D: case VM_DIV_D:
+            as.loadDouble(0, b);
+            as.doubleOp(doubleOps[instr.op - VM_ADD_D], 0, c);
+            as.storeDouble(a, 0);
+            break;
+        case VM_MOD_D:
+            as.loadDouble(0, b);
+            as.loadDouble(1, c);
+            as.callAbsolute(reinterpret_cast<const void*>(static_cast<double (*)(double, double)>(&fmod)));
+            as.storeDouble(a, 0);
+            break;
+
+        case VM_LT_I: case VM_GT_I: case VM_EQ_I: case VM_LE_I: case VM_GE_I: case VM_NE_I:
+            as.loadInt(A::RAX, b);
+            as.intOp({0x3B}, A::RAX, c);
+            as.setcc(intConds[instr.op - VM_LT_I]);
+            as.zeroExtendAl();
+            as.storeInt(a, A::RAX);
+            break;
+        case VM_LT_D: case VM_GT_D: case VM_EQ_D: case VM_LE_D: case VM_GE_D: case VM_NE_D: {
+            int rel = instr.op - VM_LT_D;
+            compareDoubles(rel, b, c);
+            as.setcc(doubleConds[rel]);
+            if (rel == 2 || rel == 5) {
+                as.setcc(rel == 2 ? A::CC_NP : A::CC_P, false);
+                as.bytes({static_cast<uint8_t>(rel == 2 ? 0x20 : 0x08), 0xC8}); // and / or al, cl
+            }
+            as.zeroExtendAl();
+            as.storeInt(a, A::RAX);
+            break;
+        }
+        case VM_AND: case VM_OR:
+            as.loadInt(A::RAX, b);
+            as.test(A::RAX);
+            as.setcc(A::CC_NE);
+            as.loadInt(A::RDX, c);
+            as.test(A::RDX);
+            as.setcc(A::CC_NE, false);
+            as.bytes({static_cast<uint8_t>(instr.op == VM_AND ? 0x20 : 0x08), 0xC8});
+            as.zeroExtendAl();
+            as.storeInt(a, A::RAX);
+            break;
+        case VM_NOT:
+            as.loadInt(A::RAX, b);
+            as.test(A::RAX);
+            as.setcc(A::CC_E);
+            as.zeroExtendAl();
+            as.storeInt(a, A::RAX);
+            break;
+
+        case VM_JMP: case VM_LOOP: jumps.push_back({as.jump(), a}); break;
+        case VM_BLT_I: case VM_BGT_I: case VM_BEQ_I: case VM_BLE_I: case VM_BGE_I: case VM_BNE_I:
+            as.loadInt(A::RAX, b);
+            as.intOp({0x3B}, A::RAX, c);
+            jumps.push_back({as.jump(intConds[instr.op - VM_BLT_I]), a});
+            break;
+        case VM_BLT_D: case VM_BGT_D: case VM_BEQ_D: case VM_BLE_D: case VM_BGE_D: case VM_BNE_D: {
+            int rel = instr.op - VM_BLT_D;
+            compareDoubles(rel, b, c);
+            if (rel == 2) { // equal and ordered
+                size_t unordered = as.jump(A::CC_P);
+                jumps.push_back({as.jump(A::CC_E), a});
+                as.patch(unordered, as.code.size());
+            }
+            else {
+                if (rel == 5) jumps.push_back({as.jump(A::CC_P), a});
+                jumps.push_back({as.jump(doubleConds[rel]), a});
+            }
+            break;
+        }
+
+        case VM_ALOAD_I: case VM_ALOAD_D: case VM_ALOADU_I: case VM_ALOADU_D: {
+            bool isDouble = instr.op == VM_ALOAD_D || instr.op == VM_ALOADU_D;
+            checkIndex(b, c, instr.op == VM_ALOAD_I || instr.op == VM_ALOAD_D);
+            as.mem(0, true, {0x8B}, A::RDX, A::RAX, isDouble ? offsetof(VMArray, doubles) : offsetof(VMArray, ints));
+            if (isDouble) {
+                as.bytes({0xF2, 0x0F, 0x10, 0x04, 0xCA}); // movsd xmm0, [rdx + rcx * 8]
+                as.storeDouble(a, 0);
+            }
+            else {
+                as.bytes({0x8B, 0x04, 0x8A}); // mov eax, [rdx + rcx * 4]
+                as.storeInt(a, A::RAX);
+            }
+            break;
+        }
+        case VM_ASTORE_I: case VM_ASTORE_D: case VM_ASTOREU_I: case VM_ASTOREU_D: {
+            bool isDouble = instr.op == VM_ASTORE_D || instr.op == VM_ASTOREU_D;
+            checkIndex(a, b, instr.op == VM_ASTORE_I || instr.op == VM_ASTORE_D);
+            as.mem(0, true, {0x8B}, A::RDX, A::RAX, isDouble ? offsetof(VMArray, doubles) : offsetof(VMArray, ints));
+            if (isDouble) {
+                as.loadDouble(0, c);
+                as.bytes({0xF2, 0x0F, 0x11, 0x04, 0xCA}); // movsd [rdx + rcx * 8], xmm0
+            }
+            else {
+                as.loadInt(A::RAX, c);
+                as.bytes({0x89, 0x04, 0x8A}); // mov [rdx + rcx * 4], eax
+            }
+            break;
+        }
+
+        case VM_ARG_I: case VM_ARG_D: case VM_PRINT_I: case VM_PRINT_D: callHelper(instr); break;
+        case VM_CALL:
+            callHelper(instr);
+            as.loadContext(A::RBX, offsetof(JitContext, I)); // the register stack may have moved
+            as.loadContext(A::RBP, offsetof(JitContext, D));
+            break;
+        case VM_RET_I:
+            as.loadInt(A::RAX, a);
+            as.mem(0, false, {0x89}, A::RAX, A::R12, offsetof(JitContext, result));
+            exits.push_back({as.jump(), JIT_RETURN});
+            break;
+        case VM_RET_D:
+            as.loadDouble(0, a);
+            as.mem(0xF2, false, {0x0F, 0x11}, 0, A::R12, offsetof(JitContext, result));
+            exits.push_back({as.jump(), JIT_RETURN});
+            break;
+        case VM_COUNT:
+            as.bytes({0x48, 0xB8}); // mov rax, &counters[a]
+            as.qword(reinterpret_cast<uint64_t>(counters + a));
+            as.bytes({0x48, 0xFF, 0x00}); // inc qword [rax]
+            break;
+        }
+    }
+
+    // Exit stubs --> eax = status, then restore regs (the return stub falls through)
+    map<int, size_t> stubs;
+    for (int status : {JIT_DIVIDE_BY_ZERO, JIT_OUT_OF_RANGE, JIT_ERROR, JIT_RETURN}) {
+        stubs[status] = as.code.size();
+        if (status == JIT_OUT_OF_RANGE) as.mem(0, false, {0x89}, A::RCX, A::R12, offsetof(JitContext, errorIndex));
+        as.code.push_back(0xB8); // mov eax, status
+        as.dword(status);
+        if (status != JIT_RETURN) exits.push_back({as.jump(), -1});
+    }
+    size_t epilogue = as.code.size();
+    as.bytes({0x48, 0x83, 0xC4, 0x08, 0x41, 0x5D, 0x41, 0x5C, 0x5B, 0x5D, 0xC3}); // add rsp, 8; pop r13, r12, rbx, rbp; ret
+
+    for (const auto& j : jumps) as.patch(j.first, fn.nativeOffsets[j.second]);
+    for (const auto& e : exits) as.patch(e.first, (e.second < 0) ? epilogue : stubs[e.second]);
+
+    // RW --> copy --> RX
+    size_t size = as.code.size();
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) return false;
+    memcpy(memory, as.code.data(), size);
+    if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, size);
+        return false;
+    }
+    fn.jitCode = shared_ptr<uint8_t>(static_cast<uint8_t*>(memory), [size](uint8_t* code) { munmap(code, size); });
+    return true;
+}
+#else
+bool compileJit(VMFunction&, uint64_t*) { return false; }
+#endif
+
+/**
+ * Program output (print on the VM)
+ * - Ints are formatted two digits at a time and doubles by formatDoubleTo straight into a 64KB buffer
+ * - The buffer goes to the stream only when a print doesn't fit and at flush (end of the run or a
+ *   runtime error), so print loops cost no stream call per print
+*/
+struct OutputBuffer {
+    static const size_t capacity = 1 << 16;
+    ostream& stream;
+    vector<char> buffer;
+    size_t used = 0;
+
+    explicit OutputBuffer(ostream& output) : stream(output), buffer(capacity) {}
+    ~OutputBuffer() { flush(); }
+
+    void flush() {
+        stream.write(buffer.data(), static_cast<streamsize>(used));
+        stream.flush();
+        used = 0;
+    }
+
+    // Room for n more chars
+    char* reserve(size_t n) {
+        if (used + n > capacity) flush();
+        return buffer.data() + used;
+    }
+
+    void printInt(int32_t value) {
+        char text[12];
+        text[11] = '\n';
+        char* start = formatIntBackward(value, text + 11);
+        size_t length = text + 12 - start;
+        memcpy(reserve(length), start, length);
+        used += length;
+    }
+
+    void printDouble(double value) {
+        char* start = reserve(33);
+        char* end = formatDoubleTo(value, start);
+        *end++ = '\n';
+        used += end - start;
+    }
+};
+
+struct VirtualMachine {
+    const CompileOptions& options; // --jit, its threshold and the call depth limit
+    VMProgram& program;
+    OutputBuffer& out;
+    vector<int32_t> ints; // register stack, one window per active call
+    vector<double> doubles;
+    size_t intTop = 0, doubleTop = 0;
+    vector<VMValue> args; // pushed by ARG_* for the next CALL
+    vector<int32_t> globalInts;
+    vector<double> globalDoubles;
+    vector<vector<int32_t>> globalIntArrays;
+    vector<vector<double>> globalDoubleArrays;
+    int depth = 0;
+    int maxDepth; // options.maxCallDepth
+    string error;
+
+    VirtualMachine(const CompileOptions& compileOptions, VMProgram& prog, OutputBuffer& output)
+        : options(compileOptions), program(prog), out(output), ints(1024), doubles(1024), maxDepth(compileOptions.maxCallDepth) {
+        int32_t globalIntCount = 0, globalDoubleCount = 0;
+        for (const auto& global : program.globals) {
+            if (global.second.first) globalDoubleCount = max(globalDoubleCount, global.second.second + 1);
+            else globalIntCount = max(globalIntCount, global.second.second + 1);
+        }
+        globalInts.assign(globalIntCount, 0);
+        globalDoubles.assign(globalDoubleCount, 0);
+        for (const auto& array : program.globalArrays) {
+            globalIntArrays.emplace_back(array.isDouble ? 0 : array.size);
+            globalDoubleArrays.emplace_back(array.isDouble ? array.size : 0);
+        }
+    }
+
+    bool run() {
+        VMValue result;
+        return execute(program.mainIndex, 0, result);
+    }
+
+    bool fail(const string& message) {
+        error = message;
+        return false;
+    }
+
+    // Compiles fn the first time it gets hot --> true if it has jitted code
+    bool hot(VMFunction& fn, uint32_t& counter) {
+        if (fn.jitCode) return true;
+        if (!options.jit || fn.jitFailed || ++counter < options.jitThreshold) return false;
+        if (!compileJit(fn, program.counters.data())) fn.jitFailed = true;
+        return !fn.jitFailed;
+    }
+
+    // Runs fn's jitted code from instr index on the current register windows
+    int runJit(VMFunction& fn, int32_t index, size_t intBase, size_t doubleBase, vector<VMArray>& arrays, VMValue& result, int32_t& errorIndex) {
+        JitContext ctx = {&ints[intBase], &doubles[doubleBase], arrays.data(), globalInts.data(), globalDoubles.data(), this, intBase, doubleBase, {}, 0};
+        auto entry = reinterpret_cast<int (*)(JitContext*, const void*)>(fn.jitCode.get());
+        int status = entry(&ctx, fn.jitCode.get() + fn.nativeOffsets[index]);
+        result = ctx.result;
+        errorIndex = ctx.errorIndex;
+        return status;
+    }
+
+    // Runs a function with its args on top of args --> false on a runtime error
+    bool execute(int32_t index, int32_t argc, VMValue& result) {
+        VMFunction& fn = program.functions[index];
+        if (++depth > maxDepth) return fail("call depth exceeded in " + fn.name);
+
+        // Register windows
+        size_t intBase = intTop, doubleBase = doubleTop;
+        intTop += fn.intInit.size();
+        doubleTop += fn.doubleInit.size();
+        if (ints.size() < intTop) ints.resize(max(intTop, ints.size() * 2));
+        if (doubles.size() < doubleTop) doubles.resize(max(doubleTop, doubles.size() * 2));
+        copy(fn.intInit.begin(), fn.intInit.end(), ints.begin() + intBase);
+        copy(fn.doubleInit.begin(), fn.doubleInit.end(), doubles.begin() + doubleBase);
+        int32_t* I = &ints[intBase];
+        double* D = &doubles[doubleBase];
+
+        size_t argBase = args.size() - argc;
+        for (size_t i = 0; i < fn.params.size() && i < static_cast<size_t>(argc); i++) {
+            if (fn.params[i].first) D[fn.params[i].second] = args[argBase + i].d;
+            else I[fn.params[i].second] = args[argBase + i].i;
+        }
+        args.resize(argBase);
+
+        // Arrays
+        vector<int32_t> intArrays(fn.intArrayWords);
+        vector<double> doubleArrays(fn.doubleArrayWords);
+        vector<VMArray> arrays;
+        for (const auto& ref : fn.arrays) {
+            if (ref.isGlobal) arrays.push_back({globalIntArrays[ref.index].data(), globalDoubleArrays[ref.index].data(), ref.size});
+            else arrays.push_back({intArrays.data() + ref.index, doubleArrays.data() + ref.index, ref.size});
+        }
+
+        int32_t* G = globalInts.data();
+        double* GD = globalDoubles.data();
+        const VMInstr* code = fn.code.data();
+        const VMInstr* ip = code;
+        int32_t a, b;
+        int status;
+
+        if (hot(fn, fn.calls)) {
+            status = runJit(fn, 0, intBase, doubleBase, arrays, result, b);
+            goto jitted;
+        }
+
+#ifdef VM_THREADED
+#define VM_LABEL(op) &&op_##op,
+        static const void* const handlers[] = { VM_OPS(VM_LABEL) };
+#undef VM_LABEL
+        if (!fn.threaded) {
+            for (auto& instr : fn.code) instr.handler = handlers[instr.op];
+            fn.threaded = true;
+        }
+#define CASE(op) op_##op:
+#define NEXT goto *(++ip)->handler
+#define JUMP(target) goto *(ip = code + (target))->handler
+        goto *ip->handler;
+#else
+#define CASE(op) case VM_##op:
+#define NEXT { ++ip; continue; }
+#define JUMP(target) { ip = code + (target); continue; }
+        for (;;) switch (ip->op) {
+#endif
+        CASE(MOV_I) I[ip->a] = I[ip->b]; NEXT;
+        CASE(MOV_D) D[ip->a] = D[ip->b]; NEXT;
+        CASE(I2D) D[ip->a] = I[ip->b]; NEXT;
+        CASE(D2I) I[ip->a] = static_cast<int32_t>(D[ip->b]); NEXT;
+        CASE(GETG_I) I[ip->a] = G[ip->b]; NEXT;
+        CASE(GETG_D) D[ip->a] = GD[ip->b]; NEXT;
+        CASE(SETG_I) G[ip->a] = I[ip->b]; NEXT;
+        CASE(SETG_D) GD[ip->a] = D[ip->b]; NEXT;
+
+        // int arithmetic wraps like 32-bit machine registers
+        CASE(ADD_I) I[ip->a] = static_cast<int32_t>(static_cast<uint32_t>(I[ip->b]) + static_cast<uint32_t>(I[ip->c])); NEXT;
+        CASE(SUB_I) I[ip->a] = static_cast<int32_t>(static_cast<uint32_t>(I[ip->b]) - static_cast<uint32_t>(I[ip->c])); NEXT;
+        CASE(MUL_I) I[ip->a] = static_cast<int32_t>(static_cast<uint32_t>(I[ip->b]) * static_cast<uint32_t>(I[ip->c])); NEXT;
+        CASE(DIV_I)
+            a = I[ip->b];
+            b = I[ip->c];
+            if (b == 0) goto divideByZero;
+            I[ip->a] = (b == -1) ? static_cast<int32_t>(0u - static_cast<uint32_t>(a)) : a / b;
+            NEXT;
+        CASE(MOD_I)
+            a = I[ip->b];
+            b = I[ip->c];
+            if (b == 0) goto divideByZero;
+            I[ip->a] = (b == -1) ? 0 : a % b;
+            NEXT;
+        CASE(ADD_D) D[ip->a] = D[ip->b] + D[ip->c]; NEXT;
+        CASE(SUB_D) D[ip->a] = D[ip->b] - D[ip->c]; NEXT;
+        CASE(MUL_D) D[ip->a] = D[ip->b] * D[ip->c]; NEXT;
+        CASE(DIV_D) D[ip->a] = D[ip->b] / D[ip->c]; NEXT;
+        CASE(MOD_D) D[ip->a] = fmod(D[ip->b], D[ip->c]); NEXT;
+
+        CASE(LT_I) I[ip->a] = I[ip->b] < I[ip->c]; NEXT;
+        CASE(GT_I) I[ip->a] = I[ip->b] > I[ip->c]; NEXT;
+        CASE(EQ_I) I[ip->a] = I[ip->b] == I[ip->c]; NEXT;
+        CASE(LE_I) I[ip->a] = I[ip->b] <= I[ip->c]; NEXT;
+        CASE(GE_I) I[ip->a] = I[ip->b] >= I[ip->c]; NEXT;
+        CASE(NE_I) I[ip->a] = I[ip->b] != I[ip->c]; NEXT;
+        CASE(LT_D) I[ip->a] = D[ip->b] < D[ip->c]; NEXT;
+        CASE(GT_D) I[ip->a] = D[ip->b] > D[ip->c]; NEXT;
+        CASE(EQ_D) I[ip->a] = D[ip->b] == D[ip->c]; NEXT;
+        CASE(LE_D) I[ip->a] = D[ip->b] <= D[ip->c]; NEXT;
+        CASE(GE_D) I[ip->a] = D[ip->b] >= D[ip->c]; NEXT;
+        CASE(NE_D) I[ip->a] = D[ip->b] != D[ip->c]; NEXT;
+        CASE(AND) I[ip->a] = I[ip->b] && I[ip->c]; NEXT;
+        CASE(OR) I[ip->a] = I[ip->b] || I[ip->c]; NEXT;
+        CASE(NOT) I[ip->a] = !I[ip->b]; NEXT;
+
+        CASE(JMP) JUMP(ip->a);
+        CASE(LOOP)
+            if (hot(fn, fn.backEdges)) {
+                status = runJit(fn, ip->a, intBase, doubleBase, arrays, result, b); // enter at the loop header
+                goto jitted;
+            }
+            JUMP(ip->a);
+        CASE(BLT_I) if (I[ip->b] < I[ip->c]) JUMP(ip->a); NEXT;
+        CASE(BGT_I) if (I[ip->b] > I[ip->c]) JUMP(ip->a); NEXT;
+        CASE(BEQ_I) if (I[ip->b] == I[ip->c]) JUMP(ip->a); NEXT;
+        CASE(BLE_I) if (I[ip->b] <= I[ip->c]) JUMP(ip->a); NEXT;
+        CASE(BGE_I) if (I[ip->b] >= I[ip->c]) JUMP(ip->a); NEXT;
+        CASE(BNE_I) if (I[ip->b] != I[ip->c]) JUMP(ip->a); NEXT;
+        CASE(BLT_D) if (D[ip->b] < D[ip->c]) JUMP(ip->a); NEXT;
+        CASE(BGT_D) if (D[ip->b] > D[ip->c]) JUMP(ip->a); NEXT;
+        CASE(BEQ_D) if (D[ip->b] == D[ip->c]) JUMP(ip->a); NEXT;
+        CASE(BLE_D) if (D[ip->b] <= D[ip->c]) JUMP(ip->a); NEXT;
+        CASE(BGE_D) if (D[ip->b] >= D[ip->c]) JUMP(ip->a); NEXT;
+        CASE(BNE_D) if (D[ip->b] != D[ip->c]) JUMP(ip->a); NEXT;
+
+        // Arrays are bounds checked: a --> array, b --> index
+        CASE(ALOAD_I)
+            b = I[ip->c];
+            if (b < 0 || b >= arrays[ip->b].size) goto outOfRange;
+            I[ip->a] = arrays[ip->b].ints[b];
+            NEXT;
+        CASE(ALOAD_D)
+            b = I[ip->c];
+            if (b < 0 || b >= arrays[ip->b].size) goto outOfRange;
+            D[ip->a] = arrays[ip->b].doubles[b];
+            NEXT;
+        CASE(ASTORE_I)
+            b = I[ip->b];
+            if (b < 0 || b >= arrays[ip->a].size) goto outOfRange;
+            arrays[ip->a].ints[b] = I[ip->c];
+            NEXT;
+        CASE(ASTORE_D)
+            b = I[ip->b];
+            if (b < 0 || b >= arrays[ip->a].size) goto outOfRange;
+            arrays[ip->a].doubles[b] = D[ip->c];
+            NEXT;
+        CASE(ALOADU_I) I[ip->a] = arrays[ip->b].ints[I[ip->c]]; NEXT; // index proven in range
+        CASE(ALOADU_D) D[ip->a] = arrays[ip->b].doubles[I[ip->c]]; NEXT;
+        CASE(ASTOREU_I) arrays[ip->a].ints[I[ip->b]] = I[ip->c]; NEXT;
+        CASE(ASTOREU_D) arrays[ip->a].doubles[I[ip->b]] = D[ip->c]; NEXT;
+
+        CASE(ARG_I) {
+            VMValue value;
+            value.i = I[ip->a];
+            args.push_back(value);
+            NEXT;
+        }
+        CASE(ARG_D) {
+            VMValue value;
+            value.d = D[ip->a];
+            args.push_back(value);
+            NEXT;
+        }
+        CASE(CALL) {
+            VMValue value;
+            if (!execute(ip->a, ip->b, value)) return false;
+            I = &ints[intBase]; // the callee may have grown the register stack
+            D = &doubles[doubleBase];
+            if (program.functions[ip->a].returnsDouble) D[ip->c] = value.d;
+            else I[ip->c] = value.i;
+            NEXT;
+        }
+        CASE(RET_I)
+            result.i = I[ip->a];
+            goto done;
+        CASE(RET_D)
+            result.d = D[ip->a];
+            goto done;
+        CASE(PRINT_I) out.printInt(I[ip->a]); NEXT;
+        CASE(PRINT_D) out.printDouble(D[ip->a]); NEXT;
+        CASE(COUNT) program.counters[ip->a]++; NEXT;
+#ifndef VM_THREADED
+        }
+#endif
+#undef CASE
+#undef NEXT
+#undef JUMP
+
+    jitted:
+        if (status == JIT_DIVIDE_BY_ZERO) goto divideByZero;
+        if (status == JIT_OUT_OF_RANGE) goto outOfRange;
+        if (status == JIT_ERROR) return false;
+        goto done;
+    divideByZero:
+        return fail("division by zero in " + fn.name);
+    outOfRange:
+        return fail("array index " + to_string(b) + " out of range in " + fn.name);
+    done:
+        intTop = intBase;
+        doubleTop = doubleBase;
+        depth--;
+        return true;
+    }
+};
+
+// ARG, CALL and PRINT from jitted code --> 0 or JIT_ERROR (vm error set)
+int jitHelper(JitContext* ctx, const VMInstr* instr) {
+    VirtualMachine& vm = *ctx->vm;
+    VMValue value;
+    switch (instr->op) {
+    case VM_ARG_I:
+        value.i = ctx->I[instr->a];
+        vm.args.push_back(value);
+        return 0;
+    case VM_ARG_D:
+        value.d = ctx->D[instr->a];
+        vm.args.push_back(value);
+        return 0;
+    case VM_PRINT_I:
+        vm.out.printInt(ctx->I[instr->a]);
+        return 0;
+    case VM_PRINT_D:
+        vm.out.printDouble(ctx->D[instr->a]);
+        return 0;
+    case VM_CALL:
+        if (!vm.execute(instr->a, instr->b, value)) return JIT_ERROR;
+        ctx->I = &vm.ints[ctx->intBase];
+        ctx->D = &vm.doubles[ctx->doubleBase];
+        if (vm.program.functions[instr->a].returnsDouble) ctx->D[instr->c] = value.d;
+        else ctx->I[instr->c] = value.i;
+        return 0;
+    }
+    return JIT_ERROR;
+}
+
+// Sums a --profile-generate run's counters per site (branches the optimizer inverted are flipped back)
+bool writeProfile(const VMProgram& vm, const ICGProgram& program, const string& path) {
+    map<string, uint64_t> calls;
+    map<int, uint64_t> labels;
+    map<int, pair<uint64_t, uint64_t>> branches; // (executed, taken)
+    for (size_t i = 0; i < vm.counters.size(); i++) {
+        const auto& kind = vm.counterSites[i].first;
+        uint64_t count = vm.counters[i];
+        if (kind == "call") {
+            calls[vm.counterSites[i].second] += count;
+            continue;
+        }
+        int site = stoi(vm.counterSites[i].second);
+        if (kind == "label") {
+            labels[site] += count;
+            continue;
+        }
+        auto& branch = branches[abs(site)];
+        if (kind == "branch") {
+            branch.first += count;
+            if (site > 0) branch.second += count; // taken = executed - fall through
+        }
+        else if (site > 0) branch.second -= count;
+        else branch.second += count; // an inverted branch falls through when the original is taken
+    }
+
+    ofstream out(path);
+    if (!out.is_open()) return false;
+    out << "# cp471 profile" << endl << "sites " << program.siteNum << endl;
+    for (const auto& call : calls) out << "call " << call.first << " " << call.second << endl;
+    for (const auto& label : labels) out << "label " << label.first << " " << label.second << endl;
+    for (const auto& branch : branches) out << "branch " << branch.first << " " << branch.second.first << " " << branch.second.second << endl;
+    return true;
+}
+
+// Bytecode listing (--emit-bytecode)
+void printBytecode(const VMProgram& vm, ostream& out) {
+    for (const auto& fn : vm.functions) {
+        out << fn.name << ": " << fn.intInit.size() << " int, " << fn.doubleInit.size() << " double registers" << endl;
+        for (size_t i = 0; i < fn.intInit.size(); i++) {
+            if (fn.intInit[i] != 0) out << "  i" << i << " = " << fn.intInit[i] << endl;
+        }
+        for (size_t i = 0; i < fn.doubleInit.size(); i++) {
+            if (fn.doubleInit[i] != 0) out << "  d" << i << " = " << formatDouble(fn.doubleInit[i]) << endl;
+        }
+        for (size_t i = 0; i < fn.code.size(); i++) {
+            const auto& instr = fn.code[i];
+            out << "  " << i << ": " << vmOpNames[instr.op] << " " << instr.a << ", " << instr.b << ", " << instr.c << endl;
+        }
+        out << endl;
+    }
+}
+
+// Phases 1 and 2 with the lexer, parser and symbol worker on threads of their own (--stream) --> the AST, its symbol table in symbolTable
+shared_ptr<ASTNode> streamFrontEnd(CompilerContext& ctx, shared_ptr<SymbolTable>& symbolTable) {
+    // Lexer thread: a context of its own so its errors, line count and constant pool stay apart until it's joined
+    ostringstream lexErrors;
+    CompilerContext lexer(ctx.options, ctx.tables, ctx.inputFile, lexErrors, ctx.out, ctx.err);
+    lexer.tokenFile = ctx.tokenFile;
+    TokenStream stream;
+    TextArena arena;
+    size_t tokens = 0;
+    ThreadUsage lexerStart, lexerEnd, symbolStart, symbolEnd; // the workers', for the stream phase
+    thread lexerThread([&]() {
+        lexerStart = ThreadUsage();
+        tokens = streamTokens(lexer, stream.ring, arena);
+        lexerEnd = ThreadUsage();
+    });
+
+    // Symbol worker: each fdec's entries go in a table of its own, re-parented to the global table below
+    struct ParsedFunction {
+        vector<pair<string, SymbolEntry>> entries;
+        bool balanced = true; // scope back at the global table after fed (otherwise the next fdec starts elsewhere)
+    };
+    SpscRing<shared_ptr<ASTNode>> parsedFunctions(1 << 8);
+    map<const ASTNode*, ParsedFunction> functions; // symbol worker only until it's joined
+    thread symbolThread([&]() {
+        symbolStart = ThreadUsage();
+        while (shared_ptr<ASTNode> fdec = parsedFunctions.pop()) {
+            auto table = make_shared<SymbolTable>("global");
+            auto scope = table;
+            populateSymbolTable(fdec, scope);
+            ParsedFunction& done = functions[fdec.get()];
+            done.entries.assign(table->table.begin(), table->table.end());
+            done.balanced = scope == table;
+        }
+        symbolEnd = ThreadUsage();
+    });
+
+    // Parser on this thread, its errors held back until the lexer's are in
+    ostringstream parseErrors;
+    ctx.tokenStream = &stream;
+    ctx.functionParsed = [&](const shared_ptr<ASTNode>& fdec) { parsedFunctions.push(fdec); };
+    ctx.errorFile.rdbuf(parseErrors.rdbuf());
+    auto root = syntaxAnalysis(ctx);
+    ctx.errorFile.rdbuf(&ctx.errorLines);
+    ctx.functionParsed = nullptr;
+    ctx.tokenStream = nullptr;
+    if (!stream.started) stream.current = stream.ring.pop();
+    while (stream.current.type != T_EOF) stream.current = stream.ring.pop(); // tokens after the program's end
+    parsedFunctions.push(nullptr);
+    lexerThread.join();
+    symbolThread.join();
+    ctx.stats.addWorker(lexerStart, lexerEnd);
+    ctx.stats.addWorker(symbolStart, symbolEnd);
+
+    ctx.errorFile << lexErrors.str() << parseErrors.str();
+    ctx.line = lexer.line;
+    ctx.constantPool = move(lexer.constantPool);
+    if (ctx.options.timeReport || ctx.options.stats) {
+        ctx.stats.tokens = tokens;
+        ctx.stats.astNodes = countNodes(root);
+    }
+
+    // Global table: the worker's entries in fdec order, then the declarations and statements (an invalid source --> the whole tree again)
+    ctx.stats.start("symtab");
+    auto table = make_shared<SymbolTable>("global");
+    auto scope = table;
+    shared_ptr<ASTNode> program = root->children.empty() ? nullptr : root->children.front();
+    bool merged = program && program->nodeType == "program" && ctx.errorFile.tellp() == 0;
+    for (auto fdecls = merged ? findChild(program, "fdecls") : nullptr; merged && fdecls; fdecls = findChild(fdecls, "fdecls")) {
+        shared_ptr<ASTNode> fdec = findChild(fdecls, "fdec");
+        if (!fdec) break;
+        auto done = functions.find(fdec.get());
+        if (done == functions.end()) populateSymbolTable(fdec, scope);
+        else if (!done->second.balanced || scope != table) merged = false;
+        else {
+            for (auto& entry : done->second.entries) {
+                if (entry.second.childTable) entry.second.childTable->parentTable = table;
+                table->addEntry(entry.first, entry.second);
+            }
+        }
+    }
+    if (merged) {
+        for (auto& child : program->children) {
+            if (child->nodeType != "fdecls") populateSymbolTable(child, scope);
+        }
+        for (auto& child : root->children) {
+            if (child != program) populateSymbolTable(child, scope);
+        }
+        ctx.out << "Done Building symbol Table" << endl;
+        symbolTable = table;
+    }
+    else symbolTable = generateSymbolTable(ctx, root);
+    return root;
+}
+
+// Phases 1-4 on ctx.inputFile --> the optimized program (nullopt if the source is invalid)
+optional<ICGProgram> compileProgram(CompilerContext& ctx) {
+    const CompileOptions& options = ctx.options;
+    bool counting = options.timeReport || options.stats;
+
+    shared_ptr<ASTNode> root;
+    shared_ptr<SymbolTable> symbolTable;
+    if (options.streamFrontEnd) {
+        ctx.stats.start("stream"); // lex, parse and function symbol tables at once
+        root = streamFrontEnd(ctx, symbolTable);
+    }
+    else {
+        // Phase 1: Run lexical parsing
+        ctx.stats.start("lex");
+        lexicalAnalysis(ctx); // Phase 1
+        if (counting) ctx.stats.tokens = ctx.tokenList.size();
+
+        // Phase 2: Run syntax analysis to build AST and then generate symbol table
+        ctx.stats.start("parse");
+        root = syntaxAnalysis(ctx); 
+        if (counting) ctx.stats.astNodes = countNodes(root);
+        ctx.stats.start("symtab");
+        symbolTable = generateSymbolTable(ctx, root);
+    }
+    if (counting) ctx.stats.symbols = countSymbols(*symbolTable);
+
+    // Phase 3: Perform semantic analysis
+    ctx.stats.start("semantic");
+    semanticAnalysis(ctx, root, symbolTable);
 
     // Phase 4: Intermediate Code Gen (only do this if code is semantically correct)
-    bool isEmpty = errorFile.tellp() == 0;
-    if (isEmpty) {
-        ICGFile.open("compile.txt");
-        ICGFile << "B main" << endl;
-        createICG(root, symbolTable);
-    } 
-    else cout << "Source File is invalid" << endl;
+    bool isEmpty = ctx.errorFile.tellp() == 0;
+    if (!isEmpty) {
+        ctx.out << "Source File is invalid" << endl;
+        return nullopt;
+    }
+    ctx.stats.start("icg");
+    ICGProgram program;
+    for (const auto& entry : symbolTable->table) {
+        if (entry.second.type == "K_DEF") program.returnTypes[entry.first] = entry.second.returnType;
+        else if (entry.second.type == "K_INT" || entry.second.type == "K_DOUBLE") program.globals[entry.first] = entry.second.type;
+    }
+    createICG(ctx, root, symbolTable, program);
+    ICG_DECLS(ctx, findChild(root->children.front(), "declarations"), program.globals, program.globalArrays);
+    if (counting) ctx.stats.quads = countQuads(program.functions);
+    if (!options.profileUse.empty()) readProfile(ctx, options.profileUse, program);
+
+    /**
+     * Optimize each function then
+     * - evaluate pure calls with literal args
+     * - inline small helpers (which can expose more literal args) and clean up the callers again
+     * - drop bounds checks loops can't fail
+     * - unroll counted loops and clean up the copies
+     * - lay out blocks from the profile (--profile-use)
+    */
+    ctx.stats.start("optimize");
+    if (options.optimize) {
+        for (auto& fn : program.functions) optimizeICG(ctx, fn, program);
+        if (options.partialEval && evaluatePureCalls(ctx, program)) {
+            for (auto& fn : program.functions) optimizeICG(ctx, fn, program);
+        }
+        if (options.inlineFunctions) inlineFunctions(ctx, program, symbolTable);
+        if (options.partialEval && evaluatePureCalls(ctx, program)) {
+            for (auto& fn : program.functions) optimizeICG(ctx, fn, program);
+        }
+        removeUncalledFunctions(ctx, program, symbolTable);
+        if (options.boundsCheckElimination) {
+            for (auto& fn : program.functions) eliminateBoundsChecks(ctx, fn, program);
+        }
+        if (options.unroll) {
+            for (auto& fn : program.functions) {
+                if (unrollLoops(ctx, fn, program)) optimizeICG(ctx, fn, program);
+            }
+        }
+        if (ctx.profile.loaded) {
+            for (auto& fn : program.functions) layoutBlocks(ctx, fn);
+        }
+    }
+    for (auto& fn : program.functions) computeFrameSize(ctx, fn, program);
+    if (counting) ctx.stats.optimizedQuads = countQuads(program.functions);
+    ctx.stats.stop();
+    return program;
+}
+
+// Phase 5: Register allocation and ARM (or x86-64) code gen --> compile.txt to irFile, x86-64 assembly to assemblyFile (nullptr --> not generated)
+void emitProgram(CompilerContext& ctx, const ICGProgram& program, ostream& irFile, ostream* assemblyFile) {
+    const CompileOptions& options = ctx.options;
+    ctx.stats.start("backend");
+    if (assemblyFile) generateX86(ctx, program, *assemblyFile);
+    if (options.emitTAC) printICG(program, irFile);
+    else if (options.emitBytecode) printBytecode(compileBytecode(ctx, program), irFile);
+    else if (options.target == "arm") generateARM(ctx, program, irFile);
+    ctx.stats.stop();
+}
+
+const size_t vmCallStackBytes = 1024; // native stack per VM call, interpreted or through jitted code
+
+// machine.run() on a thread with room for machine.maxDepth calls --> false on a runtime error
+bool runOnVMStack(CompilerContext& ctx, VirtualMachine& machine) {
+#if defined(__unix__)
+    struct Run {
+        VirtualMachine& machine;
+        bool finished;
+        ThreadUsage start, end; // the worker's, for the run phase
+    } run = {machine, false, {}, {}};
+    auto body = [](void* arg) -> void* {
+        Run& run = *static_cast<Run*>(arg);
+        run.start = ThreadUsage();
+        run.finished = run.machine.run();
+        run.end = ThreadUsage();
+        return nullptr;
+    };
+    pthread_attr_t attributes;
+    pthread_t worker;
+    size_t stackBytes = static_cast<size_t>(max(machine.maxDepth, 0)) * vmCallStackBytes + (1 << 20);
+    bool started = pthread_attr_init(&attributes) == 0;
+    if (started) {
+        started = pthread_attr_setstacksize(&attributes, stackBytes) == 0 && pthread_create(&worker, &attributes, body, &run) == 0;
+        pthread_attr_destroy(&attributes);
+    }
+    if (started) {
+        pthread_join(worker, nullptr);
+        ctx.stats.addWorker(run.start, run.end);
+        return run.finished;
+    }
+#endif
+    // No thread --> what the calling thread's stack can be trusted with
+    machine.maxDepth = min(machine.maxDepth, 10000);
+    return machine.run();
+}
+
+// Phase 6: Run on the bytecode VM (instrumented with --profile-generate), printing to programOutput --> false on a runtime error
+bool runProgram(CompilerContext& ctx, const ICGProgram& program, ostream& programOutput) {
+    const CompileOptions& options = ctx.options;
+    ctx.stats.start("run");
+    VMProgram vm = compileBytecode(ctx, program, !options.profileGenerate.empty());
+    OutputBuffer output(programOutput);
+    VirtualMachine machine(options, vm, output);
+    bool finished = runOnVMStack(ctx, machine);
+    output.flush();
+    if (!finished) ctx.err << "Runtime error: " << machine.error << endl;
+    if (vm.profiling && !writeProfile(vm, program, options.profileGenerate)) ctx.err << "Error writing profile " << options.profileGenerate << endl;
+    ctx.stats.stop();
+    return finished;
+}
+
+// Ends the last phase and prints the report to ctx.out (--time-report) --> its JSON (--stats, otherwise empty)
+string reportStats(CompilerContext& ctx) {
+    ctx.stats.stop();
+    ctx.stats.diagnostics = ctx.errorLines.lines;
+    if (ctx.options.timeReport) printTimeReport(ctx.stats, ctx.out);
+    return ctx.options.stats ? statsJson(ctx.stats) : "";
+}
+
+// Compiles one source file through every phase, outputs go to options.outputDir and messages to out / err --> exit code (1 on any error)
+int compileFile(const string& inputFilePath, const CompileOptions& options, ostream& out, ostream& err) {
+    // Open Files
+    error_code ignored;
+    filesystem::create_directories(options.outputDir, ignored);
+    ifstream inputFile(inputFilePath);
+    ofstream tokenFile(outputPath(options, "tokens.txt"));
+    ofstream errorFile(outputPath(options, "errors.txt"));
 
-    return 0;
-}
\ No newline at end of file
+    if (!inputFile.is_open() || !tokenFile.is_open() || !errorFile.is_open()) {
+        err << "Error opening files" << endl;
+        return 1; // Return a non-zero value to indicate error
+    }
+    CompilerContext ctx(options, languageTables(), inputFile, errorFile, out, err);
+    ctx.tokenFile = &tokenFile;
+
+    optional<ICGProgram> program = compileProgram(ctx);
+    bool failed = !program;
+    if (program) {
+        bool assemble = options.target == "x86-64" || options.link;
+        ofstream assembly;
+        if (assemble) assembly.open(outputPath(options, "compile.s"));
+        ofstream ICGFile(outputPath(options, "compile.txt")); // output file for intermediate code
+        emitProgram(ctx, *program, ICGFile, assemble ? &assembly : nullptr);
+        ICGFile.close();
+        if (assemble) {
+            assembly.close();
+            if (options.link && !linkX86(outputPath(options, "compile.s"), outputPath(options, "compile"))) {
+                err << "Linking compile.s failed" << endl;
+                failed = true;
+            }
+        }
+        if (options.run && !runProgram(ctx, *program, out)) failed = true;
+    }
+    string stats = reportStats(ctx);
+    if (options.stats) ofstream(outputPath(options, "stats.json")) << stats;
+    return failed ? 1 : 0;
+}
+
+/**
+ * Compilation Cache (--cache=DIR)
+ * - Entries are keyed by the XXH64 hash of the compiler version, the options that change what a
+ *   compile writes and digests (length plus two XXH64s) of the --profile-use file and the source;
+ *   an entry holds the exit code, the console output and the tokens.txt, errors.txt, compile.txt
+ *   and compile.s the compile wrote
+ * - A hit writes those back without running any phase; the key is stored too so a collision of
+ *   the entry's name reads as a miss
+ * - Entries are written to a temp file (named by process and thread) then renamed into place, so
+ *   a reader never sees half an entry and processes sharing DIR don't need a lock
+ * - A hit touches the entry's mtime; once a store takes this process's estimate of DIR's size
+ *   (the last scan plus what it stored since) past --cache-size=MB, DIR is scanned and the least
+ *   recently used entries are removed until it fits
+ * - --link and --profile-generate write files an entry can't hold, so they always compile, as do
+ *   --time-report and --stats (a replayed report would time the hit's compile, not this one)
+ * - --cache-stats prints this run's hits, misses and evictions; DIR/stats keeps the totals
+*/
+const char* const compilerVersion = "cp471 " __DATE__ " " __TIME__; // any rebuild invalidates the cache
+
+// XXH64 (xxHash, 64 bit) of [data, data + length)
+uint64_t xxh64(const char* data, size_t length, uint64_t seed = 0) {
+    const uint64_t prime1 = 11400714785074694791ULL, prime2 = 14029467366897019727ULL, prime3 = 1609587929392839161ULL;
+    const uint64_t prime4 = 9650029242287828579ULL, prime5 = 2870177450012600261ULL;
+    auto rotl = [](uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+    auto read64 = [](const char* p) { uint64_t v; memcpy(&v, p, 8); return v; }; // little endian hosts
+    auto read32 = [](const char* p) { uint32_t v; memcpy(&v, p, 4); return static_cast<uint64_t>(v); };
+    auto round = [&](uint64_t acc, uint64_t input) { return rotl(acc + input * prime2, 31) * prime1; };
+    auto merge = [&](uint64_t acc, uint64_t value) { return (acc ^ round(0, value)) * prime1 + prime4; };
+
+    const char* p = data;
+    const char* end = data + length;
+    uint64_t hash;
+    if (length >= 32) {
+        uint64_t v1 = seed + prime1 + prime2, v2 = seed + prime2, v3 = seed, v4 = seed - prime1;
+        for (; p + 32 <= end; p += 32) {
+            v1 = round(v1, read64(p));
+            v2 = round(v2, read64(p + 8));
+            v3 = round(v3, read64(p + 16));
+            v4 = round(v4, read64(p + 24));
+        }
+        hash = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        hash = merge(merge(merge(merge(hash, v1), v2), v3), v4);
+    }
+    else hash = seed + prime5;
+    hash += length;
+    for (; p + 8 <= end; p += 8) hash = rotl(hash ^ round(0, read64(p)), 27) * prime1 + prime4;
+    if (p + 4 <= end) {
+        hash = rotl(hash ^ (read32(p) * prime1), 23) * prime2 + prime3;
+        p += 4;
+    }
+    for (; p < end; p++) hash = rotl(hash ^ (static_cast<unsigned char>(*p) * prime5), 11) * prime1;
+    hash ^= hash >> 33;
+    hash *= prime2;
+    hash ^= hash >> 29;
+    hash *= prime3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+struct CacheStats {
+    atomic<uint64_t> hits{0};
+    atomic<uint64_t> misses{0};
+    atomic<uint64_t> evictions{0};
+};
+
+// Files a compile leaves in options.outputDir that an entry restores
+const char* const cachedFiles[] = {"tokens.txt", "errors.txt", "compile.txt", "compile.s"};
+
+// Whole file --> false if it can't be read
+bool readFile(const string& path, string& text) {
+    ifstream in(path, ios::binary);
+    if (!in) return false;
+    ostringstream contents;
+    contents << in.rdbuf();
+    text = contents.str();
+    return true;
+}
+
+// Length and two XXH64s of bytes --> stands in for them in a key
+string digest(const string& bytes) {
+    char text[64];
+    snprintf(text, sizeof(text), "%zu %016llx%016llx", bytes.size(), static_cast<unsigned long long>(xxh64(bytes.data(), bytes.size())),
+             static_cast<unsigned long long>(xxh64(bytes.data(), bytes.size(), 0x9e3779b97f4a7c15ULL)));
+    return text;
+}
+
+// Unique per process and thread, so concurrent writers never share a temp file
+string tempSuffix() {
+    ostringstream suffix;
+    suffix << ".tmp";
+#if defined(__unix__)
+    suffix << getpid() << '.';
+#else
+    suffix << chrono::steady_clock::now().time_since_epoch().count() << '.';
+#endif
+    suffix << this_thread::get_id();
+    return suffix.str();
+}
+
+// Everything but the source that decides what a compile writes
+string cacheKey(const CompileOptions& options) {
+    ostringstream key;
+    key << compilerVersion << '\n'
+        << options.optimize << options.inlineFunctions << options.inlineReport << options.partialEval << options.boundsCheckElimination
+        << options.registerAllocation << options.allocationReport << options.emitTAC << options.peephole << options.peepholeReport
+        << options.emitBytecode << options.run << options.jit << options.vectorize << options.avx2 << options.vectorizeReport
+        << options.unroll << options.unrollReport << options.parseTree << ' ' << options.inlineBudget << ' ' << options.inlineCallerLimit << ' '
+        << options.evalStepLimit << ' ' << options.evalDepthLimit << ' ' << options.jitThreshold << ' ' << options.maxCallDepth << ' ' << options.unrollFactor << ' '
+        << options.unrollBudget << ' ' << options.target << '\n';
+    string profile;
+    if (!options.profileUse.empty() && readFile(options.profileUse, profile)) key << "profile " << digest(profile) << '\n';
+    return key.str();
+}
+
+// Entry: "name size\n" then size bytes and "\n", per section (key, status, out, err, then the cached files)
+void writeSection(ostream& entry, const string& name, const string& bytes) {
+    entry << name << ' ' << bytes.size() << '\n';
+    entry.write(bytes.data(), static_cast<streamsize>(bytes.size()));
+    entry << '\n';
+}
+
+// --> false if the entry is missing, truncated or for another key
+bool readEntry(const string& path, const string& key, map<string, string>& sections) {
+    ifstream entry(path, ios::binary);
+    string name;
+    size_t size;
+    while (entry >> name >> size) {
+        entry.get();
+        string bytes(size, '\0');
+        if (size > 0 && !entry.read(&bytes[0], static_cast<streamsize>(size))) return false;
+        entry.get();
+        sections[name] = move(bytes);
+    }
+    return entry.eof() && sections.count("key") && sections["key"] == key && sections.count("status");
+}
+
+// Removes the least recently used entries until dir holds at most limit bytes --> bytes left
+uintmax_t evictEntries(const string& dir, uintmax_t limit, CacheStats& stats) {
+    error_code error;
+    vector<pair<filesystem::file_time_type, filesystem::path>> entries;
+    uintmax_t total = 0;
+    for (const auto& file : filesystem::directory_iterator(dir, error)) {
+        if (file.path().extension() != ".entry") continue;
+        uintmax_t size = file.file_size(error);
+        if (error) continue;
+        total += size;
+        entries.push_back({file.last_write_time(error), file.path()});
+    }
+    if (total <= limit) return total;
+    sort(entries.begin(), entries.end());
+    for (const auto& entry : entries) {
+        if (total <= limit) break;
+        uintmax_t size = filesystem::file_size(entry.second, error);
+        if (!error && filesystem::remove(entry.second, error)) {
+            total -= size;
+            stats.evictions++;
+        }
+    }
+    return total;
+}
+
+// compileFile through the cache in options.cacheDir (no cache dir --> plain compileFile)
+int compileCached(const string& inputFilePath, const CompileOptions& options, ostream& out, ostream& err, CacheStats& stats) {
+    string source;
+    if (options.cacheDir.empty() || options.link || !options.profileGenerate.empty() || options.timeReport || options.stats || !readFile(inputFilePath, source)) {
+        return compileFile(inputFilePath, options, out, err);
+    }
+    string key = cacheKey(options) + "source " + digest(source) + '\n';
+    char name[17];
+    snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(xxh64(key.data(), key.size())));
+    filesystem::path entryPath = filesystem::path(options.cacheDir) / (string(name) + ".entry");
+
+    // Hit --> restore the outputs, touch the entry for LRU
+    map<string, string> sections;
+    error_code error;
+    if (readEntry(entryPath.string(), key, sections)) {
+        filesystem::create_directories(options.outputDir, error);
+        for (const char* file : cachedFiles) {
+            if (sections.count(file)) ofstream(outputPath(options, file), ios::binary) << sections[file];
+        }
+        filesystem::last_write_time(entryPath, filesystem::file_time_type::clock::now(), error);
+        stats.hits++;
+        out << sections["out"] << flush;
+        err << sections["err"] << flush;
+        return stoi(sections["status"]);
+    }
+
+    // Miss --> compile with the console captured, then store the entry (temp file + rename)
+    stats.misses++;
+    ostringstream capturedOut, capturedErr;
+    int status = compileFile(inputFilePath, options, capturedOut, capturedErr);
+    out << capturedOut.str() << flush;
+    err << capturedErr.str() << flush;
+
+    filesystem::create_directories(options.cacheDir, error);
+    filesystem::path tempPath = entryPath;
+    tempPath += tempSuffix();
+    uintmax_t entrySize;
+    {
+        ofstream entry(tempPath, ios::binary);
+        writeSection(entry, "key", key);
+        writeSection(entry, "status", to_string(status));
+        writeSection(entry, "out", capturedOut.str());
+        writeSection(entry, "err", capturedErr.str());
+        for (const char* file : cachedFiles) {
+            string contents;
+            if (readFile(outputPath(options, file), contents)) writeSection(entry, file, contents);
+        }
+        if (!entry) {
+            entry.close();
+            filesystem::remove(tempPath, error);
+            return status;
+        }
+        entrySize = static_cast<uintmax_t>(entry.tellp());
+    }
+    filesystem::rename(tempPath, entryPath, error);
+    if (error) {
+        filesystem::remove(tempPath, error);
+        return status;
+    }
+
+    // Scans DIR on this process's first store and whenever the estimate passes the cap
+    static mutex estimateLock;
+    static map<string, uintmax_t> estimates; // cache dir --> bytes at the last scan plus stores since
+    lock_guard<mutex> guard(estimateLock);
+    auto estimate = estimates.find(options.cacheDir);
+    if (estimate == estimates.end() || (estimate->second += entrySize) > options.cacheSize) {
+        estimates[options.cacheDir] = evictEntries(options.cacheDir, options.cacheSize, stats);
+    }
+    return status;
+}
+
+// Adds this run's counts to DIR/stats and prints them with the totals (--cache-stats)
+void reportCacheStats(const CompileOptions& options, const CacheStats& stats) {
+    if (options.cacheDir.empty()) return;
+    filesystem::path statsPath = filesystem::path(options.cacheDir) / "stats";
+    uint64_t hits = 0, misses = 0, evictions = 0;
+    string text;
+    if (readFile(statsPath.string(), text)) {
+        istringstream in(text);
+        string name;
+        uint64_t count;
+        while (in >> name >> count) {
+            if (name == "hits") hits = count;
+            else if (name == "misses") misses = count;
+            else if (name == "evictions") evictions = count;
+        }
+    }
+    hits += stats.hits;
+    misses += stats.misses;
+    evictions += stats.evictions;
+
+    error_code error;
+    filesystem::create_directories(options.cacheDir, error);
+    filesystem::path tempPath = statsPath;
+    tempPath += tempSuffix();
+    ofstream(tempPath) << "hits " << hits << "\nmisses " << misses << "\nevictions " << evictions << "\n";
+    filesystem::rename(tempPath, statsPath, error);
+
+    if (options.cacheStats) {
+        uintmax_t entries = 0, bytes = 0;
+        for (const auto& file : filesystem::directory_iterator(options.cacheDir, error)) {
+            if (file.path().extension() != ".entry") continue;
+            entries++;
+            bytes += file.file_size(error);
+        }
+        cout << "Cache: " << stats.hits << " hits, " << stats.misses << " misses, " << stats.evictions << " evicted ("
+             << hits << " / " << misses << " / " << evictions << " total), " << entries << " entries, " << bytes << " bytes" << endl;
+    }
+}
+
+/**
+ * Library API (define CP471_LIBRARY and #include "compiler.cpp" to embed the compiler without its main)
+ * - compile() runs every phase on source in memory and never touches the filesystem: the parser reads
+ *   the lexer's token list, and what errors.txt, compile.txt, compile.s and the console would get goes
+ *   to the result
+ * - Options that name files are ignored: --link, --profile-generate, --profile-use and -o
+ * - Each call has its own CompilerContext, so threads can compile at once
+*/
+struct CompileResult {
+    bool ok = false; // source is valid and (with options.run) ran to the end
+    vector<string> diagnostics; // lexical, syntax and semantic errors (errors.txt), then runtime errors
+    string ir; // compile.txt: ARM, 3TAC (--emit-tac) or bytecode (--emit-bytecode)
+    string assembly; // compile.s (--target=x86-64)
+    string output; // what the program printed (--run)
+    string log; // parse tree, phase messages and --*-report lines
+    string stats; // stats.json (--stats)
+};
+
+// Reads a string_view in place (no copy into a stringbuf)
+struct ViewBuffer : streambuf {
+    explicit ViewBuffer(string_view text) {
+        char* begin = const_cast<char*>(text.data()); // only ever read
+        setg(begin, begin, begin + text.size());
+    }
+};
+
+// Lines of text (without the trailing empty line)
+void appendLines(const string& text, vector<string>& lines) {
+    istringstream in(text);
+    string line;
+    while (getline(in, line)) lines.push_back(line);
+}
+
+// What a library compile writes instead of files and the console
+struct CompileStreams {
+    ostringstream errors, messages, log, ir, assembly, output;
+};
+
+// Drops the options that name files
+void libraryOptions(CompileOptions& options) {
+    options.link = false;
+    options.profileGenerate.clear();
+    options.profileUse.clear();
+}
+
+// Emits and runs program (nullopt --> the source was invalid), then reads back what ctx wrote
+CompileResult finishCompile(CompilerContext& ctx, const optional<ICGProgram>& program, CompileStreams& streams) {
+    CompileResult result;
+    if (program) emitProgram(ctx, *program, streams.ir, ctx.options.target == "x86-64" ? &streams.assembly : nullptr);
+    result.ok = program && (!ctx.options.run || runProgram(ctx, *program, streams.output));
+    appendLines(streams.errors.str(), result.diagnostics);
+    appendLines(streams.messages.str(), result.diagnostics);
+    result.ir = streams.ir.str();
+    result.assembly = streams.assembly.str();
+    result.output = streams.output.str();
+    result.stats = reportStats(ctx);
+    result.log = streams.log.str();
+    return result;
+}
+
+CompileResult compile(string_view source, CompileOptions options = CompileOptions()) {
+    libraryOptions(options);
+    ViewBuffer buffer(source);
+    istream input(&buffer);
+    CompileStreams streams;
+    CompilerContext ctx(options, languageTables(), input, streams.errors, streams.log, streams.messages);
+    return finishCompile(ctx, compileProgram(ctx), streams);
+}
+
+/**
+ * Incremental Compilation (IncrementalCompiler, or compiler --connect=SOCKET, which keeps one per source file on the server)
+ * - The token list is split into units: each top level def ... fed (with the functions nested in it)
+ *   and the global declarations and statements after the last one
+ * - A unit's fingerprint is the XXH64 of its tokens' types and text (not their lines), so a unit
+ *   whose tokens are unchanged keeps its AST and symbol table entries and only edited units are parsed
+ * - A unit's semantic errors and 3TAC are reused while its fingerprint and the global symbols it names
+ *   (function signatures and global types) are unchanged --> editing a body re-checks and lowers that
+ *   function alone, changing a signature re-checks its callers too
+ * - Each optimizer step runs per function through a memo keyed by the function going in and what the
+ *   step reads: the options and globals, every function reachable from its callees (partial
+ *   evaluation) or its direct callees as already inlined into (inlining) --> only edited functions and
+ *   the functions that depend on them are re-optimized
+ * - Register allocation and code gen still run on the whole program
+ * - The result matches compile()'s except the log, which leaves out the parse tree (it grows with the
+ *   square of the number of functions)
+ * - Lexical or syntax errors, duplicate function names, no global statements and --inline-report /
+ *   --unroll-report (printed from inside the passes) fall back to compile()
+ * - Memo entries the last compile didn't use are dropped, so memory follows the current source
+*/
+struct CompileUnit {
+    shared_ptr<ASTNode> ast; // fdec, or program (with an empty fdecls) for the global declarations and statements
+    vector<pair<string, SymbolEntry>> symbols; // global symbol table entries it declares
+    vector<string> names; // identifiers it uses
+};
+
+struct UnitCode {
+    string errors; // semantic errors
+    bool lowered = false; // functions filled in (only once the whole source is valid)
+    vector<uint64_t> functions; // 3TAC states of its functions, main last for the globals unit
+};
+
+struct FunctionState {
+    shared_ptr<const ICGFunction> fn;
+    set<string> callees;
+    bool localsOnly = false; // touchesOnlyLocals
+};
+
+struct StepResult {
+    uint64_t id; // state after the step
+    bool changed;
+};
+
+// Entries keyed by hash; the ones a compile uses carry over to the next compile, the rest are dropped
+template <typename Value>
+struct Memo {
+    unordered_map<uint64_t, Value> previous, current;
+
+    Value* find(uint64_t key) {
+        auto it = current.find(key);
+        if (it != current.end()) return &it->second;
+        auto old = previous.find(key);
+        if (old == previous.end()) return nullptr;
+        Value& value = current[key] = move(old->second);
+        previous.erase(old);
+        return &value;
+    }
+
+    Value& add(uint64_t key, Value value) { return current[key] = move(value); }
+
+    // After a compile: sweep drops unused entries, keep holds on to them (the compile fell back)
+    void sweep() {
+        previous = move(current);
+        current.clear();
+    }
+
+    void keep() {
+        for (auto& entry : current) previous[entry.first] = move(entry.second);
+        current.clear();
+    }
+};
+
+uint64_t xxh64(const string& text) {
+    return xxh64(text.data(), text.size());
+}
+
+// Strongly connected components of graph (Tarjan), numbered callees first --> component of every name reached
+map<string, int> callGraphComponents(const CallGraph& graph) {
+    map<string, int> component, index, low;
+    vector<string> stack;
+    set<string> onStack;
+    int count = 0;
+    function<void(const string&)> visit = [&](const string& name) {
+        int order = static_cast<int>(index.size());
+        index[name] = low[name] = order;
+        stack.push_back(name);
+        onStack.insert(name);
+        auto it = graph.find(name);
+        if (it != graph.end()) {
+            for (const auto& callee : it->second) {
+                if (!index.count(callee)) {
+                    visit(callee);
+                    low[name] = min(low[name], low[callee]);
+                }
+                else if (onStack.count(callee)) low[name] = min(low[name], index[callee]);
+            }
+        }
+        if (low[name] != index[name]) return;
+        string member;
+        do {
+            member = stack.back();
+            stack.pop_back();
+            onStack.erase(member);
+            component[member] = count;
+        } while (member != name);
+        count++;
+    };
+    for (const auto& entry : graph) {
+        if (!index.count(entry.first)) visit(entry.first);
+    }
+    return component;
+}
+
+struct IncrementalCompiler {
+    mutex busy; // one compile at a time
+    shared_ptr<SymbolTable> symbols = make_shared<SymbolTable>("global"); // refilled each compile, the units' function tables point here
+    Memo<CompileUnit> units; // by fingerprint
+    Memo<UnitCode> code; // by fingerprint + signatures of the names it uses
+    Memo<FunctionState> states; // 3TAC by id
+    Memo<StepResult> steps; // optimizer step key --> result
+
+    CompileResult compile(string_view source, CompileOptions options = CompileOptions()) {
+        lock_guard<mutex> lock(busy);
+        libraryOptions(options);
+        if (options.inlineReport || options.unrollReport) return ::compile(source, options);
+
+        ViewBuffer buffer(source);
+        istream input(&buffer);
+        CompileStreams streams;
+        CompilerContext ctx(options, languageTables(), input, streams.errors, streams.log, streams.messages);
+    
+        ctx.stats.start("lex");
+        lexicalAnalysis(ctx);
+        if (options.timeReport || options.stats) ctx.stats.tokens = ctx.tokenList.size();
+        optional<ICGProgram> program;
+        bool incremental = streams.errors.tellp() == 0 && analyze(ctx, streams, program);
+        if (!incremental || !program) { // an invalid source keeps everything for the fixed one
+            units.keep();
+            code.keep();
+            states.keep();
+            steps.keep();
+            if (!incremental) return ::compile(source, options);
+            return finishCompile(ctx, program, streams);
+        }
+        units.sweep();
+        code.sweep();
+        states.sweep();
+        steps.sweep();
+        return finishCompile(ctx, program, streams);
+    }
+
+    // Phases 2 to 4 unit by unit (program is nullopt if the source is invalid) --> false to fall back to a full compile
+    bool analyze(CompilerContext& ctx, CompileStreams& streams, optional<ICGProgram>& program) {
+        bool counting = ctx.options.timeReport || ctx.options.stats;
+
+        // Units: [first, last) token ranges, each def ... fed without its ";", then the globals up to the end
+        const vector<Token>& tokens = ctx.tokenList;
+        vector<pair<size_t, size_t>> ranges;
+        size_t next = 0;
+        while (next < tokens.size() && tokens[next].type == K_DEF) {
+            int depth = 0;
+            size_t fed = next;
+            for (; fed < tokens.size(); fed++) {
+                if (tokens[fed].type == K_DEF) depth++;
+                else if (tokens[fed].type == K_FED && --depth == 0) break;
+            }
+            if (fed + 1 >= tokens.size() || tokens[fed + 1].type != K_SEMI_COL) return false;
+            ranges.push_back({next, fed + 1});
+            next = fed + 2;
+        }
+        if (next + 1 >= tokens.size()) return false; // no global statements before the closing "."
+        ranges.push_back({next, tokens.size()});
+
+        // Phase 2: parse edited units, then fill the symbol table from every unit's entries
+        ctx.stats.start("parse");
+        vector<CompileUnit*> unitList;
+        vector<uint64_t> fingerprints;
+        string text;
+        for (const auto& range : ranges) {
+            text.clear();
+            for (size_t i = range.first; i < range.second; i++) {
+                text += static_cast<char>(tokens[i].type);
+                text.append(tokens[i].buffer.begin(), tokens[i].buffer.end());
+                text += '\0';
+            }
+            uint64_t fingerprint = xxh64(text);
+            CompileUnit* unit = units.find(fingerprint);
+            if (!unit) {
+                CompileUnit parsed;
+                if (!parseUnit(ctx, range, &range == &ranges.back(), parsed)) return false;
+                unit = &units.add(fingerprint, move(parsed));
+            }
+            unitList.push_back(unit);
+            fingerprints.push_back(fingerprint);
+            if (counting) ctx.stats.astNodes += countNodes(unit->ast);
+        }
+        ctx.out << "Parsing Done" << endl;
+
+        ctx.stats.start("symtab");
+        symbols->table.clear();
+        for (const auto* unit : unitList) {
+            for (const auto& entry : unit->symbols) {
+                if (!symbols->table.emplace(entry.first, entry.second).second) return false; // declared twice
+            }
+        }
+        if (counting) ctx.stats.symbols = countSymbols(*symbols);
+        ctx.out << "Done Building symbol Table" << endl;
+
+        // Phase 3: check units whose fingerprint or used signatures changed
+        ctx.stats.start("semantic");
+        vector<UnitCode*> codeList;
+        vector<uint64_t> unitKeys;
+        for (size_t u = 0; u < unitList.size(); u++) {
+            string key = to_string(fingerprints[u]);
+            for (const auto& name : unitList[u]->names) {
+                auto entry = symbols->table.find(name);
+                key += '\n' + name;
+                if (entry == symbols->table.end()) continue;
+                key += ' ' + entry->second.type + ' ' + entry->second.returnType;
+                for (const auto& param : entry->second.params) key += ' ' + param.first + ' ' + param.second;
+            }
+            uint64_t unitKey = xxh64(key);
+            UnitCode* unitCode = code.find(unitKey);
+            if (!unitCode) {
+                UnitCode checked;
+                streampos start = streams.errors.tellp();
+                ctx.scope = "global";
+                semanticAnalysis(ctx, unitList[u]->ast, symbols);
+                if (streams.errors.tellp() != start) checked.errors = streams.errors.str().substr(start);
+                unitCode = &code.add(unitKey, move(checked));
+            }
+            else ctx.errorFile << unitCode->errors; // counted as diagnostics
+            codeList.push_back(unitCode);
+            unitKeys.push_back(unitKey);
+        }
+        if (streams.errors.tellp() != 0) {
+            ctx.out << "Source File is invalid" << endl;
+            return true;
+        }
+
+        // Phase 4: lower units that weren't lowered before (profile sites aren't numbered: profiles always compile in full)
+        ctx.stats.start("icg");
+        ICGProgram lowered;
+        for (const auto& entry : symbols->table) {
+            if (entry.second.type == "K_DEF") lowered.returnTypes[entry.first] = entry.second.returnType;
+            else if (entry.second.type == "K_INT" || entry.second.type == "K_DOUBLE") lowered.globals[entry.first] = entry.second.type;
+        }
+        vector<uint64_t> ids;
+        for (size_t u = 0; u < unitList.size(); u++) {
+            UnitCode& unitCode = *codeList[u];
+            if (!unitCode.lowered) {
+                lowered.functions.clear();
+                createICG(ctx, unitList[u]->ast, symbols, lowered);
+                string key = "icg " + to_string(unitKeys[u]);
+                for (auto& fn : lowered.functions) {
+                    uint64_t id = xxh64(key + ' ' + to_string(unitCode.functions.size()));
+                    addState(id, move(fn));
+                    unitCode.functions.push_back(id);
+                }
+                unitCode.lowered = true;
+            }
+            for (uint64_t id : unitCode.functions) {
+                states.find(id);
+                ids.push_back(id);
+            }
+        }
+        ICGProgram result;
+        result.globals = move(lowered.globals);
+        result.returnTypes = move(lowered.returnTypes);
+        ICG_DECLS(ctx, findChild(unitList.back()->ast, "declarations"), result.globals, result.globalArrays);
+
+        set<string> names;
+        for (uint64_t id : ids) {
+            if (!names.insert(state(id).fn->name).second) return false; // nested function shares a name
+            if (counting) ctx.stats.quads += state(id).fn->code.size();
+        }
+        ctx.stats.start("optimize");
+        optimize(ctx, result, ids);
+        for (uint64_t id : ids) result.functions.push_back(*state(id).fn);
+        if (counting) ctx.stats.optimizedQuads = countQuads(result.functions);
+        ctx.stats.stop();
+        program = move(result);
+        return true;
+    }
+
+    // Parses tokens [first, last) as an fdec (or the globals' program) --> false on a syntax error
+    bool parseUnit(CompilerContext& ctx, const pair<size_t, size_t>& range, bool isGlobals, CompileUnit& unit) {
+        ctx.nextToken = range.first;
+        ctx.tokenEnd = range.second;
+        parseTokens(ctx);
+        unit.ast = make_shared<ASTNode>(isGlobals ? "program" : "fdec");
+        recursiveDecent(ctx, unit.ast->nodeType, unit.ast, unit.ast);
+        ctx.tokenEnd = SIZE_MAX;
+        if (ctx.errorFile.tellp() != 0 || ctx.tokenType != "$") return false;
+
+        auto table = make_shared<SymbolTable>("global");
+        auto scope = table;
+        populateSymbolTable(unit.ast, scope);
+        for (auto& entry : table->table) {
+            if (entry.second.childTable) entry.second.childTable->parentTable = symbols;
+            unit.symbols.push_back(entry);
+        }
+        set<string> names;
+        for (size_t i = range.first; i < range.second; i++) {
+            if (ctx.tokenList[i].type == T_IDENTIFIER) names.insert(string(ctx.tokenList[i].buffer.begin(), ctx.tokenList[i].buffer.end()));
+        }
+        unit.names.assign(names.begin(), names.end());
+        return true;
+    }
+
+    const FunctionState& state(uint64_t id) {
+        return *states.find(id);
+    }
+
+    void addState(uint64_t id, ICGFunction fn) {
+        FunctionState added;
+        added.localsOnly = touchesOnlyLocals(fn, added.callees);
+        added.fn = make_shared<const ICGFunction>(move(fn));
+        states.add(id, move(added));
+    }
+
+    // Runs pass on a copy of state id unless the memo has key --> id becomes the result, true if the pass changed it
+    bool step(const string& key, uint64_t& id, const function<bool(ICGFunction&)>& pass) {
+        uint64_t hash = xxh64(key);
+        if (StepResult* done = steps.find(hash)) {
+            id = done->id;
+            states.find(id);
+            return done->changed;
+        }
+        ICGFunction fn = *state(id).fn;
+        bool changed = pass(fn);
+        if (changed) addState(hash, move(fn));
+        steps.add(hash, {changed ? hash : id, changed});
+        if (changed) id = hash;
+        return changed;
+    }
+
+    CallGraph callGraph(const vector<uint64_t>& ids) {
+        CallGraph graph;
+        for (uint64_t id : ids) {
+            const FunctionState& s = state(id);
+            graph[s.fn->name].insert(s.callees.begin(), s.callees.end());
+        }
+        return graph;
+    }
+
+    // compileProgram's optimizer sequence on states ids (in program order)
+    void optimize(CompilerContext& ctx, const ICGProgram& program, vector<uint64_t>& ids) {
+        const CompileOptions& options = ctx.options;
+        string key = to_string(options.optimize) + to_string(options.inlineFunctions) + to_string(options.partialEval) + to_string(options.boundsCheckElimination)
+            + to_string(options.unroll) + ' ' + to_string(options.inlineBudget) + ' ' + to_string(options.inlineCallerLimit) + ' ' + to_string(options.evalStepLimit)
+            + ' ' + to_string(options.evalDepthLimit) + ' ' + to_string(options.unrollFactor) + ' ' + to_string(options.unrollBudget);
+        for (const auto& global : program.globals) key += ' ' + global.first + ' ' + global.second;
+        for (const auto& array : program.globalArrays) key += ' ' + array.first + ' ' + to_string(array.second);
+        string p = to_string(xxh64(key)) + ' ';
+
+        auto optimizeAll = [&]() {
+            for (auto& id : ids) step("optimize " + p + to_string(id), id, [&](ICGFunction& fn) { return optimizeICG(ctx, fn, program); });
+        };
+        if (options.optimize) {
+            optimizeAll();
+            if (options.partialEval && evaluateAll(ctx, program, p, ids)) optimizeAll();
+            if (options.inlineFunctions) inlineAll(ctx, program, p, ids);
+            if (options.partialEval && evaluateAll(ctx, program, p, ids)) optimizeAll();
+
+            CallGraph graph = callGraph(ids);
+            set<string> visited;
+            vector<string> order;
+            callGraphOrder(graph, "main", visited, order);
+            vector<uint64_t> reachable;
+            for (uint64_t id : ids) {
+                if (visited.count(state(id).fn->name)) reachable.push_back(id);
+            }
+            ids = move(reachable);
+
+            if (options.boundsCheckElimination) {
+                for (auto& id : ids) step("bce " + p + to_string(id), id, [&](ICGFunction& fn) { return eliminateBoundsChecks(ctx, fn, program); });
+            }
+            if (options.unroll) {
+                for (auto& id : ids) {
+                    step("unroll " + p + to_string(id), id, [&](ICGFunction& fn) {
+                        if (!unrollLoops(ctx, fn, program)) return false;
+                        optimizeICG(ctx, fn, program);
+                        return true;
+                    });
+                }
+            }
+        }
+        for (auto& id : ids) {
+            step("frame " + p + to_string(id), id, [&](ICGFunction& fn) {
+                computeFrameSize(ctx, fn, program);
+                return true;
+            });
+        }
+    }
+
+    // evaluatePureCalls: a call's result depends on every function reachable from the callee, so each callee is keyed by
+    // a hash of those functions' states (a Merkle hash over the call graph's components, callees first)
+    bool evaluateAll(CompilerContext& ctx, const ICGProgram& program, const string& p, vector<uint64_t>& ids) {
+        CallGraph graph = callGraph(ids);
+        map<string, bool> pure;
+        map<string, set<string>> callees;
+        map<string, const ICGFunction*> functions;
+        map<string, uint64_t> stateOf;
+        for (uint64_t id : ids) {
+            const FunctionState& s = state(id);
+            functions[s.fn->name] = s.fn.get();
+            stateOf[s.fn->name] = id;
+            if (s.fn->name == "main") continue;
+            pure[s.fn->name] = s.localsOnly;
+            callees[s.fn->name] = s.callees;
+        }
+        propagateImpurity(pure, callees);
+
+        map<string, int> component = callGraphComponents(graph);
+        vector<vector<string>> members;
+        for (const auto& entry : component) {
+            if (entry.second >= static_cast<int>(members.size())) members.resize(entry.second + 1);
+            members[entry.second].push_back(entry.first);
+        }
+        vector<uint64_t> componentKeys(members.size());
+        for (size_t c = 0; c < members.size(); c++) {
+            string key;
+            set<uint64_t> reached;
+            for (const auto& name : members[c]) {
+                auto id = stateOf.find(name);
+                key += name + ' ' + (id != stateOf.end() ? to_string(id->second) : "-") + '\n';
+                auto calls = graph.find(name);
+                if (calls == graph.end()) continue;
+                for (const auto& callee : calls->second) {
+                    int other = component.at(callee);
+                    if (other != static_cast<int>(c)) reached.insert(componentKeys[other]);
+                }
+            }
+            for (uint64_t reachedKey : reached) key += to_string(reachedKey) + '\n';
+            componentKeys[c] = xxh64(key);
+        }
+
+        PartialEvaluator evaluator(ctx, program, pure, functions);
+        vector<uint64_t> evaluated = ids;
+        bool changed = false;
+        for (auto& id : evaluated) {
+            string key = "evaluate " + p + to_string(id);
+            for (const auto& callee : state(id).callees) key += ' ' + callee + ' ' + to_string(componentKeys[component.at(callee)]);
+            changed = step(key, id, [&](ICGFunction& fn) { return ::evaluateCalls(ctx, fn, program, evaluator); }) || changed;
+        }
+        ids = move(evaluated);
+        return changed;
+    }
+
+    // inlineFunctions: callers after their callees, each keyed by its callees' states once they were inlined into
+    void inlineAll(CompilerContext& ctx, const ICGProgram& program, const string& p, vector<uint64_t>& ids) {
+        CallGraph graph = callGraph(ids);
+        map<string, int> component = callGraphComponents(graph);
+        map<int, int> componentSize;
+        for (const auto& entry : component) componentSize[entry.second]++;
+        set<string> visited;
+        vector<string> order;
+        callGraphOrder(graph, "main", visited, order);
+        map<string, size_t> position;
+        for (size_t i = 0; i < ids.size(); i++) position.emplace(state(ids[i]).fn->name, i);
+
+        for (const auto& callerName : order) {
+            auto at = position.find(callerName);
+            if (at == position.end()) continue;
+            uint64_t& id = ids[at->second];
+            string key = "inline " + p + to_string(id);
+            for (const auto& callee : state(id).callees) {
+                auto calleeAt = position.find(callee);
+                auto calls = graph.find(callee);
+                bool recursive = componentSize[component.at(callee)] > 1 || (calls != graph.end() && calls->second.count(callee));
+                key += ' ' + callee + ' ';
+                if (callee == callerName) key += "self";
+                else if (calleeAt == position.end()) key += "-";
+                else if (recursive) key += "recursive";
+                else key += to_string(ids[calleeAt->second]);
+            }
+            step(key, id, [&](ICGFunction& caller) {
+                auto find = [&](const string& name) -> const ICGFunction* {
+                    if (name == caller.name) return &caller;
+                    auto calleeAt = position.find(name);
+                    return calleeAt != position.end() ? state(ids[calleeAt->second]).fn.get() : nullptr;
+                };
+                return ::inlineCalls(ctx, caller, program, graph, 0, find);
+            });
+        }
+    }
+};
+
+/**
+ * Compile Server (compiler --serve=SOCKET, then compiler --connect=SOCKET [flags] FILE)
+ * - The server loads the language tables once, then answers compile requests on a Unix domain
+ *   socket with a thread per connection, at most 8 (maxConnections) at once; requests run in
+ *   memory, so nothing touches the disk
+ * - A socket left at SOCKET by an earlier server is replaced; any other file there is left alone
+ *   and the server refuses to start
+ * - Frames are a 4 byte little endian length followed by that many bytes (at most 256 MB, read as
+ *   they arrive)
+ * - Request: a frame of flags (one per line) and a frame with the source; a connection can send any
+ *   number of requests
+ * - A --unit=NAME flag line (the client sends its source's absolute path) compiles through that
+ *   unit's IncrementalCompiler, so recompiling an edited file only redoes the edited functions;
+ *   the server keeps the 32 (maxUnits) most recently used units, an evicted one compiles in full
+ *   on its next request
+ * - Response: a frame with "ok" or "failed", then frames with the diagnostics (one per line), IR,
+ *   assembly, program output, log and stats JSON (empty without --stats)
+ * - The client sends one request and writes the result like a local compile: compile.txt, compile.s
+ *   and stats.json in -o DIR, program output and log on stdout, diagnostics on stderr
+*/
+#if defined(__unix__)
+const uint32_t maxFrameSize = 1u << 28;
+const int maxConnections = 8; // served at once, later ones wait in the listen backlog
+
+bool writeAll(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t written = send(fd, data, size, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+bool readAll(int fd, char* data, size_t size) {
+    while (size > 0) {
+        ssize_t got = recv(fd, data, size, 0);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;
+        data += got;
+        size -= static_cast<size_t>(got);
+    }
+    return true;
+}
+
+bool sendFrame(int fd, const string& payload) {
+    uint32_t size = static_cast<uint32_t>(payload.size());
+    unsigned char header[4] = {static_cast<unsigned char>(size), static_cast<unsigned char>(size >> 8), static_cast<unsigned char>(size >> 16), static_cast<unsigned char>(size >> 24)};
+    return writeAll(fd, reinterpret_cast<const char*>(header), 4) && writeAll(fd, payload.data(), payload.size());
+}
+
+// --> false on end of stream, a short read or a frame over maxFrameSize
+bool receiveFrame(int fd, string& payload) {
+    unsigned char header[4];
+    if (!readAll(fd, reinterpret_cast<char*>(header), 4)) return false;
+    uint32_t size = header[0] | (header[1] << 8) | (header[2] << 16) | (static_cast<uint32_t>(header[3]) << 24);
+    if (size > maxFrameSize) return false;
+
+    // Grows as the bytes arrive, so a header alone can't make the server allocate maxFrameSize
+    payload.clear();
+    const size_t chunk = 1 << 20;
+    while (payload.size() < size) {
+        size_t start = payload.size();
+        payload.resize(start + min<size_t>(chunk, size - start));
+        if (!readAll(fd, &payload[start], payload.size() - start)) return false;
+    }
+    return true;
+}
+
+string joinLines(const vector<string>& lines) {
+    string text;
+    for (const auto& line : lines) text += line + "\n";
+    return text;
+}
+
+// Unix socket address for path --> false if the path doesn't fit
+bool socketAddress(const string& path, sockaddr_un& address) {
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) return false;
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+const size_t maxUnits = 32; // incremental compilers the server keeps
+
+// The server's incremental compiler for a --unit= name (past maxUnits the least recently used one is dropped;
+// a request still running on it keeps it alive until it's done)
+shared_ptr<IncrementalCompiler> unitCompiler(const string& unit) {
+    static mutex lock;
+    static map<string, pair<shared_ptr<IncrementalCompiler>, uint64_t>> units; // unit --> compiler, last use
+    static uint64_t uses = 0;
+    lock_guard<mutex> guard(lock);
+    auto& entry = units[unit];
+    if (!entry.first) entry.first = make_shared<IncrementalCompiler>();
+    entry.second = ++uses;
+    shared_ptr<IncrementalCompiler> compiler = entry.first;
+    if (units.size() > maxUnits) {
+        auto oldest = units.begin();
+        for (auto it = units.begin(); it != units.end(); it++) {
+            if (it->second.second < oldest->second.second) oldest = it;
+        }
+        units.erase(oldest);
+    }
+    return compiler;
+}
+
+// Answers requests on one connection until the client closes it
+void serveConnection(int fd) {
+    string flags, source;
+    while (receiveFrame(fd, flags) && receiveFrame(fd, source)) {
+        CompileOptions options;
+        vector<string> unknown;
+        string unit;
+        istringstream lines(flags);
+        string flag;
+        while (getline(lines, flag)) {
+            if (flag.rfind("--unit=", 0) == 0) unit = flag.substr(7);
+            else if (!flag.empty() && !applyFlag(flag, options)) unknown.push_back("Unknown option " + flag);
+        }
+        CompileResult result;
+        if (!unknown.empty()) result.diagnostics = unknown;
+        else if (!unit.empty()) result = unitCompiler(unit)->compile(source, options);
+        else result = compile(source, options);
+        bool sent = sendFrame(fd, result.ok ? "ok" : "failed") && sendFrame(fd, joinLines(result.diagnostics)) && sendFrame(fd, result.ir)
+            && sendFrame(fd, result.assembly) && sendFrame(fd, result.output) && sendFrame(fd, result.log) && sendFrame(fd, result.stats);
+        if (!sent) break;
+    }
+    close(fd);
+}
+
+int serveCompiler(const string& path) {
+    sockaddr_un address;
+    if (!socketAddress(path, address)) {
+        cerr << "Socket path too long " << path << endl;
+        return 1;
+    }
+    // Only a socket left over from a previous server is removed, never another file
+    struct stat existing;
+    if (lstat(path.c_str(), &existing) == 0) {
+        if (!S_ISSOCK(existing.st_mode)) {
+            cerr << "Refusing to serve on " << path << ": it exists and isn't a socket" << endl;
+            return 1;
+        }
+        unlink(path.c_str());
+    }
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0 || bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, 64) != 0) {
+        cerr << "Error listening on " << path << ": " << strerror(errno) << endl;
+        return 1;
+    }
+    cout << "Serving on " << path << endl;
+
+    // Threads for at most maxConnections connections at once
+    static mutex lock;
+    static condition_variable slotFree;
+    static int active = 0;
+    while (true) {
+        {
+            unique_lock<mutex> guard(lock);
+            slotFree.wait(guard, []() { return active < maxConnections; });
+        }
+        int fd = accept(listener, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            cerr << "Error accepting on " << path << ": " << strerror(errno) << endl;
+            return 1;
+        }
+        {
+            lock_guard<mutex> guard(lock);
+            active++;
+        }
+        thread([fd]() {
+            serveConnection(fd);
+            lock_guard<mutex> guard(lock);
+            active--;
+            slotFree.notify_one();
+        }).detach();
+    }
+}
+
+int connectCompiler(const string& path, const vector<string>& flags, const string& inputFilePath, const CompileOptions& options) {
+    ifstream inputFile(inputFilePath, ios::binary);
+    if (!inputFile.is_open()) {
+        cerr << "Error opening files" << endl;
+        return 1;
+    }
+    ostringstream source;
+    source << inputFile.rdbuf();
+
+    sockaddr_un address;
+    int fd = socketAddress(path, address) ? socket(AF_UNIX, SOCK_STREAM, 0) : -1;
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        cerr << "Error connecting to " << path << endl;
+        if (fd >= 0) close(fd);
+        return 1;
+    }
+    vector<string> request = flags;
+    error_code ignored;
+    request.push_back("--unit=" + filesystem::absolute(inputFilePath, ignored).string());
+    string status, diagnostics, ir, assembly, output, log, stats;
+    bool answered = sendFrame(fd, joinLines(request)) && sendFrame(fd, source.str()) && receiveFrame(fd, status) && receiveFrame(fd, diagnostics)
+        && receiveFrame(fd, ir) && receiveFrame(fd, assembly) && receiveFrame(fd, output) && receiveFrame(fd, log) && receiveFrame(fd, stats);
+    close(fd);
+    if (!answered) {
+        cerr << "No answer from " << path << endl;
+        return 1;
+    }
+
+    filesystem::create_directories(options.outputDir, ignored);
+    if (!ir.empty()) ofstream(outputPath(options, "compile.txt")) << ir;
+    if (!assembly.empty()) ofstream(outputPath(options, "compile.s")) << assembly;
+    if (!stats.empty()) ofstream(outputPath(options, "stats.json")) << stats;
+    cout << log << output << flush;
+    cerr << diagnostics;
+    return status == "ok" ? 0 : 1;
+}
+#else
+int serveCompiler(const string& path) {
+    cerr << "--serve needs Unix domain sockets" << endl;
+    return 1;
+}
+
+int connectCompiler(const string& path, const vector<string>& flags, const string& inputFilePath, const CompileOptions& options) {
+    cerr << "--connect needs Unix domain sockets" << endl;
+    return 1;
+}
+#endif
+
+/**
+ * Batch Compilation (compiler [flags] [-o DIR] [-j N] PATH...)
+ * - PATHs are source files or directories (searched recursively for .cp files)
+ * - A single file compiles in this process with its outputs in DIR (default: the current directory)
+ * - Otherwise each file gets DIR/<name>/ for its tokens.txt, errors.txt, compile.txt, etc. and a
+ *   stdout.txt with what the compiler printed (repeated names get the first free <name>_N)
+ * - Files compile in this process on a work-stealing pool of N threads (default: hardware
+ *   threads), each in its own CompilerContext: a worker takes files from the back of its own
+ *   deque and steals from the front of the others'
+ * - Exit code is 1 if any file failed
+*/
+
+// Source files under paths (directories sorted so batch output is stable) --> false if a path doesn't exist
+bool collectSources(const vector<string>& paths, vector<string>& files) {
+    for (const auto& path : paths) {
+        error_code error;
+        if (filesystem::is_directory(path, error)) {
+            vector<string> found;
+            for (const auto& entry : filesystem::recursive_directory_iterator(path, error)) {
+                if (entry.is_regular_file() && entry.path().extension() == ".cp") found.push_back(entry.path().string());
+            }
+            sort(found.begin(), found.end());
+            files.insert(files.end(), found.begin(), found.end());
+        }
+        else if (filesystem::exists(path, error)) files.push_back(path);
+        else {
+            cerr << "No such file or directory " << path << endl;
+            return false;
+        }
+    }
+    if (files.empty()) cerr << "No .cp files found" << endl;
+    return !files.empty();
+}
+
+// Runs job(0) to job(count - 1) on workers threads, each with its own deque of job indexes
+void runWorkStealing(size_t count, int workers, const function<void(size_t)>& job) {
+    struct Queue {
+        mutex lock;
+        deque<size_t> jobs;
+    };
+    vector<Queue> queues(workers);
+    for (size_t i = 0; i < count; i++) queues[i % workers].jobs.push_back(i);
+
+    // Own deque from the back, then steal from the front of the next ones (no jobs are added, so all empty --> done)
+    auto take = [&queues, workers](int worker, size_t& index) {
+        for (int k = 0; k < workers; k++) {
+            Queue& queue = queues[(worker + k) % workers];
+            lock_guard<mutex> guard(queue.lock);
+            if (queue.jobs.empty()) continue;
+            if (k == 0) {
+                index = queue.jobs.back();
+                queue.jobs.pop_back();
+            }
+            else {
+                index = queue.jobs.front();
+                queue.jobs.pop_front();
+            }
+            return true;
+        }
+        return false;
+    };
+    vector<thread> threads;
+    for (int worker = 0; worker < workers; worker++) {
+        threads.emplace_back([&take, &job, worker]() {
+            size_t index;
+            while (take(worker, index)) job(index);
+        });
+    }
+    for (auto& worker : threads) worker.join();
+}
+
+int compileBatch(const CompileOptions& options, const vector<string>& files, CacheStats& cacheStats) {
+    // DIR/<name> per file (name_2, name_3, ... if names repeat, skipping names another file already has)
+    vector<string> directories;
+    set<string> taken;
+    for (const auto& file : files) taken.insert(filesystem::path(file).stem().string());
+    set<string> used;
+    for (const auto& file : files) {
+        string stem = filesystem::path(file).stem().string(), name = stem;
+        for (int suffix = 2; used.count(name) || (name != stem && taken.count(name)); suffix++) name = stem + "_" + to_string(suffix);
+        used.insert(name);
+        directories.push_back((filesystem::path(options.outputDir) / name).string());
+        error_code ignored;
+        filesystem::create_directories(directories.back(), ignored);
+    }
+
+    int workers = options.jobs > 0 ? options.jobs : max(1u, thread::hardware_concurrency());
+    workers = static_cast<int>(min<size_t>(workers, files.size()));
+    atomic<int> failures{0};
+    mutex printing;
+    runWorkStealing(files.size(), workers, [&](size_t i) {
+        CompileOptions job = options;
+        job.outputDir = directories[i];
+        ofstream log((filesystem::path(directories[i]) / "stdout.txt").string());
+        int status = compileCached(files[i], job, log, log, cacheStats);
+        if (status != 0) failures++;
+        lock_guard<mutex> guard(printing);
+        if (status == 0) cout << "ok     " << files[i] << endl;
+        else cout << "FAILED " << files[i] << " (see " << directories[i] << ")" << endl;
+    });
+    cout << files.size() << " files, " << failures << " failed" << endl;
+    return failures ? 1 : 0;
+}
+
+#ifndef CP471_LIBRARY
+int main(int argc, char* argv[]) {
+
+    // Optimization flags, -o / -j, --serve / --connect and the paths to compile
+    CompileOptions options;
+    vector<string> paths, flags; // flags --> sent to the server with --connect
+    string serveSocket, connectSocket;
+    for (int i = 1; i < argc; i++) {
+        string flag = argv[i];
+        if ((flag == "-o" || flag == "-j") && i + 1 == argc) {
+            cerr << "Missing value for " << flag << endl;
+            return 1;
+        }
+        if (flag == "-o") {
+            options.outputDir = argv[++i];
+            continue;
+        }
+        if (flag == "-j") flag += argv[++i]; // -j N --> -jN, checked by applyFlag
+        if (flag[0] != '-') {
+            paths.push_back(flag);
+            continue;
+        }
+        if (flag.rfind("--serve=", 0) == 0) {
+            serveSocket = flag.substr(8);
+            continue;
+        }
+        if (flag.rfind("--connect=", 0) == 0) {
+            connectSocket = flag.substr(10);
+            continue;
+        }
+        flags.push_back(flag);
+        if (!applyFlag(flag, options)) {
+            cerr << "Unknown option " << flag << endl;
+            return 1;
+        }
+    }
+
+    // The server compiles the client's files
+    if (!connectSocket.empty()) {
+        if (paths.size() != 1) {
+            cerr << "--connect compiles exactly one file" << endl;
+            return 1;
+        }
+        return connectCompiler(connectSocket, flags, paths.front(), options);
+    }
+
+    // Generate keywords, transition table and LL1 sparse map:
+    languageTables();
+    if (!serveSocket.empty()) return serveCompiler(serveSocket);
+
+    // No paths --> ask for a name in "test cases"
+    CacheStats cacheStats;
+    int status;
+    if (paths.empty()) {
+        string inputFilePath;
+        cout << "Enter Path of file to compile: ";
+        cin >> inputFilePath;
+        status = compileCached("test cases/" + inputFilePath + ".cp", options, cout, cerr, cacheStats);
+    }
+    else {
+        vector<string> files;
+        if (!collectSources(paths, files)) return 1;
+        if (files.size() == 1) status = compileCached(files.front(), options, cout, cerr, cacheStats);
+        else status = compileBatch(options, files, cacheStats);
+    }
+    reportCacheStats(options, cacheStats);
+    return status;
+}
+#endif
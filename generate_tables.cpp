@@ -0,0 +1,81 @@
+/**
+ * Language Table Generator
+ * - Reads table.txt (state, input, next state per line) and keywords.txt (one keyword per line) and
+ *   writes them to language_tables.h as constexpr data, so the compiler starts without reading
+ *   or parsing either file and works from any directory
+ * - Run from the repo root after editing either file (the "generate language tables" build task
+ *   does this before every build):
+ *     g++ -std=c++17 -o generate_tables generate_tables.cpp && ./generate_tables
+*/
+
+/* Imports */
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <array>
+using namespace std;
+
+// C++ string literal for text
+string quote(const string& text) {
+    string literal = "\"";
+    for (char ch : text) {
+        if (ch == '"' || ch == '\\') literal += '\\';
+        literal += ch;
+    }
+    return literal + "\"";
+}
+
+int main(int argc, char* argv[]) {
+    string tablePath = argc > 1 ? argv[1] : "table.txt";
+    string keywordsPath = argc > 2 ? argv[2] : "keywords.txt";
+    string outputPath = argc > 3 ? argv[3] : "language_tables.h";
+
+    ifstream tableFile(tablePath);
+    ifstream keywordsFile(keywordsPath);
+    if (!tableFile || !keywordsFile) {
+        cerr << "Error opening " << (!tableFile ? tablePath : keywordsPath) << endl;
+        return 1;
+    }
+
+    // Transitions --> same bounds as the compiler's 30 states x 127 inputs table
+    vector<array<int, 3>> transitions;
+    int state, input, next_state;
+    char comma;
+    while (tableFile >> state >> comma >> input >> comma >> next_state) {
+        if (state < 0 || state >= 30 || input < 0 || input >= 127) {
+            cerr << tablePath << ": transition " << state << ", " << input << " is outside the 30 x 127 table" << endl;
+            return 1;
+        }
+        transitions.push_back({state, input, next_state});
+    }
+    if (!tableFile.eof()) {
+        cerr << tablePath << ": expected \"state, input, next state\" after " << transitions.size() << " transitions" << endl;
+        return 1;
+    }
+
+    vector<string> keywords;
+    string keyword;
+    while (getline(keywordsFile, keyword)) {
+        if (!keyword.empty() && keyword.back() == '\r') keyword.pop_back();
+        keywords.push_back(keyword);
+    }
+
+    ofstream out(outputPath);
+    if (!out) {
+        cerr << "Error opening " << outputPath << endl;
+        return 1;
+    }
+    out << "// Generated by generate_tables.cpp from " << tablePath << " and " << keywordsPath << " --> do not edit\n";
+    out << "#pragma once\n\n";
+    out << "// Transition table for automaton machine: {state, input, next state}\n";
+    out << "constexpr int transitionList[][3] = {\n";
+    for (const auto& t : transitions) out << "    {" << t[0] << ", " << t[1] << ", " << t[2] << "},\n";
+    out << "};\n\n";
+    out << "// Reserved words and symbols (eg. for, do, while, etc...)\n";
+    out << "constexpr const char* keywordList[] = {\n";
+    for (const auto& k : keywords) out << "    " << quote(k) << ",\n";
+    out << "};\n";
+    cout << "Wrote " << transitions.size() << " transitions and " << keywords.size() << " keywords to " << outputPath << endl;
+    return 0;
+}
@@ -0,0 +1,73 @@
+// Generated by generate_tables.cpp from table.txt and keywords.txt --> do not edit
+#pragma once
+
+// Transition table for automaton machine: {state, input, next state}
+constexpr int transitionList[][3] = {
+    {0, 50, 51},
+    {0, 60, 1},
+    {1, 61, 2},
+    {1, 62, 3},
+    {1, 50, 4},
+    {0, 61, 5},
+    {5, 61, 9},
+    {5, 50, 11},
+    {0, 62, 6},
+    {6, 61, 7},
+    {6, 50, 8},
+    {0, 48, 13},
+    {13, 48, 13},
+    {13, 50, 100},
+    {13, 46, 14},
+    {14, 48, 15},
+    {15, 48, 15},
+    {15, 50, 100},
+    {15, 101, 16},
+    {16, 43, 17},
+    {16, 45, 17},
+    {16, 48, 18},
+    {17, 48, 18},
+    {18, 48, 18},
+    {18, 50, 100},
+    {0, 97, 10},
+    {10, 97, 10},
+    {10, 32, 100},
+    {10, 10, 100},
+};
+
+// Reserved words and symbols (eg. for, do, while, etc...)
+constexpr const char* keywordList[] = {
+    "def",
+    "(",
+    ")",
+    "[",
+    "]",
+    "int",
+    "double",
+    "if",
+    "then",
+    "fed",
+    "fi",
+    "else",
+    "while",
+    "print",
+    "return",
+    "%",
+    "/",
+    "or",
+    "od",
+    "and",
+    "not",
+    "do",
+    "=",
+    "<",
+    ">",
+    "==",
+    "<=",
+    ">=",
+    "<>",
+    "*",
+    "-",
+    ".",
+    "+",
+    ";",
+};
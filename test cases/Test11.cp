@@ -0,0 +1,19 @@
+def int sq(int x)
+	return (x*x)
+fed;
+def int sumsq(int a, int b)
+	return (sq(a) + sq(b))
+fed;
+def double half(double d)
+	return (d / 2.0)
+fed;
+int x,i;
+double h;
+x=0;i=1;
+while(i<10) do
+	x = x + sumsq(i, 2); i=i+1
+od;
+h = half(3.0);
+print(x);
+print(h);
+print(sq(3)).
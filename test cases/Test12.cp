@@ -0,0 +1,52 @@
+int g, n;
+int a[10];
+double h;
+def double avg(double m, double t)
+    double x;
+    x = 0.5;
+    while 1 < 2 do x = x * 1.5; t = t + x; return t / m od;
+    return t
+fed;
+def double dd(double qa, double qb, double qc, double qd, double qe, double qf, double qg, double qh, double qi, double qj)
+    return (qa - qb + qc * qd - qe + qf - qg + qh - qi / qj)
+fed;
+def int many(int qa, int qb, int qc, int qd, int qe, int qf, int qg, int qh, int qi)
+    return (qa - qb + qc * qd - qe + qf - qg + qh - qi)
+fed;
+def int sum(int m)
+    int i, t;
+    int b[5];
+    i = 0; t = 0;
+    while i < m do b[i] = a[i] * 2; t = t + b[i]; i = i + 1 od;
+    return t
+fed;
+def int bump(int k)
+    g = g + k;
+    return g
+fed;
+def int fib(int k)
+    if k < 2 then return (k) fi;
+    return (fib(k-1) + fib(k-2))
+fed;
+n = 0;
+while n < 10 do a[n] = n * n; n = n + 1 od;
+print a[3] + a[9];
+print sum(5);
+print avg(4.0, 1.0);
+print many(1, 2, 3, 4, 5, 6, 7, 8, 9);
+print many(n, 2, n, 4, n, 6, n, 8, n);
+print dd(1.5, 2.0, 3.0, 4.0, 5.0, 6.0, 7.0, 8.0, 9.0, 3.0);
+h = 1.0E-10;
+print h;
+h = h * 3.0;
+print h;
+print 0.1 + 0.2;
+g = 1;
+print bump(3);
+print g;
+print fib(20);
+print 7 % 3;
+print 0 - 7 / 2;
+print (0 - 7) % 3;
+print a[n - 1];
+print a[n].
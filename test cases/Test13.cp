@@ -0,0 +1,15 @@
+int x, i, k;
+double d, e;
+int a[100];
+x = 0; i = 0; d = 0.0; e = 0.5;
+while i < 3000000 do
+    k = i % 100;
+    a[k] = a[k] + i;
+    x = x + a[k] / 7;
+    d = d + e;
+    i = i + 1
+od;
+print x;
+print d;
+print 5.5 % 2.0;
+print 1 / (x - x).
@@ -0,0 +1,14 @@
+def int classify(int n)
+    int r;
+    if n % 7 == 0 then r = 1 else r = n % 3 fi;
+    return r
+fed;
+int i, s;
+i = 0;
+s = 0;
+while i < 1000 do
+    s = s + classify(i);
+    if i > 997 then print(s) fi;
+    i = i + 1
+od;
+print(s).
@@ -0,0 +1,33 @@
+def int total(int n)
+    int a[50], i, s;
+    i = 0;
+    while i < n do
+        a[i] = i * 2;
+        i = i + 1
+    od;
+    i = 1;
+    s = 0;
+    while i <= n do
+        s = s + a[i - 1];
+        i = i + 1
+    od;
+    return s
+fed;
+int j, k, b[10], c[10];
+j = 9;
+while j >= 0 do
+    b[j] = j;
+    c[j % 3] = j;
+    j = j - 1
+od;
+print(b[9]);
+print(c[2]);
+k = 0;
+while k < 20 do
+    b[k % 10] = b[k % 10] + k;
+    k = k + 1
+od;
+print(b[3]);
+print(total(50));
+print(total(10));
+print(total(51)).
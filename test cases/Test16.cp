@@ -0,0 +1,18 @@
+def int grid(int n, int m)
+    int g[100], r, c, s;
+    r = 0;
+    s = 0;
+    while r < n do
+        c = 0;
+        while c < m do
+            g[r * 10 + c] = r + c;
+            s = s + g[c];
+            c = c + 1
+        od;
+        r = r + 1
+    od;
+    return s
+fed;
+print(grid(10, 10));
+print(grid(3, 4));
+print(grid(2, 12)).
@@ -0,0 +1,37 @@
+double a[1003], b[1003], c[1003];
+int p[1003], q[1003];
+int i, r, n;
+double s, h;
+i = 0;
+while i < 1003 do
+    a[i] = 0.5;
+    b[i] = 1.25;
+    c[i] = 2.0;
+    p[i] = i;
+    q[i] = 3;
+    i = i + 1
+od;
+h = 0.75;
+r = 0;
+while r < 1000 do
+    i = 0;
+    while i < 1003 do
+        a[i] = b[i] * c[i] + a[i] * h - 1.0;
+        i = i + 1
+    od;
+    i = 0;
+    while i < 1001 do
+        p[i] = p[i] + q[i] - 1;
+        i = i + 1
+    od;
+    r = r + 1
+od;
+s = 0.0;
+i = 0;
+while i < 1003 do
+    s = s + a[i];
+    i = i + 1
+od;
+print s;
+print p[1000];
+print a[7].
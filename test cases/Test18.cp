@@ -0,0 +1,44 @@
+def int fall(int n, int m)
+    int s, i;
+    s = 0;
+    i = n;
+    while i > m do
+        if i % 2 == 0 then s = s + i else s = s - 1 fi;
+        i = i - 1
+    od;
+    return s
+fed;
+def int stride(int n)
+    int s, i;
+    s = 0;
+    i = 0;
+    while i <= n do
+        s = s + i * i;
+        i = i + 3
+    od;
+    return s + i
+fed;
+def double mix(int n)
+    double d;
+    int i;
+    d = 1.0;
+    i = 0;
+    while i < n do
+        d = d * 1.5 + d * 1.5;
+        i = i + 1
+    od;
+    return d
+fed;
+int k, j;
+k = 0;
+j = 7;
+while j >= 0 do k = k * 2 + j; j = j - 2 od;
+print k;
+print fall(100, 3);
+print fall(2, 5);
+print fall(7, 0);
+print stride(0);
+print stride(10);
+print stride(1000);
+print mix(7);
+print mix(2).
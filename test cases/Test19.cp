@@ -0,0 +1,8 @@
+def int deep(int n)
+    if n < 1 then return 0 else return deep(n - 1) + 1 fi
+fed;
+def double halves(int n)
+    if n < 1 then return 0.0 else return halves(n - 1) + 0.5 fi
+fed;
+print(deep(100000));
+print(halves(50001)).
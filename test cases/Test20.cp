@@ -0,0 +1,3 @@
+double d;
+d = 2.5;
+print 1.5.
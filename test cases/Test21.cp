@@ -0,0 +1,4 @@
+int r, b[0];
+r = 99999999999;
+r = 2147483647;
+print r.
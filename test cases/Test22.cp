@@ -0,0 +1,15 @@
+def int f(int x)
+    int y;
+    y = y + x;
+    return y
+fed;
+def double g(int k)
+    double z, c[3];
+    c[k] = c[k] + 1.5;
+    z = z + c[k];
+    return z
+fed;
+int i, s;
+double h;
+i = 0;
+while i < 4 do s = f(i); print s; h = g(i % 3); print h; i = i + 1 od.
@@ -0,0 +1,14 @@
+def int walk(int n)
+    int y, a[4];
+    y = y + a[n % 4] + n;
+    a[n % 4] = y;
+    if n < 1 then return y else return walk(n - 1) + y fi
+fed;
+def double half(int n)
+    double d, b[2];
+    d = d + b[n % 2] + 0.5;
+    b[n % 2] = d;
+    if n < 1 then return d else return half(n - 1) + d fi
+fed;
+print(walk(5));
+print(half(3)).
@@ -0,0 +1,2 @@
+int r;
+r = 1; print r; r = 5.
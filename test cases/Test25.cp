@@ -0,0 +1,3 @@
+int r;
+r = 1;
+print r + 1.
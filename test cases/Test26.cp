@@ -0,0 +1,3 @@
+int r;
+r = 1;
+while r < 3 do r = r + 1; print od.
@@ -0,0 +1,16 @@
+def int f(int x)
+    int y, b[3];
+    y = x[1];
+    b = 2;
+    return b
+fed;
+int x, r, a[4];
+x[2] = 1;
+r = x[2];
+r = a;
+r = f(a);
+print a;
+if a < 1 then print r fi;
+a[1] = 5;
+r = a[1] + f(r);
+print r.
@@ -0,0 +1,171 @@
+#!/bin/bash
+# Runs every TestN.cp that has a TestN.expected through each backend and the compiler's modes, diffing
+# what it prints against the expected output (and errors.txt against TestN.errors where there is one)
+#   usage: test cases/run_tests.sh [COMPILER]   (default: builds compiler.cpp into a temp dir)
+# Native runs (--target=x86-64 --link) need an x86-64 host with a C compiler ($CC, default cc), --avx2
+# runs an AVX2 CPU; they're skipped otherwise
+cd "$(dirname "$0")" || exit 1
+work=$(mktemp -d)
+server=
+trap 'if [ -n "$server" ]; then kill $server 2>/dev/null; fi; rm -rf "$work"' EXIT
+
+if [ $# -gt 0 ]; then compiler=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+else
+    echo "Building compiler.cpp"
+    ${CXX:-g++} -std=c++17 -O2 -o "$work/compiler" ../compiler.cpp || exit 1
+    compiler=$work/compiler
+fi
+
+native=0
+if [ "$(uname -m)" = x86_64 ] && command -v "${CC:-cc}" >/dev/null; then native=1; fi
+avx2=0
+if [ $native = 1 ] && grep -qw avx2 /proc/cpuinfo 2>/dev/null; then avx2=1; fi
+
+passed=0
+failed=0
+
+# check NAME EXPECTED_FILE ACTUAL_FILE
+check() {
+    if diff -u "$2" "$3" > "$work/diff"; then passed=$((passed + 1))
+    else
+        failed=$((failed + 1))
+        echo "FAIL $1"
+        head -20 "$work/diff"
+    fi
+}
+
+# What the compiler printed, without its phase messages
+filter() {
+    grep -v -e '^Parsing Done$' -e '^Done Building symbol Table$'
+}
+
+# connectAndRun SOURCE FLAGS... --> like compileAndRun through the compile server at $work/socket
+connectAndRun() {
+    local source=$1
+    shift
+    "$compiler" --connect="$work/socket" --no-parse-tree -o "$work/out" "$@" "$source" 2> "$work/stderr" | filter
+    grep '^Runtime error:' "$work/stderr"
+}
+
+# compileAndRun SOURCE FLAGS... --> the program's output (and any diagnostics) on stdout
+compileAndRun() {
+    local source=$1
+    shift
+    rm -rf "$work/out"
+    "$compiler" --no-parse-tree -o "$work/out" "$@" "$source" 2>&1 | filter
+    if [ -x "$work/out/compile" ]; then "$work/out/compile" 2>&1; fi
+}
+
+modes=("--run" "--run -O0" "--jit --jit-threshold=1" "--run --stream" "--run --no-bce" "--run --no-inline" "--run --no-unroll")
+if [ $native = 1 ]; then modes+=("--target=x86-64 --link" "--target=x86-64 --link -O0"); fi
+if [ $avx2 = 1 ]; then modes+=("--target=x86-64 --link --avx2"); fi
+
+# Every test in every mode
+for expected in Test*.expected; do
+    name=${expected%.expected}
+    for mode in "${modes[@]}"; do
+        compileAndRun "$name.cp" $mode > "$work/actual"
+        check "$name $mode" "$expected" "$work/actual"
+    done
+done
+
+# Diagnostics: errors.txt of every test that has a TestN.errors
+for errors in Test*.errors; do
+    [ -e "$errors" ] || continue
+    name=${errors%.errors}
+    compileAndRun "$name.cp" --emit-tac > /dev/null
+    check "$name errors.txt" "$errors" "$work/out/errors.txt"
+done
+
+# Compilation cache: a second compile is a hit and prints the same
+"$compiler" --no-parse-tree -o "$work/out" --cache="$work/cache" --run Test5.cp > /dev/null 2>&1
+"$compiler" --no-parse-tree -o "$work/out" --cache="$work/cache" --cache-stats --run Test5.cp 2>&1 | filter > "$work/actual"
+grep -q '^Cache: 1 hits, 0 misses' "$work/actual" && echo "cache hit" > "$work/hit" || echo "no cache hit" > "$work/hit"
+echo "cache hit" > "$work/wanted"
+check "cache hit" "$work/wanted" "$work/hit"
+grep -v '^Cache:' "$work/actual" > "$work/cached"
+check "cache output" Test5.expected "$work/cached"
+
+# Batch: every test at once on 2 workers, each file's stdout.txt in its own dir
+"$compiler" --no-parse-tree -o "$work/batch" -j2 --run Test*.cp > /dev/null 2>&1
+for expected in Test*.expected; do
+    name=${expected%.expected}
+    filter < "$work/batch/$name/stdout.txt" > "$work/actual"
+    check "batch $name" "$expected" "$work/actual"
+done
+
+# PGO: the profiled run and the run built from its profile print the same
+compileAndRun Test14.cp --profile-generate="$work/profile" > "$work/actual"
+check "pgo generate" Test14.expected "$work/actual"
+compileAndRun Test14.cp --profile-use="$work/profile" --run > "$work/actual"
+check "pgo use" Test14.expected "$work/actual"
+
+# Bounds check elimination: unchecked loads / stores in the bytecode, none with --no-bce
+compileAndRun Test15.cp --emit-bytecode > /dev/null
+grep -q 'ALOADU\|ASTOREU' "$work/out/compile.txt" && echo yes > "$work/actual" || echo no > "$work/actual"
+echo yes > "$work/wanted"
+check "bounds checks eliminated" "$work/wanted" "$work/actual"
+compileAndRun Test15.cp --emit-bytecode --no-bce > /dev/null
+grep -q 'ALOADU\|ASTOREU' "$work/out/compile.txt" && echo yes > "$work/actual" || echo no > "$work/actual"
+echo no > "$work/wanted"
+check "--no-bce keeps bounds checks" "$work/wanted" "$work/actual"
+
+# Vectorizer: both of Test17's inner loops
+compileAndRun Test17.cp --target=x86-64 --vectorize-report | grep -c '^Vectorized:' > "$work/actual"
+echo 2 > "$work/wanted"
+check "vectorize report" "$work/wanted" "$work/actual"
+
+# Unroller: Test18 has counted loops it takes
+compileAndRun Test18.cp --emit-tac --unroll-report | grep -q '^Unrolled:' && echo yes > "$work/actual" || echo no > "$work/actual"
+echo yes > "$work/wanted"
+check "unroll report" "$work/wanted" "$work/actual"
+
+# Stats: the run phase counts the VM thread's allocations (Test19's 100000 deep frames are over 1 MB)
+compileAndRun Test19.cp --run --stats > /dev/null
+bytes=$(grep '"name": "run"' "$work/out/stats.json" | grep -o '"allocated_bytes": [0-9]*' | grep -o '[0-9]*$')
+[ "${bytes:-0}" -gt 1048576 ] && echo yes > "$work/actual" || echo no > "$work/actual"
+echo yes > "$work/wanted"
+check "run phase allocations" "$work/wanted" "$work/actual"
+
+# Compile server: every test through --connect, then an edit to one file is picked up
+# (the server prints errors.txt to stderr, so only runtime errors are kept from it)
+"$compiler" --serve="$work/socket" > /dev/null 2>&1 &
+server=$!
+for i in $(seq 50); do
+    if [ -S "$work/socket" ]; then break; fi
+    sleep 0.1
+done
+if [ -S "$work/socket" ]; then
+    for expected in Test*.expected; do
+        name=${expected%.expected}
+        connectAndRun "$name.cp" --run > "$work/actual"
+        check "server $name" "$expected" "$work/actual"
+    done
+    cp Test11.cp "$work/edit.cp"
+    connectAndRun "$work/edit.cp" --run > "$work/actual"
+    check "server incremental before edit" Test11.expected "$work/actual"
+    sed 's/return (d \/ 2.0)/return (d \/ 4.0)/' Test11.cp > "$work/edit.cp"
+    connectAndRun "$work/edit.cp" --run > "$work/actual"
+    sed 's/^1.5$/0.75/' Test11.expected > "$work/wanted"
+    check "server incremental after edit" "$work/wanted" "$work/actual"
+else
+    failed=$((failed + 1))
+    echo "FAIL server didn't start"
+fi
+
+# Bad -j values are diagnosed, not thrown
+"$compiler" -j abc Test1.cp > "$work/actual" 2>&1
+echo "exit $?" >> "$work/actual"
+printf 'Unknown option -jabc\nexit 1\n' > "$work/wanted"
+check "-j abc" "$work/wanted" "$work/actual"
+
+# Numeric flags take all of their value and only in range
+for flag in -j2x --inline-budget=5abc --cache-size=-1 --jit-threshold=-1 --unroll-factor=0 --eval-steps=99999999999999999999; do
+    "$compiler" "$flag" Test1.cp > "$work/actual" 2>&1
+    echo "exit $?" >> "$work/actual"
+    printf 'Unknown option %s\nexit 1\n' "$flag" > "$work/wanted"
+    check "$flag" "$work/wanted" "$work/actual"
+done
+
+echo "$passed passed, $failed failed"
+[ $failed = 0 ]